@@ -12,14 +12,46 @@
 #include <algorithm>
 #include <stdlib.h>
 #include <initializer_list>
+#include <vector>
+#include <functional>
+#include <tuple>
+#include <mutex>
+#include <new>
+#include <span>
 #include "value-type.h"
+#include "pool-allocator.h"
+#include "frozen-bst.h"
+#include "thread-pool.h"
 #include <iostream>  
 #include <exception>
+#include <stdexcept>
 
 
-template<class Key, class Value> class bstree; // forward declarations of template classes.
+/*
+ * Balancing policies, selected by bstree's Balance template parameter.
+ *
+ *  unbalanced: the plain CLRS binary search tree. Sorted input degenerates the tree into a linked list.
+ *  red_black:  the CLRS red-black tree. insert_or_assign() and remove() recolor and rotate the nodes on the search path, so
+ *              the height stays below 2 * log2(n + 1), even for sorted input.
+ *  splay:      the self-adjusting tree of Sleator and Tarjan. insert_or_assign() and the other insertions, remove(), and find(),
+ *              floor() and ceiling() on a non-const tree rotate the last node they reach to the root, so recently used keys stay
+ *              near the top. One operation may take O(n), but a sequence of them takes O(log n) amortized per operation, and a
+ *              skewed sequence takes much less.
+ */
+struct unbalanced {};
+struct red_black {};
+struct splay {};
+
+/*
+ * Keys are ordered by Compare, as in std::map. If Compare declares is_transparent (like std::less<>), the lookup methods also accept 
+ * any type that Compare can compare with Key, e.g. std::string_view for std::string keys, so a lookup does not construct a Key.
+ *
+ * Nodes are allocated with the Allocator parameter, a standard allocator that bstree rebinds to its Node type. The default,
+ * pool_allocator, carves nodes out of contiguous slabs and recycles freed nodes through a free list.
+ */
+template<class Key, class Value, class Compare = std::less<Key>, class Balance = unbalanced, class Allocator = pool_allocator<std::pair<const Key, Value>>> class bstree; // forward declarations of template classes.
 
-template<class Key, class Value> class bstree {
+template<class Key, class Value, class Compare, class Balance, class Allocator> class bstree {
 
   public:
 
@@ -31,15 +63,47 @@ template<class Key, class Value> class bstree {
     using difference_type = long int;
     using pointer         = value_type*; 
     using reference       = value_type&; 
+    using key_compare     = Compare;
+    using balance_type    = Balance;
+    using allocator_type  = Allocator;
 
   private:
+    static constexpr bool is_red_black = std::is_same_v<Balance, red_black>;
+    static constexpr bool is_splay     = std::is_same_v<Balance, splay>;
+
+    static constexpr bool has_transparent_compare = requires { typename Compare::is_transparent; };
+
+    enum class Color : char { red, black }; // Only used by the red_black policy.
+
+    class Node;
+
+    using node_allocator_type = typename std::allocator_traits<Allocator>::template rebind_alloc<Node>;
+    using node_traits         = std::allocator_traits<node_allocator_type>;
+
+    /*
+     * Returns a node to the allocator that allocated it. Every node_ptr of a tree points to the same node_allocator_type, which
+     * the tree keeps on the heap so that the pointer stays valid when the tree itself is moved.
+     */
+    struct node_deleter {
+
+        node_allocator_type *alloc = nullptr;
+
+        void operator()(Node *pnode) const noexcept
+        {
+            node_traits::destroy(*alloc, pnode);
+            node_traits::deallocate(*alloc, pnode, 1);
+        }
+    };
+
+    using node_ptr = std::unique_ptr<Node, node_deleter>;
+
    /*
-    * The tree nodes are of type std::unique_ptr<Node>, and each node contains a __value_type member __vt, a convenience 
-      wrapper for access to a pair<const Key, Value>. 
+    * The tree nodes are of type node_ptr, a std::unique_ptr<Node> whose deleter returns the node to the tree's allocator, and each
+      node contains a __value_type member __vt, a convenience wrapper for access to a pair<const Key, Value>. 
     */ 
    class Node {
 
-        friend class bstree<Key, Value>;    
+        friend class bstree<Key, Value, Compare, Balance, Allocator>;    
 
     public:   
         
@@ -48,16 +112,20 @@ template<class Key, class Value> class bstree {
             parent = nullptr;
         }
      
-        // The copy constructor 
-        Node(const Node& lhs);
+        // Nodes are not copied or moved; copy_subtree() copies the tree node by node.
+        Node(const Node& lhs) = delete;
         
-        Node(const Key& key, const Value& value, Node *parent_in=nullptr) : __vt{key, value}, parent{parent_in}, left{nullptr}, right{nullptr} 
+        Node(const Key& key, const Value& value, Node *parent_in=nullptr) : __vt{key, value}, left{nullptr}, right{nullptr}, parent{parent_in}, color{Color::red}, size{1}
         {
         }
-      
-        Node& operator=(const Node&) noexcept; 
 
-        Node(Node&&); // ...but we allow move assignment and move construction.
+        // Constructs the pair<const Key, Value> in place from args, which are forwarded to std::pair's constructor.
+        template<class... Args> Node(Node *parent_in, std::in_place_t, Args&&... args) : __vt(std::in_place, std::forward<Args>(args)...), 
+            left{nullptr}, right{nullptr}, parent{parent_in}, color{Color::red}, size{1}
+        {
+        }
+      
+        Node& operator=(const Node&) = delete; 
         /*
            ~Node() implictily invokes the Node destructor for left and right, which results in the recursive destruction of the entire subtree rooted at *this. However, this can cause the stack to overflow, especially if
            the Node being destructed is the root. To avoid this, ~bstree() calls destroy_subtree(root), which does a post-order traversal, calling node.reset(). 
@@ -79,18 +147,16 @@ template<class Key, class Value> class bstree {
             return ostr;
         }
         
-        Node& operator=(Node&&) noexcept;
-
-        void connectLeft(std::unique_ptr<Node>& node) noexcept
+        void connectLeft(node_ptr& node) noexcept
         {
             left = std::move(node);
             left->parent = this;
         }  
 
-        void connectRight(std::unique_ptr<Node>& node) noexcept 
+        void connectRight(node_ptr& node) noexcept 
         {
-            left = std::move(node);
-            left->parent = this;
+            right = std::move(node);
+            right->parent = this;
         }  
 
     private:
@@ -98,11 +164,15 @@ template<class Key, class Value> class bstree {
         __value_type<Key, Value> __vt;  // Convenience wrapper for std::pair<const Key, Value>
                                         // Has necessary constructors and assignment operators.
                               
-        std::unique_ptr<Node> left;
-        std::unique_ptr<Node> right;
+        node_ptr left;
+        node_ptr right;
 
         Node *parent;
 
+        Color color; // New nodes are red. 
+
+        std::size_t size; // Number of nodes in the subtree rooted at this node.
+
         constexpr const Key& key() const noexcept 
         {
            return __vt.__get_value().first; //  'template<typename _Key, typename _Value> struct __value_type' does not have members first and second.
@@ -154,7 +224,7 @@ template<class Key, class Value> class bstree {
       
       public: 
       
-      LevelOrderPrinter (const bstree<Key, Value>& tree, std::ostream& ostr_in, Printer p):  ostr{ostr_in}, current_level{0}, do_print{p}
+      LevelOrderPrinter (const bstree<Key, Value, Compare, Balance, Allocator>& tree, std::ostream& ostr_in, Printer p):  ostr{ostr_in}, current_level{0}, do_print{p}
       { 
           height_ = tree.height(); 
       }
@@ -179,656 +249,3505 @@ template<class Key, class Value> class bstree {
 
   private: 
 
-    std::unique_ptr<Node> root; 
+    std::shared_ptr<node_allocator_type> node_alloc; // Shared with node handles and with trees produced by split().
+
+    node_ptr root; 
+
+    [[no_unique_address]] Compare comp;
+
+    bool deferred_destroy = false; // See set_deferred_destruction().
+
+    // Keys a and b are equivalent if neither orders before the other.
+    template<class K1, class K2> bool equivalent(const K1& a, const K2& b) const noexcept
+    {
+        return !comp(a, b) && !comp(b, a);
+    }
+
+    template<typename Functor> void DoInOrderTraverse(Functor f, const node_ptr& root) const noexcept;
+    template<typename Functor> void DoPostOrderTraverse(Functor f,  const node_ptr& root) const noexcept;
+    template<typename Functor> void DoPreOrderTraverse(Functor f, const node_ptr& root) const noexcept;
+
+    void copy_tree(const bstree<Key, Value, Compare, Balance, Allocator>& lhs) noexcept;
 
-    int size;
+    node_ptr copy_subtree(const Node *src, Node *parent);
 
-    template<typename Functor> void DoInOrderTraverse(Functor f, const std::unique_ptr<Node>& root) const noexcept;
-    template<typename Functor> void DoPostOrderTraverse(Functor f,  const std::unique_ptr<Node>& root) const noexcept;
-    template<typename Functor> void DoPreOrderTraverse(Functor f, const std::unique_ptr<Node>& root) const noexcept;
+    node_ptr rebuild_subtree(Node *src);
 
-    void copy_tree(const bstree<Key, Value>& lhs) noexcept;
+    template<class MakeNode> static void copy_subtree_into(const Node *src, Node *parent, node_ptr& slot, MakeNode make);
 
-    Node *min(std::unique_ptr<Node>& current) const noexcept
+    void parallel_copy(const bstree& lhs, work_stealing_pool& pool);
+
+    template<class... Args> node_ptr make_node(Args&&... args);
+
+    Node *min(node_ptr& current) const noexcept
     {
         return min(current.get());
     }
 
     Node *min(Node *current) const noexcept;
-    //std::unique_ptr<Node>& min(std::unique_ptr<Node>& current) const noexcept;
+
+    const Node *min(const Node *current) const noexcept
+    {
+        return min(const_cast<Node *>(current));
+    }
+    //node_ptr& min(node_ptr& current) const noexcept;
    
+    Node *max(Node *current) const noexcept;
+
     Node *getSuccessor(const Node *current) const noexcept;
+    Node *getPredecessor(const Node *current) const noexcept;
+
+    template<class K> Node *lower_bound_node(const K& key) const noexcept;
+    template<class K> Node *upper_bound_node(const K& key) const noexcept;
+
+    node_ptr& get_unique_ptr(Node *pnode) noexcept;
 
-    std::unique_ptr<Node>& get_unique_ptr(Node *pnode) noexcept;
+    template<class K> std::pair<bool, const Node *> findNode(const K& key, const Node *current) const noexcept; 
+    template<class K> std::pair<bool, const Node *> findNode_near(const K& key, const Node *finger) const noexcept; 
 
-    std::pair<bool, const Node *> findNode(const key_type& key, const Node *current) const noexcept; 
+    template<class Found> void find_batch_nodes(std::span<const Key> keys, Found found) const noexcept;
+
+    static void prefetch(const Node *pnode) noexcept
+    {
+#if defined(__GNUC__)
+        __builtin_prefetch(pnode);
+        __builtin_prefetch(&pnode->key()); // A large Node may hold its key on the next cache line.
+#else
+        (void) pnode;
+#endif
+    }
 
     int  height(const Node *pnode) const noexcept;
     int  depth(const Node *pnode) const noexcept;
     bool isBalanced(const Node *pnode) const noexcept;
 
-    void move(bstree<Key, Value>&& lhs) noexcept;
+    void move(bstree<Key, Value, Compare, Balance, Allocator>&& lhs) noexcept;
 
     /*-- Changed to return unique_ptr
-    Node *find(Key key, const std::unique_ptr<Node>&) const noexcept;
+    Node *find(Key key, const node_ptr&) const noexcept;
      */
 
-    std::unique_ptr<Node>& find(Key key, std::unique_ptr<Node>&) const noexcept;
+    template<class K> node_ptr& find(const K& key, node_ptr&) const noexcept;
 
-    void destroy_subtree(std::unique_ptr<Node>& subtree_root) noexcept;
+    void destroy_subtree(node_ptr& subtree_root) noexcept;
 
-    Node *get_floor(Key key) const noexcept
+    template<class Drop> static void post_order_drop(node_ptr& subtree, Drop drop) noexcept;
+
+    static void free_subtree(node_ptr& subtree) noexcept
+    {
+        post_order_drop(subtree, [](node_ptr& pnode) { pnode.reset(); });
+    }
+
+    static void release_subtree(node_ptr& subtree, std::mutex& alloc_mutex) noexcept;
+
+    // std::allocator may allocate and deallocate on several threads at once. Other allocators, like pool_allocator, are serialized.
+    static constexpr bool thread_safe_allocator = std::is_same_v<node_allocator_type, std::allocator<Node>>;
+
+    // When the values need no destructor calls, the whole tree can be freed by releasing its pool's slabs. See destroy_subtree().
+    static constexpr bool releasable_pool = std::is_trivially_destructible_v<value_type> && 
+                                            requires (node_allocator_type& alloc) { alloc.owns_pool(); alloc.release(); };
+
+    bool can_release_pool() const noexcept
+    {
+        if constexpr (releasable_pool)
+            return node_alloc.use_count() == 1 && node_alloc->owns_pool();
+        else
+            return false;
+    }
+
+    void destroy_tree() noexcept;
+    bool defer_destroy() noexcept;
+    void parallel_destroy(work_stealing_pool& pool) noexcept;
+
+    template<class K> Node *get_floor(const K& key) const noexcept
     {
       const auto& pnode = get_floor(root, key);
    
       return pnode.get();
     }
 
-    const std::unique_ptr<Node>& get_floor(const std::unique_ptr<Node>& current, Key key) const noexcept;
+    template<class K> const node_ptr& get_floor(const node_ptr& current, const K& key) const noexcept;
     
-    Node *get_ceiling(Key key) const noexcept
+    template<class K> Node *get_ceiling(const K& key) const noexcept
     {
-      const std::unique_ptr<Node>& pnode = get_ceiling(root, key);
+      const node_ptr& pnode = get_ceiling(root, key);
       
       return pnode.get();
     }
     
-    const std::unique_ptr<Node>& get_ceiling(const std::unique_ptr<Node>& current, Key key) const noexcept;
+    template<class K> const node_ptr& get_ceiling(const node_ptr& current, const K& key) const noexcept;
 
-    void transplant(std::unique_ptr<Node>& pnode, std::unique_ptr<Node>& y) noexcept;
-  public:
-/*
+    template<class K> Key floor_key(const K& key) const;
+    template<class K> Key ceiling_key(const K& key) const;
 
-Some of the std::map insert methods:
+    node_ptr transplant(Node *u, node_ptr v) noexcept;
 
-    template< class InputIt >
-    void insert( InputIt first, InputIt last );
-    
-    void insert( std::initializer_list<value_type> ilist );
-    
-    insert_return_type insert(node_type&& nh);
-    
-    iterator insert(const_iterator hint, node_type&& nh);
-    
-    void insert( std::initializer_list<value_type> ilist );
-    
-    insert_return_type insert(node_type&& nh);
-    
-    iterator insert(const_iterator hint, node_type&& nh);
+    node_ptr unlink(Node *z) noexcept;
 
-    template< class InputIt >
-    void insert( InputIt first, InputIt last );
-*/
+    // Red-black helpers. Each rotation returns the node that took the rotated node's position.
+    Node *rotate_left(Node *x) noexcept;
+    Node *rotate_right(Node *x) noexcept;
 
-    //++std::pair<iterator,bool> insert( const value_type& value );
-    //++std::pair<iterator,bool> insert( value_type&& value );
-    
-/*
- From std::map insert_or_assign methods
+    void splay_node(Node *x) noexcept;
 
-    template <class M>
-    pair<iterator, bool> insert_or_assign(const key_type& k, M&& obj);
+    // Splays, and returns, the last node a search for key reaches: the node with key, or else its predecessor or successor.
+    template<class K> Node *splay_search(const K& key) noexcept
+    {
+      auto [found, pnode] = findNode(key, root.get());
 
-    template <class M>
-    pair<iterator, bool> insert_or_assign(key_type&& k, M&& obj);
+      Node *last = const_cast<Node *>(pnode);
 
-    template <class M>
-    iterator insert_or_assign(const_iterator hint, const key_type& k, M&& obj);
+      if (last)
+          splay_node(last);
 
-    template <class M>
-    iterator insert_or_assign(const_iterator hint, key_type&& k, M&& obj);
+      return last;
+    }
 
+    template<class K> bool splay_find(const K& key) noexcept
+    {
+      Node *pnode = splay_search(key);
 
-*/
+      return pnode && equivalent(pnode->key(), key);
+    }
 
-    // One other stl typedef.
-    using node_type       = Node; 
-  
-    bstree() noexcept : root{nullptr}, size{0} { }
+    template<class K> Key splay_floor_key(const K& key);
+    template<class K> Key splay_ceiling_key(const K& key);
 
-    // While the default destructor successfully frees all nodes. A huge recursive call invokes every Node's destructor.
-    // will be invoke in one huge recursive call 
-   ~bstree() noexcept
+    static bool is_red(const Node *pnode) noexcept
     {
-        destroy_subtree(root);
-    } 
-
-    bstree(std::initializer_list<value_type>& list) noexcept; 
+       return pnode != nullptr && pnode->color == Color::red;
+    }
 
-    bstree(const bstree&) noexcept; 
+    static bool is_black(const Node *pnode) noexcept
+    {
+       return !is_red(pnode);
+    }
 
-    bstree(bstree&& lhs) noexcept
+    static std::size_t subtree_size(const Node *pnode) noexcept
     {
-        move(std::move(lhs)); 
+       return pnode ? pnode->size : 0;
     }
 
-    bstree& operator=(const bstree&) noexcept; 
+    // Recomputes pnode->size from its children, which must be up to date.
+    static void update_size(Node *pnode) noexcept
+    {
+       pnode->size = 1 + subtree_size(pnode->left.get()) + subtree_size(pnode->right.get());
+    }
 
-    bstree& operator=(bstree&&) noexcept;
+    template<class ForwardIt> node_ptr build_sorted(ForwardIt& first, ForwardIt last, std::size_t n, Node *parent, int depth, int red_depth);
 
-    bstree<Key, Value> clone() const noexcept; 
+    const Node *select_node(std::size_t k) const noexcept;
+    template<class K> std::size_t count_less(const K& key, bool inclusive) const noexcept;
 
-    bool isEmpty() const noexcept
+    template<class K1, class K2, class Functor> void visit_range(const K1& lo, const K2& hi, Functor& f) const
     {
-      return (size == 0) ? true : false;
+      if (comp(hi, lo))
+          return;
+
+      for (const Node *current = lower_bound_node(lo); current && !comp(hi, current->key()); current = getSuccessor(current))
+          f(current->__vt.__get_value());
     }
 
-    void test_invariant() const noexcept;
+    template<class K1, class K2> std::vector<Key> keys_in_range(const K1& lo, const K2& hi) const
+    {
+      std::vector<Key> result;
 
-    const Value& operator[](Key key) const;
+      result.reserve(count_range(lo, hi));
 
-    Value& operator[](Key key);
+      auto collect = [&result](const value_type& pair) { result.push_back(pair.first); };
 
-    void insert(std::initializer_list<value_type>& list) noexcept; 
+      visit_range(lo, hi, collect);
 
-    bool insert(const key_type& key, const mapped_type& value) noexcept
-    {
-        return insert_or_assign(key, value);
+      return result;
     }
 
-    bool insert_or_assign(const key_type& key, const mapped_type& value) noexcept; // TODO: std::pair<cont Key, Value>
-  
-    // TODO: Add methods that take a pair<const Key, Value>
+    template<class K1, class K2> std::size_t erase_range(const K1& lo, const K2& hi);
 
-    Value& operator[](const Key& key) noexcept; 
+    bool insert_fixup(Node *z) noexcept;
+    void remove_fixup(Node *x, Node *x_parent) noexcept;
 
-    const Value& operator[](const Key& key) const noexcept; 
+    /*
+     * Parallel traversal plan. The in-order sequence is cut into pieces, each either a whole subtree of at most grain nodes or a
+     * single node lying between two such subtrees, and consecutive pieces are grouped into chunks of about grain nodes; chunk c is
+     * pieces[starts[c]] to pieces[starts[c + 1] - 1]. Each chunk is one task.
+     */
+    struct traversal_piece {
 
-    // TODO: Add emplace() methods and other methods like std::map have, like insert_or_assign().
+        const node_ptr *subtree;
+        bool whole;              // If false, only the subtree's root.
+    };
 
-    bool remove(Key key) noexcept
-    {
-        return remove(key, root);
-    } 
- 
-    bool remove(Key key, std::unique_ptr<Node>& root) noexcept; // root of current subtree
+    struct traversal_plan {
 
-    bool find(Key key) const noexcept
-    {
-       return find(key, root) ? true : false;
-    }
+        std::vector<traversal_piece> pieces;
+        std::vector<std::size_t> starts; // Ends with pieces.size().
 
-    Key floor(Key key) const 
-    {
-      if (isEmpty()) 
-          throw new std::logic_error("floor() called with empty tree");
+        std::size_t chunks() const noexcept
+        {
+            return starts.size() - 1;
+        }
+    };
 
-      const Node *pnode = get_floor(key);
-      
-      if (!pnode)
-          throw new std::logic_error("argument to floor() is too small");
-      else 
-           return pnode->key();
-    }
+    static constexpr std::size_t min_parallel_grain = 4096;
 
-    Key ceiling(Key key) const 
-    {
-      if (isEmpty()) 
-          throw new std::logic_error("floor() called with empty tree");
+    // Copies and destructions of trees this large are split over the pool's workers.
+    static constexpr std::size_t parallel_threshold = 16 * min_parallel_grain;
 
-      const Node *pnode = get_ceiling(key);
-       
-      if (!pnode)
-          throw new std::logic_error("argument to ceiling() is too large");
-      else 
-           return pnode->key();
+    // About eight chunks per worker, so that stealing can even out uneven chunks, but never fewer than min_parallel_grain nodes each.
+    std::size_t parallel_grain(const work_stealing_pool& pool) const noexcept
+    {
+        return std::max(min_parallel_grain, size() / (8 * pool.size()));
     }
-    
-    // Breadth-first traversal
-    template<class Functor> void levelOrderTraverse(Functor f) const noexcept;
 
-    // Depth-first traversals
-    template<typename Functor> void inOrderTraverse(Functor f) const noexcept
-    { 
-      return DoInOrderTraverse(f, root); 
-    }
+    traversal_plan plan_traversal(std::size_t grain) const;
 
-    template<typename Functor> void preOrderTraverse(Functor f) const noexcept  
+    // An empty tree sharing alloc, e.g. with the tree it will be split from or joined with.
+    bstree(std::shared_ptr<node_allocator_type> alloc, const Compare& comp_in) noexcept : node_alloc{std::move(alloc)}, root{nullptr}, comp{comp_in} 
     { 
-      return DoPreOrderTraverse(f, root); 
     }
 
-    template<typename Functor> void postOrderTraverse(Functor f) const noexcept
-    { 
-      return DoPostOrderTraverse(f, root); 
-    }
+    int black_height() const noexcept;
 
-    template<typename PrintFunctor> void  printlevelOrder(std::ostream& ostr, PrintFunctor pf) const noexcept;
+    int join3(node_ptr left, int left_height, node_ptr x, node_ptr right, int right_height) noexcept;
 
-    void debug_print(std::ostream& ostr) const noexcept;
+    template<class GoesRight> std::pair<bstree, bstree> split_by(GoesRight goes_right);
 
-    int height() const noexcept;
-    bool isBalanced() const noexcept;
+    static bstree join_trees(bstree& left, bstree& right) noexcept;
+
+    static void reseat(node_ptr& subtree, node_allocator_type *alloc);
 
-    friend std::ostream& operator<<(std::ostream& ostr, const bstree<Key, Value>& tree) noexcept
+    // A subtree detached from its parent becomes a tree: its root must be black, which adds one to its black height if it was red.
+    static node_ptr as_tree(node_ptr subtree, int& height) noexcept
     {
-       std::cout << "{ "; 
-       
-       auto functor = [](const auto& pair) { 
-            const auto&[key, value] = pair;
-            std::cout << key  << ", ";
-       };
-       
-       tree.inOrderTraverse(functor);
-       
-       std::cout << "}\n" << std::flush;
-       return ostr;
+        if (subtree) {
+
+            subtree->parent = nullptr;
+
+            if (is_red_black && is_red(subtree.get())) {
+
+                subtree->color = Color::black;
+                ++height;
+            }
+        }
+
+        return subtree;
     }
-};
 
-template<class Key, class Value>
-bstree<Key, Value>::Node::Node(const Node& lhs) : __vt{lhs.__vt}, left{nullptr}, right{nullptr}
-{
-   if (lhs.parent == nullptr) // If lhs is the root, then set parent to nullptr.
-       parent = nullptr;
+    // Iterates over pointers to pairs as if over the pairs, so that from_sorted() can copy pairs that stay in their trees.
+    struct pair_ptr_iterator {
 
-   // The make_unique<Node> calls will in turn recursively invoke the constructor again, resulting in the entire tree rooted at
-   // lhs being copied.
-   if (lhs.left  != nullptr) { 
+        using iterator_category = std::forward_iterator_tag;
+        using value_type        = typename bstree::value_type;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = const value_type *;
+        using reference         = const value_type&;
 
-       left = std::make_unique<Node>(*lhs.left);    
-       left->parent = this;
-   }
-   
-   if (lhs.right != nullptr) {
+        const value_type *const *p;
 
-       right = std::make_unique<Node>(*lhs.right); 
-       right->parent = this;
-   }
-}
+        reference operator*() const noexcept { return **p; }
+        pointer operator->() const noexcept { return *p; }
 
-template<class Key, class Value> typename bstree<Key, Value>::Node&  bstree<Key, Value>::Node::operator=(const typename bstree<Key, Value>::Node& lhs) noexcept
-{
-   if (&lhs == this) return *this;
+        pair_ptr_iterator& operator++() noexcept { ++p; return *this; }
+        pair_ptr_iterator operator++(int) noexcept { return {p++}; }
 
-   __vt = lhs.__vt;
+        friend bool operator==(const pair_ptr_iterator&, const pair_ptr_iterator&) = default;
+    };
 
-   if (lhs.parent == nullptr) // If we are copying a root pointer, then set parent.
-       parent = nullptr;
+    static bstree merge_walk(const bstree& lhs, const bstree& rhs, bool left_only, bool both, bool right_only);
 
-   // The make_unique<Node> calls below results in the entire tree rooted at lhs being copied.
-   if (lhs.left  != nullptr) { 
+    enum class set_operation { union_of, intersection_of, difference_of };
 
-       left = std::make_unique<Node>(*lhs.left);    
-       left->parent = this;
-   }
-   
-   if (lhs.right != nullptr) {
+    // The nodes a parallel set operation drops. They are chained through empty left links and freed by one thread at the end.
+    struct discard_list {
 
-       right = std::make_unique<Node>(*lhs.right); 
-       right->parent = this;
-   }
-  
-   return *this;
-}
+        std::mutex m;
+        node_ptr head;
 
-template<class Key, class Value> inline bstree<Key, Value>::bstree(std::initializer_list<value_type>& list)  noexcept : bstree()
-{
-   insert(list);
-}
+        void add(node_ptr subtree) noexcept;
+    };
 
-template<class Key, class Value> inline bstree<Key, Value>::bstree(const bstree<Key, Value>& lhs) noexcept
-{ 
-   root = std::make_unique<Node>(*lhs.root); 
-   size = lhs.size;
-}
+    template<class K> void split3(node_ptr t, int height, const K& key, bstree& lower, int& lower_height, bstree& upper,
+                                  int& upper_height, node_ptr& match) noexcept;
 
-template<class Key, class Value> inline void bstree<Key, Value>::move(bstree<Key, Value>&& lhs) noexcept  
-{
-  root = std::move(lhs.root); 
+    bstree combine(bstree a, bstree b, set_operation op, work_stealing_pool& pool, discard_list& discarded) noexcept;
 
-  size = lhs.size;
+    static bstree parallel_set_operation(bstree& lhs, bstree& rhs, set_operation op, work_stealing_pool& pool);
 
-  lhs.size = 0;
-}
+    template<class Functor> void traverse_chunk(Functor& f, const traversal_plan& plan, std::size_t c) const noexcept;
 
-template<class Key, class Value> bstree<Key, Value>& bstree<Key, Value>::operator=(const bstree<Key, Value>& lhs) noexcept
-{
-  if (this == &lhs)  {
-      
-      return *this;
-  }
+  public:
+/*
 
-  // This will implicitly delete all Nodes in 'this', and set root to a duplicate tree of Nodes.
-  root = std::make_unique<Node>(*lhs.root); 
- 
-  size = lhs.size; 
+Some of the std::map insert methods:
 
-  return *this;
-}
+    template< class InputIt >
+    void insert( InputIt first, InputIt last );
+    
+    void insert( std::initializer_list<value_type> ilist );
+    
+    iterator insert(const_iterator hint, node_type&& nh);
 
-template<class Key, class Value> bstree<Key, Value>& bstree<Key, Value>::operator=(bstree<Key, Value>&& lhs) noexcept
-{
-  if (this == &lhs) return *this;
-  
-  move(std::move(lhs)); 
+    template< class InputIt >
+    void insert( InputIt first, InputIt last );
+*/
 
-  return *this;
-}
+    /*
+     * An owning handle to a node extracted from a tree, like std::map::node_type. It shares the allocator of the tree the node came
+     * from, so it may outlive that tree, and inserting it into a tree whose allocator compares equal relinks the node without 
+     * allocating or copying.
+     */
+    class node_handle {
 
-template<class Key, class Value> inline std::ostream& bstree<Key, Value>::Node::print(std::ostream& ostr) const noexcept
-{
-  ostr << "[ " << key() << ", " << value() << "] " << std::flush;  
-  return ostr; 
-}
+        friend class bstree<Key, Value, Compare, Balance, Allocator>;
 
-template<class Key, class Value> std::ostream& bstree<Key, Value>::Node::debug_print(std::ostream& ostr) const noexcept
-{
-   ostr << " {["; 
- 
-   ostr << key() << ']';
+        std::shared_ptr<node_allocator_type> alloc; // Declared before pnode, so it is destroyed after it.
+        node_ptr pnode;
 
-   if (parent) 
-      ostr << ", parent->key() =" << parent->key(); 
-   else
-      ostr << ", parent = nullptr";
- 
-   if (!left) 
-     ostr << ", left = nullptr";
-   else
-      ostr << ", left->key() = " <<  left->key();
-   
-   if (!right) 
-     ostr << ", right = nullptr";
-   else
-      ostr << ", right->key() = " << right->key();
-   
-   ostr << "}";
- 
-   return ostr;
-}
+        node_handle(node_ptr pnode_in, std::shared_ptr<node_allocator_type> alloc_in) noexcept : alloc{std::move(alloc_in)}, 
+            pnode{std::move(pnode_in)}
+        {
+        }
 
-template<typename Key, typename Value> 
-template<typename PrintFunctor>
-void  bstree<Key, Value>::printlevelOrder(std::ostream& ostr, PrintFunctor print_functor) const noexcept
-{
-  LevelOrderPrinter<PrintFunctor> tree_printer(*this, ostr, print_functor);  
-  
-  levelOrderTraverse(tree_printer);
-  
-  ostr << std::flush;
-}
+      public:
 
-template<typename Key, typename Value> inline void  bstree<Key, Value>::debug_print(std::ostream& ostr) const noexcept
-{
-  auto node_debug_printer = [&ostr] (const Node *current) { current->debug_print(ostr); };
+        using key_type       = Key;
+        using mapped_type    = Value;
+        using allocator_type = Allocator;
 
-  printlevelOrder(ostr, node_debug_printer);  
-  
-  ostr << std::flush;
+        node_handle() noexcept = default;
+
+        node_handle(node_handle&&) noexcept = default;
+
+        node_handle& operator=(node_handle&& lhs) noexcept
+        {
+            pnode.reset(); // while its allocator is still alive
+
+            alloc = std::move(lhs.alloc);
+            pnode = std::move(lhs.pnode);
+            return *this;
+        }
+
+        bool empty() const noexcept
+        {
+            return pnode == nullptr;
+        }
+
+        explicit operator bool() const noexcept
+        {
+            return pnode != nullptr;
+        }
+
+        // As with std::map's node handles, the key may be modified before the node is inserted again.
+        Key& key() const noexcept
+        {
+            return const_cast<Key&>(pnode->key());
+        }
+
+        Value& mapped() const noexcept
+        {
+            return pnode->value();
+        }
+
+        allocator_type get_allocator() const
+        {
+            return allocator_type(*alloc);
+        }
+    };
+
+    using node_type = node_handle; 
+
+    /*
+     * Bidirectional iterator that visits the keys in ascending order. Incrementing follows getSuccessor() and decrementing follows 
+     * getPredecessor(), both of which use the parent pointers, so an iterator is just a Node pointer plus the tree (which 
+     * operator--() needs to step back from end()). end() is the nullptr node.
+     *
+     * Iterators stay valid until the node they refer to is removed.
+     */
+    template<bool IsConst> class tree_iterator {
+
+        friend class bstree<Key, Value, Compare, Balance, Allocator>;
+
+        using node_pointer = std::conditional_t<IsConst, const Node *, Node *>;
+        using tree_pointer = const bstree<Key, Value, Compare, Balance, Allocator> *;
+
+        node_pointer current;
+        tree_pointer tree;
+
+        tree_iterator(node_pointer pnode, tree_pointer ptree) noexcept : current{pnode}, tree{ptree} {}
+
+      public:
+
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type        = typename bstree<Key, Value, Compare, Balance, Allocator>::value_type;
+        using difference_type   = typename bstree<Key, Value, Compare, Balance, Allocator>::difference_type;
+        using pointer           = std::conditional_t<IsConst, const value_type *, value_type *>;
+        using reference         = std::conditional_t<IsConst, const value_type&, value_type&>;
+
+        tree_iterator() noexcept : current{nullptr}, tree{nullptr} {}
+
+        // An iterator converts to a const_iterator.
+        template<bool RhsConst, class = std::enable_if_t<IsConst && !RhsConst>> 
+        tree_iterator(const tree_iterator<RhsConst>& lhs) noexcept : current{lhs.current}, tree{lhs.tree} {}
+
+        reference operator*() const noexcept
+        {
+            return current->__vt.__get_value();
+        }
+
+        pointer operator->() const noexcept
+        {
+            return &current->__vt.__get_value();
+        }
+
+        tree_iterator& operator++() noexcept
+        {
+            current = tree->getSuccessor(current);
+            return *this;
+        }
+
+        tree_iterator operator++(int) noexcept
+        {
+            tree_iterator tmp{*this};
+            ++*this;
+            return tmp;
+        }
+
+        tree_iterator& operator--() noexcept
+        {
+            current = current ? tree->getPredecessor(current) : tree->max(tree->root.get());
+            return *this;
+        }
+
+        tree_iterator operator--(int) noexcept
+        {
+            tree_iterator tmp{*this};
+            --*this;
+            return tmp;
+        }
+
+        friend bool operator==(const tree_iterator& lhs, const tree_iterator& rhs) noexcept
+        {
+            return lhs.current == rhs.current;
+        }
+
+        template<bool> friend class tree_iterator;
+    };
+
+    using iterator               = tree_iterator<false>;
+    using const_iterator         = tree_iterator<true>;
+    using reverse_iterator       = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+    struct insert_return_type {
+
+        iterator  position;
+        bool      inserted;
+        node_type node;     // The handle passed to insert(), if its key was already present.
+    };
+
+  private:
+
+    Node *link_node(node_ptr node, Node *parent) noexcept;
+
+    /*
+     * True if this tree's allocator may deallocate the nodes that alloc allocated, so that they can be relinked into this tree rather
+     * than moved into new nodes: if the allocators compare equal, or if this tree's allocator adopts alloc's memory, as
+     * pool_allocator::adopt() does.
+     */
+    bool can_adopt(node_allocator_type& alloc)
+    {
+        if (alloc == *node_alloc)
+            return true;
+
+        if constexpr (requires { node_alloc->adopt(alloc); })
+            return node_alloc->adopt(alloc);
+        else
+            return false;
+    }
+
+    node_ptr adopt(node_ptr& node);
+
+    template<class K> node_type extract_key(const K& key) noexcept
+    {
+      node_ptr& pnode = find(key, root);
+
+      if (!pnode)
+          return node_type{};
+
+      return node_type{unlink(pnode.get()), node_alloc};
+    }
+
+    // The search for key starts at finger (see findNode_near()); root.get() searches from the root as usual.
+    template<class K, class... Args> std::pair<iterator, bool> try_emplace_key(const Node *finger, K&& key, Args&&... args);
+
+    template<class K, class M> std::pair<iterator, bool> insert_or_assign_key(const Node *finger, K&& key, M&& obj);
+
+    // A hint of end() has no node to start from.
+    const Node *finger_of(const_iterator hint) const noexcept
+    {
+      return hint.current ? hint.current : root.get();
+    }
+
+  public:
+  
+    bstree() : node_alloc{std::make_shared<node_allocator_type>()}, root{nullptr}, comp{} { }
+
+    explicit bstree(const Allocator& alloc) : node_alloc{std::make_shared<node_allocator_type>(alloc)}, root{nullptr}, comp{} { }
+
+    explicit bstree(const Compare& comp_in, const Allocator& alloc = Allocator()) : node_alloc{std::make_shared<node_allocator_type>(alloc)},
+       root{nullptr}, comp{comp_in} { }
+
+    // While the default destructor successfully frees all nodes. A huge recursive call invokes every Node's destructor.
+    // will be invoke in one huge recursive call 
+   ~bstree() noexcept
+    {
+        destroy_tree();
+    } 
+
+    bstree(std::initializer_list<value_type>& list) noexcept; 
+
+    /*
+     * Bulk construction. [first, last) holds key/value pairs sorted by ascending key (e.g. std::pair<Key, Value>). When a key repeats,
+     * the last pair wins, as if the pairs had been inserted with insert_or_assign(). The tree is built bottom-up in O(n) time with 
+     * one node allocation per key, in key order, and is perfectly balanced.
+     */
+    template<class ForwardIt> static bstree from_sorted(ForwardIt first, ForwardIt last, const Compare& comp = Compare(),
+                                                        const Allocator& alloc = Allocator());
+
+    // Same as from_sorted(), but [first, last) may be in any order. The pairs are copied and sorted first: O(n log n).
+    template<class InputIt> static bstree from_unsorted(InputIt first, InputIt last, const Compare& comp = Compare(),
+                                                        const Allocator& alloc = Allocator());
+
+    bstree(const bstree&) noexcept; 
+
+    bstree(bstree&& lhs) noexcept : node_alloc{lhs.node_alloc}, root{nullptr}, comp{lhs.comp}
+    {
+        move(std::move(lhs)); 
+    }
+
+    bstree& operator=(const bstree&) noexcept; 
+
+    bstree& operator=(bstree&&) noexcept;
+
+    /*
+     * Copying. The copy constructor and copy assignment copy a tree of parallel_threshold or more nodes on the shared
+     * work_stealing_pool: the nodes near the root are copied first, and each remaining subtree is copied by a task of its own. clone()
+     * always copies this way, on the given pool.
+     */
+    bstree<Key, Value, Compare, Balance, Allocator> clone(work_stealing_pool& pool = work_stealing_pool::instance()) const; 
+
+    /*
+     * Destruction. A tree of parallel_threshold or more nodes is destroyed by the shared work_stealing_pool, one subtree per task.
+     *
+     * With deferred destruction on, the destructor and the assignments do not wait: they hand the old nodes to a pool worker and
+     * return at once. That worker frees the nodes while this tree may already allocate new ones, so the allocator must allow it: it
+     * must be std::allocator, or an allocator that this tree alone uses (as with a default-constructed pool_allocator), in which
+     * case the allocator goes with the old nodes and the tree gets a new, default-constructed one. Otherwise the nodes are destroyed
+     * at once, as usual. Trees with static storage duration should not defer, as the pool may be gone by the time they are destroyed.
+     */
+    void set_deferred_destruction(bool on) noexcept
+    {
+      deferred_destroy = on;
+    }
+
+    bool deferred_destruction() const noexcept
+    {
+      return deferred_destroy;
+    }
+
+    key_compare key_comp() const
+    {
+      return comp;
+    }
+
+    allocator_type get_allocator() const noexcept
+    {
+      return allocator_type(*node_alloc);
+    }
+
+    bool isEmpty() const noexcept
+    {
+      return (root == nullptr) ? true : false;
+    }
+
+    std::size_t size() const noexcept
+    {
+      return subtree_size(root.get());
+    }
+
+    iterator begin() noexcept
+    {
+      return iterator{root ? min(root.get()) : nullptr, this};
+    }
+
+    const_iterator begin() const noexcept
+    {
+      return const_iterator{root ? min(root.get()) : nullptr, this};
+    }
+
+    iterator end() noexcept
+    {
+      return iterator{nullptr, this};
+    }
+
+    const_iterator end() const noexcept
+    {
+      return const_iterator{nullptr, this};
+    }
+
+    const_iterator cbegin() const noexcept { return begin(); }
+    const_iterator cend() const noexcept { return end(); }
+
+    reverse_iterator rbegin() noexcept { return reverse_iterator{end()}; }
+    reverse_iterator rend() noexcept { return reverse_iterator{begin()}; }
+
+    const_reverse_iterator rbegin() const noexcept { return const_reverse_iterator{end()}; }
+    const_reverse_iterator rend() const noexcept { return const_reverse_iterator{begin()}; }
+
+    /*
+     * Each lookup method has a const Key& overload and, when Compare is transparent, a template overload taking any K comparable with
+     * Key, so callers holding e.g. a std::string_view or const char * need not construct a Key.
+     */
+
+    // Returns an iterator to the first key not less than key.
+    iterator lower_bound(const Key& key) noexcept
+    {
+      return iterator{lower_bound_node(key), this};
+    }
+
+    const_iterator lower_bound(const Key& key) const noexcept
+    {
+      return const_iterator{lower_bound_node(key), this};
+    }
+
+    template<class K> requires has_transparent_compare iterator lower_bound(const K& key) noexcept
+    {
+      return iterator{lower_bound_node(key), this};
+    }
+
+    template<class K> requires has_transparent_compare const_iterator lower_bound(const K& key) const noexcept
+    {
+      return const_iterator{lower_bound_node(key), this};
+    }
+
+    // Returns an iterator to the first key greater than key.
+    iterator upper_bound(const Key& key) noexcept
+    {
+      return iterator{upper_bound_node(key), this};
+    }
+
+    const_iterator upper_bound(const Key& key) const noexcept
+    {
+      return const_iterator{upper_bound_node(key), this};
+    }
+
+    template<class K> requires has_transparent_compare iterator upper_bound(const K& key) noexcept
+    {
+      return iterator{upper_bound_node(key), this};
+    }
+
+    template<class K> requires has_transparent_compare const_iterator upper_bound(const K& key) const noexcept
+    {
+      return const_iterator{upper_bound_node(key), this};
+    }
+
+    std::pair<iterator, iterator> equal_range(const Key& key) noexcept
+    {
+      return {lower_bound(key), upper_bound(key)};
+    }
+
+    std::pair<const_iterator, const_iterator> equal_range(const Key& key) const noexcept
+    {
+      return {lower_bound(key), upper_bound(key)};
+    }
+
+    template<class K> requires has_transparent_compare std::pair<iterator, iterator> equal_range(const K& key) noexcept
+    {
+      return {lower_bound(key), upper_bound(key)};
+    }
+
+    template<class K> requires has_transparent_compare std::pair<const_iterator, const_iterator> equal_range(const K& key) const noexcept
+    {
+      return {lower_bound(key), upper_bound(key)};
+    }
+
+    // Removes the node at pos and returns an iterator to its successor.
+    iterator erase(const_iterator pos) noexcept
+    {
+      Node *pnode = const_cast<Node *>(pos.current);
+
+      Node *successor = getSuccessor(pnode);
+
+      unlink(pnode);
+
+      return iterator{successor, this};
+    }
+
+    /*
+     * Node handles. extract() unlinks a node and hands it over, still allocated, in a node_type; insert(node_type&&) and merge() link
+     * existing nodes into this tree. Nothing is allocated or copied when the allocators of the two trees compare equal, e.g. when 
+     * both trees were constructed with copies of one pool_allocator, or when this tree's allocator can adopt the other's memory, as
+     * pool_allocator always can: this tree's pool then keeps the other pool's slabs until it is released. Otherwise each key and
+     * value is moved into a new node.
+     */
+    node_type extract(const_iterator pos) noexcept
+    {
+      return node_type{unlink(const_cast<Node *>(pos.current)), node_alloc};
+    }
+
+    // Returns an empty handle if key is not present.
+    node_type extract(const Key& key) noexcept
+    {
+      return extract_key(key);
+    }
+
+    template<class K> requires has_transparent_compare node_type extract(const K& key) noexcept
+    {
+      return extract_key(key);
+    }
+
+    // If nh's key is already present, nh is returned in node.
+    insert_return_type insert(node_type&& nh);
+
+    // Moves into this tree every node of source whose key is not present here. The other nodes stay in source.
+    void merge(bstree& source);
+
+    void merge(bstree&& source)
+    {
+      merge(source);
+    }
+
+    /*
+     * Order statistics. Every node records the size of its subtree, so these run in O(height) (like select() and rank() in
+     * java-bst.java).
+     */
+
+    // Returns the key of rank k, the key that has exactly k smaller keys in the tree.
+    Key select(std::size_t k) const
+    {
+      const Node *pnode = select_node(k);
+
+      if (!pnode)
+          throw std::out_of_range("argument to select() is invalid");
+
+      return pnode->key();
+    }
+
+    // Returns an iterator to the node of rank k, or end() if k >= size().
+    iterator nth(std::size_t k) noexcept
+    {
+      return iterator{const_cast<Node *>(select_node(k)), this};
+    }
+
+    const_iterator nth(std::size_t k) const noexcept
+    {
+      return const_iterator{select_node(k), this};
+    }
+
+    // Returns the number of keys less than key.
+    std::size_t rank(const Key& key) const noexcept
+    {
+      return count_less(key, false);
+    }
+
+    template<class K> requires has_transparent_compare std::size_t rank(const K& key) const noexcept
+    {
+      return count_less(key, false);
+    }
+
+    // Returns the number of keys in [lo, hi].
+    std::size_t count_range(const Key& lo, const Key& hi) const noexcept
+    {
+      if (comp(hi, lo)) 
+          return 0;
+
+      return count_less(hi, true) - count_less(lo, false);
+    }
+
+    template<class K1, class K2> requires has_transparent_compare std::size_t count_range(const K1& lo, const K2& hi) const noexcept
+    {
+      if (comp(hi, lo)) 
+          return 0;
+
+      return count_less(hi, true) - count_less(lo, false);
+    }
+
+    /*
+     * Range queries over the keys in [lo, hi]. They start at lower_bound(lo) and follow successors until a key exceeds hi, so only the
+     * O(height) nodes on the way down and the k nodes in the range are visited (java-bst.java's keys(lo, hi) prunes the same way).
+     * count_range() above counts a range without visiting it.
+     */
+
+    // Calls f(value) for each key in [lo, hi], in ascending order.
+    template<class Functor> void for_each_in_range(const Key& lo, const Key& hi, Functor f) const
+    {
+      visit_range(lo, hi, f);
+    }
+
+    template<class K1, class K2, class Functor> requires has_transparent_compare void for_each_in_range(const K1& lo, const K2& hi, Functor f) const
+    {
+      visit_range(lo, hi, f);
+    }
+
+    // Returns the keys in [lo, hi] in ascending order.
+    std::vector<Key> keys(const Key& lo, const Key& hi) const
+    {
+      return keys_in_range(lo, hi);
+    }
+
+    template<class K1, class K2> requires has_transparent_compare std::vector<Key> keys(const K1& lo, const K2& hi) const
+    {
+      return keys_in_range(lo, hi);
+    }
+
+    // Removes the keys in [lo, hi] and returns how many there were. The range is split off and the rest joined: O(height + k).
+    std::size_t erase(const Key& lo, const Key& hi)
+    {
+      return erase_range(lo, hi);
+    }
+
+    template<class K1, class K2> requires has_transparent_compare std::size_t erase(const K1& lo, const K2& hi)
+    {
+      return erase_range(lo, hi);
+    }
+
+    /*
+     * Split and join relink the existing nodes, fixing their parent pointers and subtree sizes, instead of copying them. Both run in
+     * O(height). For red-black trees they use the join of problem 13-2 in Introduction to Algorithms, 3rd Edition: to join
+     * left < x < right, walk down the inner spine of the taller tree to the black node whose black height equals the shorter tree's,
+     * put x, colored red, in its place with that node and the shorter tree as children, and let insert_fixup() repair a red-red
+     * violation. A split walks down to the split point and joins the subtrees hanging off the path on the way back up; the black
+     * heights of consecutive joins telescope, so the whole split costs O(height) (Tarjan, Data Structures and Network Algorithms).
+     */
+
+    // Moves the keys less than key into the first tree and the rest into the second. This tree is left empty. Both trees share
+    // this tree's allocator.
+    std::pair<bstree, bstree> split(const Key& key)
+    {
+      return split_by([this, &key](const Key& k) { return !comp(k, key); });
+    }
+
+    template<class K> requires has_transparent_compare std::pair<bstree, bstree> split(const K& key)
+    {
+      return split_by([this, &key](const Key& k) { return !comp(k, key); });
+    }
+
+    /*
+     * Returns a tree with the entries of left and right, leaving both empty. Every key of left must be less than every key of right,
+     * or std::invalid_argument is thrown. Only trees that share an allocator, as trees produced by one split() do, are joined in
+     * O(height). Otherwise right's nodes must first be handed to left's allocator, in O(size(right)): they are relinked if left's
+     * allocator compares equal to right's or can adopt its memory, as pool_allocator can, and else right is rebuilt, in the same
+     * shape, from new nodes that its entries are moved into. Either way the result is no taller than the taller of the two trees
+     * plus one.
+     */
+    static bstree join(bstree&& left, bstree&& right);
+
+    /*
+     * Set operations on the keys of two trees. Both trees are walked in order, like std::set_union() and friends walk two sorted
+     * ranges, and the result is built by from_sorted(): O(size(lhs) + size(rhs)) time, one allocation per resulting key, and a
+     * perfectly balanced result. When a key is in both trees, the result takes lhs's value. The result uses a copy of lhs's
+     * allocator, as a copy of lhs would, and lhs's comparator, which must order the keys like rhs's.
+     */
+    static bstree set_union(const bstree& lhs, const bstree& rhs)
+    {
+      return merge_walk(lhs, rhs, true, true, true);
+    }
+
+    static bstree set_intersection(const bstree& lhs, const bstree& rhs)
+    {
+      return merge_walk(lhs, rhs, false, true, false);
+    }
+
+    // The keys of lhs that are not in rhs.
+    static bstree set_difference(const bstree& lhs, const bstree& rhs)
+    {
+      return merge_walk(lhs, rhs, true, false, false);
+    }
+
+    /*
+     * The same operations on red-black trees, by divide and conquer on the pool, after Blelloch, Ferizovic and Sun, "Just Join for
+     * Parallel Ordered Sets" (SPAA 2016). To unite a and b, split b by the key of a's root, unite a's left subtree with the lower
+     * part and a's right subtree with the upper part in parallel, and join the two results with a's root in between. The nodes are
+     * relinked, not copied, so lhs and rhs are consumed (left empty) and nodes are neither allocated nor, until the end, freed. For
+     * m = min(size(lhs), size(rhs)) and n the larger size this takes O(m log(n / m + 1)) work, which beats the linear walk when one
+     * tree is much smaller than the other, and O(log^2 n) span. Below 2 * min_parallel_grain entries a step runs sequentially.
+     *
+     * The nodes must move between the trees, so lhs and rhs must share an allocator, as trees split from one tree do, or have
+     * allocators that compare equal or that lhs's allocator can adopt, as pool_allocator can (rhs's nodes are then told about lhs's
+     * allocator, in O(size(rhs))). Otherwise, and for the unbalanced and splay policies, whose height does not bound the recursion,
+     * the linear walk above runs and lhs and rhs are cleared.
+     */
+    static bstree parallel_union(bstree&& lhs, bstree&& rhs, work_stealing_pool& pool = work_stealing_pool::instance())
+    {
+      return parallel_set_operation(lhs, rhs, set_operation::union_of, pool);
+    }
+
+    static bstree parallel_intersection(bstree&& lhs, bstree&& rhs, work_stealing_pool& pool = work_stealing_pool::instance())
+    {
+      return parallel_set_operation(lhs, rhs, set_operation::intersection_of, pool);
+    }
+
+    static bstree parallel_difference(bstree&& lhs, bstree&& rhs, work_stealing_pool& pool = work_stealing_pool::instance())
+    {
+      return parallel_set_operation(lhs, rhs, set_operation::difference_of, pool);
+    }
+
+    void test_invariant() const noexcept;
+
+    void insert(std::initializer_list<value_type>& list) noexcept; 
+
+    bool insert(const key_type& key, const mapped_type& value) noexcept
+    {
+        return insert_or_assign(key, value).second;
+    }
+
+    /*
+     * The methods below follow std::map. Keys and values are forwarded into the node, so rvalue arguments are moved rather than 
+     * copied, and, except for emplace(), nothing is allocated or constructed when the key is already present.
+     */
+
+    // Inserts pr unless its key is present. The key is copied (it is const), the value is moved.
+    std::pair<iterator, bool> insert(value_type&& pr)
+    {
+        return try_emplace_key(root.get(), pr.first, std::move(pr.second));
+    }
+
+    std::pair<iterator, bool> insert(const value_type& pr)
+    {
+        return try_emplace_key(root.get(), pr.first, pr.second);
+    }
+
+    // For pairs like std::pair<Key, Value>, whose key can also be moved.
+    template<class P> requires std::is_constructible_v<value_type, P&&> std::pair<iterator, bool> insert(P&& pr)
+    {
+        return emplace(std::forward<P>(pr));
+    }
+
+    // Constructs a pair<const Key, Value> from args. The node is built before the search (its key is needed), and is destroyed if 
+    // the key is already present.
+    template<class... Args> std::pair<iterator, bool> emplace(Args&&... args);
+
+    // If key is not present, inserts a value constructed from args; otherwise does nothing, and args are not moved from.
+    template<class... Args> std::pair<iterator, bool> try_emplace(const key_type& key, Args&&... args)
+    {
+        return try_emplace_key(root.get(), key, std::forward<Args>(args)...);
+    }
+
+    template<class... Args> std::pair<iterator, bool> try_emplace(key_type&& key, Args&&... args)
+    {
+        return try_emplace_key(root.get(), std::move(key), std::forward<Args>(args)...);
+    }
+
+    template<class K, class... Args> requires has_transparent_compare && std::is_constructible_v<Key, K&&> 
+    std::pair<iterator, bool> try_emplace(K&& key, Args&&... args)
+    {
+        return try_emplace_key(root.get(), std::forward<K>(key), std::forward<Args>(args)...);
+    }
+
+    // Assigns obj to key's value if key is present, and otherwise inserts it. second is true if a node was inserted.
+    template<class M> std::pair<iterator, bool> insert_or_assign(const key_type& key, M&& obj)
+    {
+        return insert_or_assign_key(root.get(), key, std::forward<M>(obj));
+    }
+
+    template<class M> std::pair<iterator, bool> insert_or_assign(key_type&& key, M&& obj)
+    {
+        return insert_or_assign_key(root.get(), std::move(key), std::forward<M>(obj));
+    }
+
+    template<class K, class M> requires has_transparent_compare && std::is_constructible_v<Key, K&&> 
+    std::pair<iterator, bool> insert_or_assign(K&& key, M&& obj)
+    {
+        return insert_or_assign_key(root.get(), std::forward<K>(key), std::forward<M>(obj));
+    }
+
+    /*
+     * Hinted insertion. Unlike std::map, where the hint only pays off if key belongs right before it, the search for key starts at 
+     * hint, wherever it is, and climbs through parent links only as far as needed (see find_near()). Passing the iterator the previous
+     * insertion returned makes runs of nearby keys, such as an append-mostly time series, cheap. A hint of end() searches from the root.
+     */
+    template<class M> iterator insert_or_assign(const_iterator hint, const key_type& key, M&& obj)
+    {
+        return insert_or_assign_key(finger_of(hint), key, std::forward<M>(obj)).first;
+    }
+
+    template<class M> iterator insert_or_assign(const_iterator hint, key_type&& key, M&& obj)
+    {
+        return insert_or_assign_key(finger_of(hint), std::move(key), std::forward<M>(obj)).first;
+    }
+
+    iterator insert(const_iterator hint, const key_type& key, const mapped_type& value)
+    {
+        return insert_or_assign(hint, key, value);
+    }
+
+    template<class... Args> iterator try_emplace(const_iterator hint, const key_type& key, Args&&... args)
+    {
+        return try_emplace_key(finger_of(hint), key, std::forward<Args>(args)...).first;
+    }
+
+    template<class... Args> iterator try_emplace(const_iterator hint, key_type&& key, Args&&... args)
+    {
+        return try_emplace_key(finger_of(hint), std::move(key), std::forward<Args>(args)...).first;
+    }
+
+    // Returns the value of key, inserting a value-initialized one first if key is not present.
+    Value& operator[](const Key& key)
+    {
+        return try_emplace_key(root.get(), key).first->second;
+    }
+
+    Value& operator[](Key&& key)
+    {
+        return try_emplace_key(root.get(), std::move(key)).first->second;
+    }
+
+    // Throws std::out_of_range if key is not present.
+    const Value& operator[](const Key& key) const
+    {
+        auto [found, pnode] = findNode(key, root.get());
+
+        if (!found)
+            throw std::out_of_range("key passed to operator[] const is not in the tree");
+
+        return pnode->value();
+    }
+
+    // With the splay policy, key (or the last node its search reaches) is splayed first, so the node to remove is the root.
+    bool remove(const Key& key) noexcept
+    {
+        if constexpr (is_splay)
+            splay_search(key);
+
+        return remove(key, root);
+    } 
+
+    template<class K> requires has_transparent_compare bool remove(const K& key) noexcept
+    {
+        if constexpr (is_splay)
+            splay_search(key);
+
+        return remove(key, root);
+    } 
+ 
+    template<class K> bool remove(const K& key, node_ptr& root) noexcept; // root of current subtree
+
+    bool find(const Key& key) const noexcept
+    {
+       return findNode(key, root.get()).first;
+    }
+
+    template<class K> requires has_transparent_compare bool find(const K& key) const noexcept
+    {
+       return findNode(key, root.get()).first;
+    }
+
+    /*
+     * With the splay policy, find(), floor() and ceiling() on a non-const tree splay the last node of the search to the root. Their
+     * const overloads above leave the tree alone, so concurrent readers of a const tree stay safe.
+     */
+    bool find(const Key& key) noexcept requires is_splay
+    {
+       return splay_find(key);
+    }
+
+    template<class K> requires has_transparent_compare && is_splay bool find(const K& key) noexcept
+    {
+       return splay_find(key);
+    }
+
+    Key floor(const Key& key) requires is_splay
+    {
+      return splay_floor_key(key);
+    }
+
+    template<class K> requires has_transparent_compare && is_splay Key floor(const K& key)
+    {
+      return splay_floor_key(key);
+    }
+
+    Key ceiling(const Key& key) requires is_splay
+    {
+      return splay_ceiling_key(key);
+    }
+
+    template<class K> requires has_transparent_compare && is_splay Key ceiling(const K& key)
+    {
+      return splay_ceiling_key(key);
+    }
+
+    /*
+     * Looks up every key in keys and stores a pointer to its value, or nullptr if it is absent, in the same position of values, which
+     * must be at least as long. The searches run find_batch_width at a time, interleaved: each step advances every search one level
+     * and prefetches the child it moves to, so that the cache misses of different searches overlap instead of following one another.
+     * On a tree much larger than the cache this hides most of the memory latency that bounds a sequential find().
+     */
+    static constexpr std::size_t find_batch_width = 16;
+
+    void find_batch(std::span<const Key> keys, std::span<Value *> values) noexcept
+    {
+      find_batch_nodes(keys, [&values](std::size_t i, const Node *pnode) {
+          values[i] = pnode ? const_cast<Value *>(&pnode->value()) : nullptr;
+      });
+    }
+
+    void find_batch(std::span<const Key> keys, std::span<const Value *> values) const noexcept
+    {
+      find_batch_nodes(keys, [&values](std::size_t i, const Node *pnode) {
+          values[i] = pnode ? &pnode->value() : nullptr;
+      });
+    }
+
+    /*
+     * Finger search: returns an iterator to key, or end() if it is absent, searching from finger rather than from the root. The cost
+     * grows with the distance between finger and key, not with the size of the tree. finger may be any iterator of this tree; end()
+     * searches from the root.
+     */
+    iterator find_near(const_iterator finger, const Key& key) noexcept
+    {
+      auto [found, pnode] = findNode_near(key, finger_of(finger));
+
+      return iterator{found ? const_cast<Node *>(pnode) : nullptr, this};
+    }
+
+    const_iterator find_near(const_iterator finger, const Key& key) const noexcept
+    {
+      auto [found, pnode] = findNode_near(key, finger_of(finger));
+
+      return const_iterator{found ? pnode : nullptr, this};
+    }
+
+    template<class K> requires has_transparent_compare iterator find_near(const_iterator finger, const K& key) noexcept
+    {
+      auto [found, pnode] = findNode_near(key, finger_of(finger));
+
+      return iterator{found ? const_cast<Node *>(pnode) : nullptr, this};
+    }
+
+    template<class K> requires has_transparent_compare const_iterator find_near(const_iterator finger, const K& key) const noexcept
+    {
+      auto [found, pnode] = findNode_near(key, finger_of(finger));
+
+      return const_iterator{found ? pnode : nullptr, this};
+    }
+
+    Key floor(const Key& key) const 
+    {
+      return floor_key(key);
+    }
+
+    template<class K> requires has_transparent_compare Key floor(const K& key) const 
+    {
+      return floor_key(key);
+    }
+
+    Key ceiling(const Key& key) const 
+    {
+      return ceiling_key(key);
+    }
+
+    template<class K> requires has_transparent_compare Key ceiling(const K& key) const 
+    {
+      return ceiling_key(key);
+    }
+    
+    // Returns an immutable, array-laid-out copy of the tree for read-mostly lookups. See frozen-bst.h.
+    frozen_bstree<Key, Value, Compare> freeze() const
+    {
+      return frozen_bstree<Key, Value, Compare>(begin(), size(), comp);
+    }
+
+    /*
+     * Binary serialization for trivially copyable Key and Value. serialize() writes the layout of freeze() in the format of
+     * frozen_bstree::write(), and deserialize() reads it back and rebuilds the tree with from_sorted() in O(n), one allocation per
+     * key. To serve lookups from such a file without rebuilding any nodes, map it with frozen_bstree::map() instead.
+     */
+    void serialize(std::ostream& ostr) const requires (std::is_trivially_copyable_v<Key> && std::is_trivially_copyable_v<Value>)
+    {
+      freeze().write(ostr);
+    }
+
+    static bstree deserialize(std::istream& istr, const Compare& comp = Compare(), const Allocator& alloc = Allocator())
+        requires (std::is_trivially_copyable_v<Key> && std::is_trivially_copyable_v<Value>)
+    {
+      auto frozen = frozen_bstree<Key, Value, Compare>::read(istr, comp);
+
+      return from_sorted(frozen.begin(), frozen.end(), comp, alloc);
+    }
+
+    // Breadth-first traversal
+    template<class Functor> void levelOrderTraverse(Functor f) const noexcept;
+
+    // Depth-first traversals
+    template<typename Functor> void inOrderTraverse(Functor f) const noexcept
+    { 
+      return DoInOrderTraverse(f, root); 
+    }
+
+    template<typename Functor> void preOrderTraverse(Functor f) const noexcept  
+    { 
+      return DoPreOrderTraverse(f, root); 
+    }
+
+    template<typename Functor> void postOrderTraverse(Functor f) const noexcept
+    { 
+      return DoPostOrderTraverse(f, root); 
+    }
+
+    /*
+     * Parallel traversals, run as tasks on a work-stealing pool. The subtree sizes let the tree be cut into chunks of about equal node
+     * counts without visiting the nodes first. The functors are shared by all tasks, so they must be safe to call from several
+     * threads at once, and the tree must not be modified until the call returns.
+     */
+
+    // Calls f(value) for every element, as inOrderTraverse() does, but in no particular order.
+    template<class Functor> void parallel_for_each(Functor f, work_stealing_pool& pool = work_stealing_pool::instance()) const;
+
+    /*
+     * Each chunk is folded with acc = reduce(std::move(acc), value), starting from identity, and the chunk results are folded with
+     * combine(lhs, rhs). If ordered, the chunk results are combined from left to right in key order, so combine need only be
+     * associative (e.g. concatenation); otherwise they are combined as the chunks finish, and combine must also be commutative.
+     */
+    template<class T, class Reduce, class Combine> T parallel_reduce(T identity, Reduce reduce, Combine combine, bool ordered = true,
+                                                                     work_stealing_pool& pool = work_stealing_pool::instance()) const;
+
+    template<typename PrintFunctor> void  printlevelOrder(std::ostream& ostr, PrintFunctor pf) const noexcept;
+
+    void debug_print(std::ostream& ostr) const noexcept;
+
+    int height() const noexcept;
+    bool isBalanced() const noexcept;
+
+    friend std::ostream& operator<<(std::ostream& ostr, const bstree<Key, Value, Compare, Balance, Allocator>& tree) noexcept
+    {
+       ostr << "{ "; 
+       
+       auto functor = [&ostr](const auto& pair) { 
+            const auto&[key, value] = pair;
+            ostr << key  << ", ";
+       };
+       
+       tree.inOrderTraverse(functor);
+       
+       ostr << "}\n" << std::flush;
+       return ostr;
+    }
+};
+
+/*
+ * Allocates a node with the tree's allocator and constructs it from args. The returned node_ptr gives the node back to the same
+ * allocator.
+ */
+template<class Key, class Value, class Compare, class Balance, class Allocator> template<class... Args> 
+typename bstree<Key, Value, Compare, Balance, Allocator>::node_ptr bstree<Key, Value, Compare, Balance, Allocator>::make_node(Args&&... args)
+{
+   node_allocator_type& alloc = *node_alloc;
+
+   Node *pnode = node_traits::allocate(alloc, 1);
+
+   try {
+
+      node_traits::construct(alloc, pnode, std::forward<Args>(args)...);
+
+   } catch (...) {
+
+      node_traits::deallocate(alloc, pnode, 1);
+      throw;
+   }
+
+   return node_ptr{pnode, node_deleter{&alloc}};
+}
+
+/*
+ * Returns a copy of the subtree rooted at src, allocated with this tree's allocator. The copy of src gets parent as its parent. 
+ */
+template<class Key, class Value, class Compare, class Balance, class Allocator> 
+typename bstree<Key, Value, Compare, Balance, Allocator>::node_ptr bstree<Key, Value, Compare, Balance, Allocator>::copy_subtree(const Node *src, Node *parent) 
+{
+   node_ptr copy{nullptr, node_deleter{node_alloc.get()}};
+
+   try {
+
+      copy_subtree_into(src, parent, copy, [this](const Key& key, const Value& value, Node *parent) { 
+          return make_node(key, value, parent); 
+      });
+
+   } catch (...) {
+
+      destroy_subtree(copy);
+      throw;
+   }
+
+   return copy;
+}
+
+/*
+ * Returns a tree of the same shape and colors as the subtree rooted at src, allocated with this tree's allocator, with src's keys and
+ * values moved into it. src keeps its nodes, moved-from, for the caller to destroy. All the nodes are allocated before anything is
+ * moved, so if an allocation throws, src is left as it was.
+ */
+template<class Key, class Value, class Compare, class Balance, class Allocator> 
+typename bstree<Key, Value, Compare, Balance, Allocator>::node_ptr bstree<Key, Value, Compare, Balance, Allocator>::rebuild_subtree(Node *src) 
+{
+   node_allocator_type& alloc = *node_alloc;
+
+   std::vector<Node *> blocks;
+   std::size_t next = 0;
+
+   auto deallocate_rest = [&] {
+      for (; next < blocks.size(); ++next)
+          node_traits::deallocate(alloc, blocks[next], 1);
+   };
+
+   node_ptr copy{nullptr, node_deleter{&alloc}};
+
+   try {
+
+      blocks.reserve(subtree_size(src));
+
+      while (blocks.size() < blocks.capacity())
+          blocks.push_back(node_traits::allocate(alloc, 1));
+
+      copy_subtree_into(src, nullptr, copy, [&](const Key& key, const Value& value, Node *parent) {
+
+          Node *pnode = blocks[next];
+
+          node_traits::construct(alloc, pnode, parent, std::in_place, std::move(const_cast<Key&>(key)), std::move(const_cast<Value&>(value)));
+
+          ++next;
+
+          return node_ptr{pnode, node_deleter{&alloc}};
+      });
+
+   } catch (...) {
+
+      deallocate_rest();
+      destroy_subtree(copy);
+      throw;
+   }
+
+   return copy;
+}
+
+/*
+ * Copies the subtree rooted at src into slot, with make(key, value, parent) creating the nodes. Each node is linked into the copy as
+ * soon as it is made, so if make throws, slot holds a well-formed partial copy that the caller must destroy.
+ *
+ * The source and the copy are walked in pre-order in lockstep, using their parent pointers instead of recursion: copy the left child
+ * if it has not been copied yet, else the right child, else ascend in both trees.
+ */
+template<class Key, class Value, class Compare, class Balance, class Allocator> template<class MakeNode>
+void bstree<Key, Value, Compare, Balance, Allocator>::copy_subtree_into(const Node *src, Node *parent, node_ptr& slot, MakeNode make) 
+{
+   if (src == nullptr)
+       return;
+
+   auto copy_node = [&make](const Node *pnode, Node *parent) {
+
+       node_ptr pcopy = make(pnode->key(), pnode->value(), parent);
+       pcopy->color = pnode->color;
+       pcopy->size = pnode->size;
+       return pcopy;
+   };
+
+   slot = copy_node(src, parent);
+
+   const Node *s = src;
+   Node *d = slot.get();
+
+   while (true) {
+
+      if (s->left && !d->left) {
+
+          d->left = copy_node(s->left.get(), d);
+          s = s->left.get();
+          d = d->left.get();
+
+      } else if (s->right && !d->right) {
+
+          d->right = copy_node(s->right.get(), d);
+          s = s->right.get();
+          d = d->right.get();
+
+      } else if (s != src) {
+
+          s = s->parent;
+          d = d->parent;
+
+      } else {
+
+          break;
+      }
+   }
+}
+
+template<class Key, class Value, class Compare, class Balance, class Allocator> inline void bstree<Key, Value, Compare, Balance, Allocator>::copy_tree(const bstree<Key, Value, Compare, Balance, Allocator>& lhs) noexcept
+{
+   if (lhs.size() >= parallel_threshold)
+       parallel_copy(lhs, work_stealing_pool::instance());
+   else
+       root = copy_subtree(lhs.root.get(), nullptr);
+}
+
+/*
+ * The nodes whose subtrees exceed the grain are copied here, from the root down; every subtree of at most grain nodes below them
+ * becomes a task that copies it with copy_subtree_into() straight into its slot in the copy. The slots are distinct, so the tasks
+ * share nothing but the allocator. Unless it is thread safe, each task takes the blocks for its whole subtree in one go under
+ * alloc_mutex, and the tree-building thread allocates under the same mutex.
+ *
+ * If anything throws, the tasks are allowed to finish, and the partial copy is destroyed once no task can still touch it.
+ */
+template<class Key, class Value, class Compare, class Balance, class Allocator> 
+void bstree<Key, Value, Compare, Balance, Allocator>::parallel_copy(const bstree& lhs, work_stealing_pool& pool)
+{
+   std::size_t grain = lhs.parallel_grain(pool);
+
+   if (lhs.size() <= grain) {
+
+       root = copy_subtree(lhs.root.get(), nullptr);
+       return;
+   }
+
+   std::mutex alloc_mutex;
+
+   auto copy_task = [this, &alloc_mutex](const Node *src, Node *parent, node_ptr *slot) {
+
+       if constexpr (thread_safe_allocator) {
+
+           copy_subtree_into(src, parent, *slot, [this](const Key& key, const Value& value, Node *parent) { 
+               return make_node(key, value, parent); 
+           });
+
+       } else {
+
+           node_allocator_type& alloc = *node_alloc;
+
+           std::vector<Node *> blocks;
+
+           auto give_back = [&] {
+               std::lock_guard lock{alloc_mutex};
+
+               for (Node *pnode : blocks)
+                   node_traits::deallocate(alloc, pnode, 1);
+
+               blocks.clear();
+           };
+
+           try {
+              blocks.reserve(src->size);
+              {
+                 std::lock_guard lock{alloc_mutex};
+
+                 while (blocks.size() < src->size)
+                     blocks.push_back(node_traits::allocate(alloc, 1));
+              }
+
+              copy_subtree_into(src, parent, *slot, [&](const Key& key, const Value& value, Node *parent) {
+                  Node *pnode = blocks.back();
+
+                  node_traits::construct(alloc, pnode, key, value, parent);
+
+                  blocks.pop_back();
+
+                  return node_ptr{pnode, node_deleter{&alloc}};
+              });
+
+           } catch (...) {
+
+              give_back();
+              throw;
+           }
+       }
+   };
+
+   work_stealing_pool::task_group group{pool};
+
+   try {
+
+      struct pending_copy {
+
+          const Node *src;
+          Node *parent;
+          node_ptr *slot;
+      };
+
+      std::vector<pending_copy> stack{{lhs.root.get(), nullptr, &root}};
+
+      while (!stack.empty()) {
+
+          auto [src, parent, slot] = stack.back();
+          stack.pop_back();
+
+          if (src == nullptr)
+              continue;
+
+          if (src->size <= grain) {
+
+              group.run([=, &copy_task] { copy_task(src, parent, slot); });
+              continue;
+          }
+
+          {
+             std::lock_guard lock{alloc_mutex};
+
+             *slot = make_node(src->key(), src->value(), parent);
+          }
+
+          (*slot)->color = src->color;
+          (*slot)->size = src->size;
+
+          stack.push_back({src->right.get(), slot->get(), &(*slot)->right});
+          stack.push_back({src->left.get(), slot->get(), &(*slot)->left});
+      }
+
+      group.wait();
+
+   } catch (...) {
+
+      try { group.wait(); } catch (...) { }
+
+      destroy_subtree(root);
+      throw;
+   }
+}
+
+template<class Key, class Value, class Compare, class Balance, class Allocator> inline bstree<Key, Value, Compare, Balance, Allocator>::bstree(std::initializer_list<value_type>& list)  noexcept : bstree()
+{
+   insert(list);
+}
+
+template<class Key, class Value, class Compare, class Balance, class Allocator> template<class ForwardIt> 
+bstree<Key, Value, Compare, Balance, Allocator> bstree<Key, Value, Compare, Balance, Allocator>::from_sorted(ForwardIt first, ForwardIt last, const Compare& comp, const Allocator& alloc)
+{
+   bstree tree{comp, alloc};
+
+   std::size_t n = 0; // Number of distinct keys
+
+   for (ForwardIt iter = first; iter != last; ++n) {
+
+       ForwardIt prior = iter++;
+
+       while (iter != last && !comp(prior->first, iter->first)) // skip duplicates
+           ++iter;
+   }
+
+   /*
+    * Every subtree is split at its middle, so the sizes of any two subtrees at the same depth differ by at most one, and all nullptr
+    * children lie at depth floor(log2(n)) or one below it. Coloring just the nodes at depth floor(log2(n)) red then gives every path 
+    * the same number of black nodes.
+    */
+   int red_depth = 0;
+
+   for (std::size_t m = n; m > 1; m /= 2) 
+       ++red_depth;
+
+   tree.root = tree.build_sorted(first, last, n, nullptr, 0, red_depth);
+
+   return tree;
+}
+
+template<class Key, class Value, class Compare, class Balance, class Allocator> template<class InputIt> 
+bstree<Key, Value, Compare, Balance, Allocator> bstree<Key, Value, Compare, Balance, Allocator>::from_unsorted(InputIt first, InputIt last, const Compare& comp, const Allocator& alloc)
+{
+   std::vector<std::pair<Key, Value>> pairs(first, last);
+
+   // A stable sort keeps the last of several equal keys last, where from_sorted() will pick it.
+   std::stable_sort(pairs.begin(), pairs.end(), [&comp](const auto& lhs, const auto& rhs) { return comp(lhs.first, rhs.first); });
+
+   return from_sorted(pairs.cbegin(), pairs.cend(), comp, alloc);
+}
+
+/*
+ * Builds a tree from the next n distinct keys of [first, last), advancing first past them. The left subtree is built first, then 
+ * the root takes the next key, and then the right subtree is built, so the nodes are allocated in key order. The recursion depth is
+ * log2(n).
+ */
+template<class Key, class Value, class Compare, class Balance, class Allocator> template<class ForwardIt> 
+typename bstree<Key, Value, Compare, Balance, Allocator>::node_ptr bstree<Key, Value, Compare, Balance, Allocator>::build_sorted(ForwardIt& first, ForwardIt last, std::size_t n, Node *parent, int depth, int red_depth)
+{
+   if (n == 0)
+       return node_ptr{nullptr, node_deleter{node_alloc.get()}};
+
+   std::size_t left_n = (n - 1) / 2;
+
+   node_ptr left = build_sorted(first, last, left_n, nullptr, depth + 1, red_depth);
+
+   ForwardIt pick = first++;
+
+   while (first != last && !comp(pick->first, first->first)) // The last of equal keys wins.
+       pick = first++;
+
+   node_ptr pnode = make_node(pick->first, pick->second, parent);
+
+   if (left) {
+
+       pnode->left = std::move(left);
+       pnode->left->parent = pnode.get();
+   }
+
+   pnode->right = build_sorted(first, last, n - 1 - left_n, pnode.get(), depth + 1, red_depth);
+
+   pnode->size = n;
+   pnode->color = (depth == red_depth && depth > 0) ? Color::red : Color::black;
+
+   return pnode;
+}
+
+template<class Key, class Value, class Compare, class Balance, class Allocator> inline bstree<Key, Value, Compare, Balance, Allocator>::bstree(const bstree<Key, Value, Compare, Balance, Allocator>& lhs) noexcept :
+   node_alloc{std::make_shared<node_allocator_type>(node_traits::select_on_container_copy_construction(*lhs.node_alloc))}, root{nullptr}, comp{lhs.comp}
+{ 
+   copy_tree(lhs);
+}
+
+/*
+ * Takes over lhs's nodes together with the allocator that owns them. lhs is left empty, sharing that allocator.
+ */
+template<class Key, class Value, class Compare, class Balance, class Allocator> inline void bstree<Key, Value, Compare, Balance, Allocator>::move(bstree<Key, Value, Compare, Balance, Allocator>&& lhs) noexcept  
+{
+  destroy_tree();
+
+  node_alloc = lhs.node_alloc;
+
+  comp = lhs.comp;
+
+  root = std::move(lhs.root); 
+}
+
+template<class Key, class Value, class Compare, class Balance, class Allocator> bstree<Key, Value, Compare, Balance, Allocator>& bstree<Key, Value, Compare, Balance, Allocator>::operator=(const bstree<Key, Value, Compare, Balance, Allocator>& lhs) noexcept
+{
+  if (this == &lhs)  {
+      
+      return *this;
+  }
+
+  // Free all Nodes in 'this', and then set root to a duplicate tree of Nodes allocated with this tree's allocator.
+  destroy_tree();
+
+  copy_tree(lhs);
+
+  return *this;
+}
+
+template<class Key, class Value, class Compare, class Balance, class Allocator> 
+bstree<Key, Value, Compare, Balance, Allocator> bstree<Key, Value, Compare, Balance, Allocator>::clone(work_stealing_pool& pool) const
+{
+  bstree copy(comp, allocator_type(node_traits::select_on_container_copy_construction(*node_alloc)));
+
+  copy.parallel_copy(*this, pool);
+
+  return copy;
+}
+
+template<class Key, class Value, class Compare, class Balance, class Allocator> bstree<Key, Value, Compare, Balance, Allocator>& bstree<Key, Value, Compare, Balance, Allocator>::operator=(bstree<Key, Value, Compare, Balance, Allocator>&& lhs) noexcept
+{
+  if (this == &lhs) return *this;
+  
+  move(std::move(lhs)); 
+
+  return *this;
+}
+
+template<class Key, class Value, class Compare, class Balance, class Allocator> inline std::ostream& bstree<Key, Value, Compare, Balance, Allocator>::Node::print(std::ostream& ostr) const noexcept
+{
+  ostr << "[ " << key() << ", " << value() << "] " << std::flush;  
+  return ostr; 
+}
+
+template<class Key, class Value, class Compare, class Balance, class Allocator> std::ostream& bstree<Key, Value, Compare, Balance, Allocator>::Node::debug_print(std::ostream& ostr) const noexcept
+{
+   ostr << " {["; 
+ 
+   ostr << key() << ']';
+
+   if (parent) 
+      ostr << ", parent->key() =" << parent->key(); 
+   else
+      ostr << ", parent = nullptr";
+ 
+   if (!left) 
+     ostr << ", left = nullptr";
+   else
+      ostr << ", left->key() = " <<  left->key();
+   
+   if (!right) 
+     ostr << ", right = nullptr";
+   else
+      ostr << ", right->key() = " << right->key();
+   
+   ostr << "}";
+ 
+   return ostr;
+}
+
+template<typename Key, typename Value, typename Compare, typename Balance, typename Allocator> 
+template<typename PrintFunctor>
+void  bstree<Key, Value, Compare, Balance, Allocator>::printlevelOrder(std::ostream& ostr, PrintFunctor print_functor) const noexcept
+{
+  LevelOrderPrinter<PrintFunctor> tree_printer(*this, ostr, print_functor);  
+  
+  levelOrderTraverse(tree_printer);
+  
+  ostr << std::flush;
+}
+
+template<typename Key, typename Value, typename Compare, typename Balance, typename Allocator> inline void  bstree<Key, Value, Compare, Balance, Allocator>::debug_print(std::ostream& ostr) const noexcept
+{
+  auto node_debug_printer = [&ostr] (const Node *current) { current->debug_print(ostr); };
+
+  printlevelOrder(ostr, node_debug_printer);  
+  
+  ostr << std::flush;
+}
+
+/*
+template<class Key, class Value, class Compare, class Balance, class Allocator> bstree<Key, Value, Compare, Balance, Allocator>::Node::Node(Key key, const Value& value, Node *ptr2parent)  : parent{ptr2parent}, left{nullptr}, right{nullptr}, \
+        __vt{key, value}
+{
+}
+*/
+
+/*
+ * Input:  pnode is a raw Node *.
+ * Return: A reference to the unique_ptr that manages pnode.
+ */
+template<class Key, class Value, class Compare, class Balance, class Allocator> typename bstree<Key, Value, Compare, Balance, Allocator>::node_ptr& bstree<Key, Value, Compare, Balance, Allocator>::get_unique_ptr(Node *pnode) noexcept
+{
+  if (pnode->parent == nullptr) { // Is pnode the root? 
+
+     return root; 
+
+  } else {
+
+     return (pnode->parent->left.get() == pnode) ? pnode->parent->left : pnode->parent->right;  
+  }
+}
+
+/*
+ * The depth-first traversals below do not recurse. They walk the subtree with the parent pointers, so they use O(1) memory and
+ * cannot overflow the stack, no matter how degenerate the tree is. 'stop' is the parent of the subtree's root: reaching it means
+ * the walk has left the subtree.
+ *
+ * In-order: after visiting a node, go to the leftmost node of its right subtree. If there is no right subtree, ascend until we
+ * arrive from a left child, which is getSuccessor() restricted to the subtree.
+ */
+template<class Key, class Value, class Compare, class Balance, class Allocator> template<typename Functor> void bstree<Key, Value, Compare, Balance, Allocator>::DoInOrderTraverse(Functor f, const node_ptr& subtree) const noexcept
+{
+   if (subtree == nullptr) {
+
+      return;
+   }
+
+   const Node *stop = subtree->parent;
+
+   const Node *current = min(subtree.get());
+
+   while (current != stop) {
+
+      f(current->__vt.__get_value()); 
+
+      if (current->right) {
+
+          current = min(current->right.get());
+
+      } else {
+
+          const Node *child;
+
+          do {
+              child = current;
+              current = current->parent;
+
+          } while (current != stop && child == current->right.get());
+      }
+   }
+}
+
+/*
+ * Pre-order: visit a node, then descend into its left child, or else its right child. At a leaf, ascend until we arrive from a 
+ * left child whose parent has a right child, and continue with that right child.
+ */
+template<class Key, class Value, class Compare, class Balance, class Allocator> template<typename Functor> void bstree<Key, Value, Compare, Balance, Allocator>::DoPreOrderTraverse(Functor f, const node_ptr& subtree) const noexcept
+{
+   if (subtree == nullptr) {
+
+      return;
+   }
+
+   const Node *stop = subtree->parent;
+
+   const Node *current = subtree.get();
+
+   while (current != stop) {
+
+      f(current->__vt.__get_value()); 
+
+      if (current->left) {
+
+          current = current->left.get();
+
+      } else if (current->right) {
+
+          current = current->right.get();
+
+      } else {
+
+          const Node *child;
+
+          do {
+              child = current;
+              current = current->parent;
+
+          } while (current != stop && (child == current->right.get() || !current->right));
+
+          if (current != stop)
+              current = current->right.get();
+      }
+   }
+}
+
+/*
+ * Post-order: start at the first leaf reached by preferring left children. After visiting a node, if it is a left child and its 
+ * parent has a right child, continue at the first leaf of that right subtree; otherwise the parent is next.
+ */
+template<class Key, class Value, class Compare, class Balance, class Allocator> template<typename Functor> void bstree<Key, Value, Compare, Balance, Allocator>::DoPostOrderTraverse(Functor f, const node_ptr& subtree) const noexcept
+{
+   if (subtree == nullptr) {
+
+      return;
+   }
+
+   auto first_leaf = [](const Node *pnode) {
+
+       while (pnode->left || pnode->right) 
+           pnode = pnode->left ? pnode->left.get() : pnode->right.get();
+
+       return pnode;
+   };
+
+   const Node *current = first_leaf(subtree.get());
+
+   while (true) {
+
+      f(current->__vt.__get_value()); 
+
+      if (current == subtree.get()) 
+          break;
+
+      const Node *parent = current->parent;
+
+      current = (current == parent->left.get() && parent->right) ? first_leaf(parent->right.get()) : parent;
+   }
+}
+
+/*
+ * Cuts the in-order sequence as in-order traversal with an explicit stack would visit it, except that a subtree of at most grain
+ * nodes is taken whole instead of being descended into. Only the nodes on the left spines of oversized subtrees are visited, so for
+ * a balanced tree planning costs O((n / grain) log n).
+ */
+template<class Key, class Value, class Compare, class Balance, class Allocator>
+typename bstree<Key, Value, Compare, Balance, Allocator>::traversal_plan bstree<Key, Value, Compare, Balance, Allocator>::plan_traversal(std::size_t grain) const
+{
+   traversal_plan plan;
+
+   std::vector<const node_ptr *> stack;
+
+   const node_ptr *current = &root;
+
+   while (true) {
+
+      for (; *current && (*current)->size > grain; current = &(*current)->left)
+          stack.push_back(current);
+
+      if (*current)
+          plan.pieces.push_back({current, true});
+
+      if (stack.empty())
+          break;
+
+      current = stack.back();
+      stack.pop_back();
+
+      plan.pieces.push_back({current, false});
+
+      current = &(*current)->right;
+   }
+
+   std::size_t chunk_size = grain; // Start a chunk at the first piece.
+
+   for (std::size_t i = 0; i < plan.pieces.size(); ++i) {
+
+      if (chunk_size >= grain) {
+
+          plan.starts.push_back(i);
+          chunk_size = 0;
+      }
+
+      chunk_size += plan.pieces[i].whole ? (*plan.pieces[i].subtree)->size : 1;
+   }
+
+   plan.starts.push_back(plan.pieces.size());
+
+   return plan;
+}
+
+template<class Key, class Value, class Compare, class Balance, class Allocator> template<class Functor>
+void bstree<Key, Value, Compare, Balance, Allocator>::traverse_chunk(Functor& f, const traversal_plan& plan, std::size_t c) const noexcept
+{
+   for (std::size_t i = plan.starts[c]; i < plan.starts[c + 1]; ++i) {
+
+      const traversal_piece& piece = plan.pieces[i];
+
+      if (piece.whole)
+          DoInOrderTraverse(std::ref(f), *piece.subtree);
+      else
+          f((*piece.subtree)->__vt.__get_value());
+   }
+}
+
+template<class Key, class Value, class Compare, class Balance, class Allocator> template<class Functor>
+void bstree<Key, Value, Compare, Balance, Allocator>::parallel_for_each(Functor f, work_stealing_pool& pool) const
+{
+   traversal_plan plan = plan_traversal(parallel_grain(pool));
+
+   if (plan.chunks() <= 1) {
+
+       DoInOrderTraverse(std::ref(f), root);
+       return;
+   }
+
+   work_stealing_pool::task_group group{pool};
+
+   for (std::size_t c = 0; c < plan.chunks(); ++c)
+       group.run([this, &f, &plan, c] { traverse_chunk(f, plan, c); });
+
+   group.wait();
+}
+
+template<class Key, class Value, class Compare, class Balance, class Allocator> template<class T, class Reduce, class Combine>
+T bstree<Key, Value, Compare, Balance, Allocator>::parallel_reduce(T identity, Reduce reduce, Combine combine, bool ordered, work_stealing_pool& pool) const
+{
+   traversal_plan plan = plan_traversal(parallel_grain(pool));
+
+   auto fold_chunk = [this, &plan, &identity, &reduce](std::size_t c) {
+
+       T acc = identity;
+
+       auto step = [&acc, &reduce](const value_type& value) { acc = reduce(std::move(acc), value); };
+
+       traverse_chunk(step, plan, c);
+
+       return acc;
+   };
+
+   if (plan.chunks() <= 1)
+       return plan.chunks() == 0 ? identity : fold_chunk(0);
+
+   work_stealing_pool::task_group group{pool};
+
+   if (ordered) {
+
+       std::vector<T> partial(plan.chunks(), identity);
+
+       for (std::size_t c = 0; c < plan.chunks(); ++c)
+           group.run([&partial, &fold_chunk, c] { partial[c] = fold_chunk(c); });
+
+       group.wait();
+
+       T result = std::move(partial[0]);
+
+       for (std::size_t c = 1; c < plan.chunks(); ++c)
+           result = combine(std::move(result), std::move(partial[c]));
+
+       return result;
+   }
+
+   T result = identity;
+   std::mutex result_mutex;
+
+   for (std::size_t c = 0; c < plan.chunks(); ++c)
+       group.run([&, c] {
+          T acc = fold_chunk(c);
+
+          std::lock_guard lock{result_mutex};
+          result = combine(std::move(result), std::move(acc));
+       });
+
+   group.wait();
+
+   return result;
+}
+
+/*
+ * Post order node destruction
+ *
+ * Iterative: descend to a leaf, delete it, and resume from its parent. Only leaves are deleted, so ~Node() never recurses.
+ *
+ * When the entire tree is destroyed, its values need no destructor calls, and no other tree or allocator shares its node pool, 
+ * the pool's slabs are released all at once instead.
+ */
+template<class Key, class Value, class Compare, class Balance, class Allocator> void bstree<Key, Value, Compare, Balance, Allocator>::destroy_subtree(node_ptr& subtree) noexcept
+{
+   if (subtree == nullptr) {
+
+      return;
+   }
+
+   if constexpr (releasable_pool) {
+
+      if (&subtree == &root && can_release_pool()) {
+
+          (void) subtree.release(); // The nodes' memory goes away with the slabs.
+
+          node_alloc->release();
+          return;
+      }
+   }
+
+   free_subtree(subtree);
+}
+
+// Calls drop(slot) on the slot of every node of subtree, children before parents, ending with subtree itself.
+template<class Key, class Value, class Compare, class Balance, class Allocator> template<class Drop> 
+void bstree<Key, Value, Compare, Balance, Allocator>::post_order_drop(node_ptr& subtree, Drop drop) noexcept
+{
+   if (subtree == nullptr) {
+
+      return;
+   }
+
+   Node *current = subtree.get();
+
+   while (current != subtree.get() || current->left || current->right) {
+
+      while (current->left || current->right) 
+          current = current->left ? current->left.get() : current->right.get();
+
+      Node *parent = current->parent;
+
+      drop(parent->left.get() == current ? parent->left : parent->right);
+
+      current = parent;
+   }
+
+   drop(subtree);
+}
+
+/*
+ * Destroys subtree like free_subtree(), for use by several threads on disjoint subtrees. Unless the allocator is thread safe, the
+ * nodes are destroyed here, but their blocks are chained together through their own storage, like node_pool's free list, and handed
+ * back to the allocator in one go under alloc_mutex.
+ */
+template<class Key, class Value, class Compare, class Balance, class Allocator> 
+void bstree<Key, Value, Compare, Balance, Allocator>::release_subtree(node_ptr& subtree, std::mutex& alloc_mutex) noexcept
+{
+   if constexpr (thread_safe_allocator) {
+
+      free_subtree(subtree);
+
+   } else {
+
+      if (subtree == nullptr)
+          return;
+
+      node_allocator_type& alloc = *subtree.get_deleter().alloc;
+
+      void *chain = nullptr;
+
+      post_order_drop(subtree, [&alloc, &chain](node_ptr& pnode) {
+          Node *p = pnode.release();
+
+          node_traits::destroy(alloc, p);
+
+          ::new (static_cast<void *>(p)) void *(chain);
+          chain = p;
+      });
+
+      std::lock_guard lock{alloc_mutex};
+
+      while (chain) {
+
+          void *block = chain;
+
+          chain = *std::launder(static_cast<void **>(block));
+
+          node_traits::deallocate(alloc, static_cast<Node *>(block), 1);
+      }
+   }
+}
+
+/*
+ * Frees the whole tree: by releasing the pool when possible, else by deferring to a pool worker if asked to, else in parallel if
+ * the tree is large.
+ */
+template<class Key, class Value, class Compare, class Balance, class Allocator> void bstree<Key, Value, Compare, Balance, Allocator>::destroy_tree() noexcept
+{
+   if (root == nullptr || can_release_pool()) {
+
+       destroy_subtree(root);
+
+   } else if (deferred_destroy && defer_destroy()) {
+
+       return;
+
+   } else if (size() >= parallel_threshold) {
+
+       parallel_destroy(work_stealing_pool::instance());
+
+   } else {
+
+       destroy_subtree(root);
+   }
+}
+
+/*
+ * Hands the nodes, and the allocator they came from, to a pool worker. Returns false, leaving the tree as it was, if the allocator
+ * may not be used by the worker and by this tree at the same time, or if the hand-over fails.
+ */
+template<class Key, class Value, class Compare, class Balance, class Allocator> bool bstree<Key, Value, Compare, Balance, Allocator>::defer_destroy() noexcept
+{
+   constexpr bool replaceable = std::is_default_constructible_v<node_allocator_type> && 
+                                requires (node_allocator_type& alloc) { alloc.owns_pool(); };
+
+   if constexpr (!thread_safe_allocator && !replaceable) {
+
+       return false;
+
+   } else {
+
+       if constexpr (!thread_safe_allocator) {
+
+           if (node_alloc.use_count() != 1 || !node_alloc->owns_pool())
+               return false;
+       }
+
+       try {
+          std::shared_ptr<node_allocator_type> next = node_alloc;
+
+          if constexpr (!thread_safe_allocator)
+              next = std::make_shared<node_allocator_type>();
+
+          Node *pnode = root.get();
+
+          work_stealing_pool::instance().submit([pnode, alloc = node_alloc] {
+              node_ptr subtree{pnode, node_deleter{alloc.get()}};
+
+              free_subtree(subtree);
+          });
+
+          (void) root.release(); // Now owned by the task.
+
+          node_alloc = std::move(next);
+
+          return true;
+
+       } catch (...) {
+
+          return false;
+       }
+   }
+}
+
+/*
+ * The nodes whose subtrees exceed the grain are left for last; every subtree of at most grain nodes below them is destroyed by a task
+ * of its own, which clears its slot. If tasks cannot be started, whatever they did not get to is destroyed here.
+ */
+template<class Key, class Value, class Compare, class Balance, class Allocator> 
+void bstree<Key, Value, Compare, Balance, Allocator>::parallel_destroy(work_stealing_pool& pool) noexcept
+{
+   std::size_t grain = parallel_grain(pool);
+
+   std::mutex alloc_mutex;
+
+   try {
+      std::vector<node_ptr *> stack{&root};
+
+      work_stealing_pool::task_group group{pool};
+
+      while (!stack.empty()) {
+
+          node_ptr *slot = stack.back();
+          stack.pop_back();
+
+          if (*slot == nullptr)
+              continue;
+
+          if ((*slot)->size <= grain) {
+
+              group.run([slot, &alloc_mutex] { release_subtree(*slot, alloc_mutex); });
+
+          } else {
+
+              stack.push_back(&(*slot)->left);
+              stack.push_back(&(*slot)->right);
+          }
+      }
+
+      group.wait();
+
+   } catch (...) {
+   }
+
+   destroy_subtree(root); // The nodes above the subtrees.
+}
+/*
+ * Algorithm taken from page 290 of Introduction to Algorithms by Cormen, 3rd Edition, et. al.
+ */
+/*-- Change to return unique_ptr<Node>
+template<class Key, class Value, class Compare, class Balance, class Allocator> typename bstree<Key, Value, Compare, Balance, Allocator>::Node *bstree<Key, Value, Compare, Balance, Allocator>::find(Key key, const node_ptr& current) const noexcept
+{
+  if (!current || current->key() == key)
+     return current.get();
+  if (key < current->key())
+     return find(key, current->left);
+  else return find(key, current->right);
+}
+*/
+
+template<class Key, class Value, class Compare, class Balance, class Allocator> template<class K> typename bstree<Key, Value, Compare, Balance, Allocator>::node_ptr& bstree<Key, Value, Compare, Balance, Allocator>::find(const K& key, node_ptr& subtree) const noexcept
+{
+  node_ptr *current = &subtree;
+
+  while (*current && !equivalent((*current)->key(), key)) 
+     current = comp(key, (*current)->key()) ? &(*current)->left : &(*current)->right;
+
+  return *current;
+}
+
+/*
+ * Returns pair<bool, const Node *>, where
+ * If key found, {true, Node * of found node}
+ * If key not node found, {false, Node * of leadf node where insert should occur}
+*/
+template<class Key, class Value, class Compare, class Balance, class Allocator> template<class K> std::pair<bool, const typename bstree<Key, Value, Compare, Balance, Allocator>::Node *> bstree<Key, Value, Compare, Balance, Allocator>::findNode(const K& key, const typename bstree<Key, Value, Compare, Balance, Allocator>::Node *current) const noexcept
+{
+  const Node *parent = nullptr;
+
+  while (current != nullptr) {
+
+     if (equivalent(current->key(), key)) return {true, current}; 
+
+      parent = current;
+
+      current = comp(key, current->key()) ? current->left.get() : current->right.get(); 
+  }
+  
+  return {false, parent}; 
+}
+
+/*
+ * The interleaved search behind find_batch(), after Kocberber et al., "Asynchronous Memory Access Chaining" (VLDB 2015). Up to
+ * find_batch_width searches are in flight, each a (key index, current node) pair. A round visits every one of them: a search that
+ * has found its key or run off the tree reports found(index, node or nullptr) and starts over from the root with the next key;
+ * any other search descends one level and prefetches its next node, which by the time the round comes back to it has usually
+ * arrived from memory. Once the keys run out, the last searches drain and finished slots are filled from the end of the array.
+ */
+template<class Key, class Value, class Compare, class Balance, class Allocator> template<class Found> void bstree<Key, Value, Compare, Balance, Allocator>::find_batch_nodes(std::span<const Key> keys, Found found) const noexcept
+{
+  struct search {
+
+     std::size_t index;
+     const Node *current;
+  };
+
+  search searches[find_batch_width];
+
+  std::size_t next = 0;
+  std::size_t active = 0;
+
+  while (active < find_batch_width && next < keys.size())
+      searches[active++] = {next++, root.get()};
+
+  while (active > 0) {
+
+      for (std::size_t s = 0; s < active; ) {
+
+          search& current = searches[s];
+          const Key& key = keys[current.index];
+          const Node *pnode = current.current;
+
+          bool go_left = pnode && comp(key, pnode->key());
+
+          if (!pnode || (!go_left && !comp(pnode->key(), key))) { // Off the tree, or found.
+
+              found(current.index, pnode);
+
+              if (next < keys.size()) {
+
+                  current = {next++, root.get()};
+                  ++s;
+
+              } else
+                  current = searches[--active]; // Visit the moved search next.
+
+              continue;
+          }
+
+          pnode = go_left ? pnode->left.get() : pnode->right.get();
+
+          if (pnode)
+              prefetch(pnode);
+
+          current.current = pnode;
+          ++s;
+      }
+  }
+}
+
+/*
+ * Finger search for trees with parent pointers. The keys of the subtree rooted at current lie strictly between two of its ancestors:
+ * the nearest one holding current in its right subtree (the lower bound) and the nearest one holding it in its left subtree (the
+ * upper bound). If key is less than current's key, only the lower bound matters, so the search climbs the run of left-child links
+ * above current to reach it, comparing no keys on the way. If key lies above the bound, it belongs in current's subtree and an
+ * ordinary descent from current finishes the search; otherwise the bound becomes current and the climb resumes. Greater keys are
+ * symmetric.
+ *
+ * Each bound passed costs one comparison, and the bounds passed are the nodes between finger and key on the path through their 
+ * lowest common ancestor, so for a balanced tree the comparisons grow as O(log d), d being the number of keys between finger and 
+ * key. The result is that of findNode().
+ */
+template<class Key, class Value, class Compare, class Balance, class Allocator> template<class K> std::pair<bool, const typename bstree<Key, Value, Compare, Balance, Allocator>::Node *> bstree<Key, Value, Compare, Balance, Allocator>::findNode_near(const K& key, const Node *finger) const noexcept
+{
+  if (!finger) 
+      return {false, nullptr}; // The tree is empty.
+
+  const Node *current = finger;
+
+  for (;;) {
+
+      bool go_left = comp(key, current->key());
+
+      if (!go_left && !comp(current->key(), key))
+          return {true, current};
+
+      const Node *child = current;
+      const Node *bound = current->parent;
+
+      while (bound && child == (go_left ? bound->left.get() : bound->right.get())) {
+
+          child = bound;
+          bound = bound->parent;
+      }
+
+      if (!bound || (go_left ? comp(bound->key(), key) : comp(key, bound->key()))) { // key lies within current's subtree.
+
+          const Node *next = go_left ? current->left.get() : current->right.get();
+
+          return next ? findNode(key, next) : std::pair<bool, const Node *>{false, current};
+      }
+
+      current = bound;
+  }
+}
+
+template<class Key, class Value, class Compare, class Balance, class Allocator> typename bstree<Key, Value, Compare, Balance, Allocator>::Node *bstree<Key, Value, Compare, Balance, Allocator>::min(typename bstree<Key, Value, Compare, Balance, Allocator>::Node *current) const noexcept
+{
+  while (current->left != nullptr) {
+
+       current = current->left.get();
+  } 
+
+  return current;  
+}
+
+/*
+ The code for tree-successor is broken into two cases. If the right subtree of node x is nonempty, then the successor of x is just the left-most node in the right subtree, which is found
+ by calling min(x->right). On the other hand, if the right subtree of node x is empty and x has a successor y, then y is the lowest ancestor of x whose left child is also an ancestor of x.
+ To find y, we simply go up the tree from x until we encounter a node that is the left child of its parent.
+
+ Pseudo code 
+
+ tree-successor(x)
+ {
+    if x->right != NIL
+  
+       return min(x->right)
+  
+   y = x->parent
+  
+   while (y != NIL and x = y->right)
+  
+        x = y
+  
+        y = y->parent
+   }
+  
+   return y
+ }
+ 
+  */
+template<class Key, class Value, class Compare, class Balance, class Allocator>  typename bstree<Key, Value, Compare, Balance, Allocator>::Node* bstree<Key, Value, Compare, Balance, Allocator>::getSuccessor(const typename bstree<Key, Value, Compare, Balance, Allocator>::Node *x) const noexcept
+{
+  if (x->right) 
+      return min(x->right.get());
+
+  Node *parent = x->parent;
+
+  // To find the smallest parent of child whose left child is also an ancestor of x, we ascend the parent chain until we find a node that is a left child.
+  // If its parent is nullptr, then there we are at the root and there is no successor.  
+  while(parent && x == parent->right.get()) {
+
+       x = parent;
+
+       parent = parent->parent;
+  }
+
+  return parent;
+}
+
+// tree-predecessor(x) is symmetric to tree-successor(x): either the right-most node in x's left subtree, or the lowest ancestor of x 
+// whose right child is also an ancestor of x.
+template<class Key, class Value, class Compare, class Balance, class Allocator>  typename bstree<Key, Value, Compare, Balance, Allocator>::Node* bstree<Key, Value, Compare, Balance, Allocator>::getPredecessor(const typename bstree<Key, Value, Compare, Balance, Allocator>::Node *x) const noexcept
+{
+  if (x->left) 
+      return max(x->left.get());
+
+  Node *parent = x->parent;
+
+  while(parent && x == parent->left.get()) {
+
+       x = parent;
+
+       parent = parent->parent;
+  }
+
+  return parent;
+}
+
+template<class Key, class Value, class Compare, class Balance, class Allocator> typename bstree<Key, Value, Compare, Balance, Allocator>::Node *bstree<Key, Value, Compare, Balance, Allocator>::max(typename bstree<Key, Value, Compare, Balance, Allocator>::Node *current) const noexcept
+{
+  while (current->right != nullptr) {
+
+       current = current->right.get();
+  } 
+
+  return current;  
+}
+
+// Returns the node with the smallest key not less than key, or nullptr.
+template<class Key, class Value, class Compare, class Balance, class Allocator> template<class K> typename bstree<Key, Value, Compare, Balance, Allocator>::Node *bstree<Key, Value, Compare, Balance, Allocator>::lower_bound_node(const K& key) const noexcept
+{
+  Node *current = root.get();
+  Node *result = nullptr;
+
+  while (current) {
+
+     if (comp(current->key(), key)) {
+
+         current = current->right.get();
+
+     } else {
+
+         result = current;
+         current = current->left.get();
+     }
+  }
+
+  return result;
+}
+
+/*
+ * Returns the node of rank k, or nullptr if k >= size(). If the left subtree has more than k nodes, the node is in it; if it has 
+ * exactly k, it is the current node; otherwise it is the node of rank k - size(left) - 1 in the right subtree.
+ */
+template<class Key, class Value, class Compare, class Balance, class Allocator> const typename bstree<Key, Value, Compare, Balance, Allocator>::Node *bstree<Key, Value, Compare, Balance, Allocator>::select_node(std::size_t k) const noexcept
+{
+  const Node *current = root.get();
+
+  while (current) {
+
+     std::size_t left_size = subtree_size(current->left.get());
+
+     if (k < left_size) {
+
+         current = current->left.get();
+
+     } else if (k > left_size) {
+
+         k -= left_size + 1;
+         current = current->right.get();
+
+     } else {
+
+         break;
+     }
+  }
+
+  return current;
+}
+
+// Returns the number of keys less than key, or less than or equal to key if inclusive is true.
+template<class Key, class Value, class Compare, class Balance, class Allocator> template<class K> std::size_t bstree<Key, Value, Compare, Balance, Allocator>::count_less(const K& key, bool inclusive) const noexcept
+{
+  const Node *current = root.get();
+  std::size_t count = 0;
+
+  while (current) {
+
+     if (comp(key, current->key())) {
+
+         current = current->left.get();
+
+     } else if (comp(current->key(), key)) {
+
+         count += subtree_size(current->left.get()) + 1;
+         current = current->right.get();
+
+     } else {
+
+         count += subtree_size(current->left.get()) + (inclusive ? 1 : 0);
+         break;
+     }
+  }
+
+  return count;
+}
+
+/*
+ * Splits the tree into the keys below lo, the keys in [lo, hi] and the keys above hi, and joins the first and last. Only splitting
+ * allocates (a path of O(height) entries), and it does so before it changes anything, so on failure the tree is unchanged.
+ */
+template<class Key, class Value, class Compare, class Balance, class Allocator> template<class K1, class K2> std::size_t bstree<Key, Value, Compare, Balance, Allocator>::erase_range(const K1& lo, const K2& hi)
+{
+  if (root == nullptr || comp(hi, lo))
+      return 0;
+
+  auto [lower, rest] = split_by([this, &lo](const Key& key) { return !comp(key, lo); });
+
+  auto [range, upper] = rest.split_by([this, &hi](const Key& key) { return comp(hi, key); });
+
+  *this = join_trees(lower, upper);
+
+  return range.size(); // range is destroyed on return.
+}
+
+// The number of black nodes on every path from the root down to a nullptr. Always 0 for unbalanced trees.
+template<class Key, class Value, class Compare, class Balance, class Allocator> int bstree<Key, Value, Compare, Balance, Allocator>::black_height() const noexcept
+{
+  int height = 0;
+
+  if constexpr (is_red_black) {
+
+      for (const Node *current = root.get(); current; current = current->left.get())
+          height += is_black(current);
+  }
+
+  return height;
+}
+
+/*
+ * Makes this tree the join of left, x and right, where every key of left is less than x's key and every key of right greater, and
+ * returns its black height. x must have no children. left_height and right_height are the black heights of left and right, whose
+ * roots must be black. Without the red-black policy, x simply becomes the root.
+ */
+template<class Key, class Value, class Compare, class Balance, class Allocator> 
+int bstree<Key, Value, Compare, Balance, Allocator>::join3(node_ptr left, int left_height, node_ptr x, node_ptr right, int right_height) noexcept
+{
+  auto adopt_children = [](Node *pnode, node_ptr lhs, node_ptr rhs) {
+
+      pnode->left = std::move(lhs);
+      pnode->right = std::move(rhs);
+
+      if (pnode->left)
+          pnode->left->parent = pnode;
+
+      if (pnode->right)
+          pnode->right->parent = pnode;
+
+      update_size(pnode);
+  };
+
+  x->parent = nullptr;
+
+  if (!is_red_black || left_height == right_height) {
+
+      x->color = Color::black;
+
+      adopt_children(x.get(), std::move(left), std::move(right));
+
+      root = std::move(x);
+
+      return left_height + 1;
+  }
+
+  bool left_taller = left_height > right_height;
+
+  root = std::move(left_taller ? left : right);
+
+  node_ptr shorter = std::move(left_taller ? right : left);
+
+  int height = std::max(left_height, right_height);
+  int target = std::min(left_height, right_height);
+
+  // Walk down the taller tree's inner spine to the first black node (or nullptr) whose black height is the shorter tree's.
+  Node *parent = nullptr;
+  node_ptr *slot = &root;
+
+  while (!(is_black(slot->get()) && height == target)) {
+
+      height -= is_black(slot->get());
+
+      parent = slot->get();
+      slot = left_taller ? &parent->right : &parent->left;
+  }
+
+  Node *z = x.get();
+
+  z->color = Color::red;
+
+  if (left_taller)
+      adopt_children(z, std::move(*slot), std::move(shorter));
+  else
+      adopt_children(z, std::move(shorter), std::move(*slot));
+
+  z->parent = parent;
+  *slot = std::move(x);
+
+  for (Node *pnode = parent; pnode != nullptr; pnode = pnode->parent)
+      update_size(pnode);
+
+  return std::max(left_height, right_height) + insert_fixup(z);
+}
+
+/*
+ * Splits the tree into the nodes for which goes_right(key) is false and those for which it is true, which must be a suffix of the
+ * keys. The walk down records each node, its black height and the side it continued on. The nodes are then detached from the
+ * bottom up: a node whose left side the walk took goes right, and is joined with its right subtree onto the right tree built so
+ * far (all of whose keys are smaller); the other nodes are joined with their left subtrees onto the left tree in the same way.
+ */
+template<class Key, class Value, class Compare, class Balance, class Allocator> template<class GoesRight> 
+std::pair<bstree<Key, Value, Compare, Balance, Allocator>, bstree<Key, Value, Compare, Balance, Allocator>> bstree<Key, Value, Compare, Balance, Allocator>::split_by(GoesRight goes_right)
+{
+  struct step {
+
+      Node *pnode;
+      int height;     // Black height of the subtree rooted at pnode.
+      bool went_left;
+  };
+
+  std::vector<step> path;
+
+  int height = black_height();
+
+  for (Node *current = root.get(); current; ) {
+
+      bool went_left = goes_right(current->key());
+
+      path.push_back({current, height, went_left});
+
+      if constexpr (is_red_black)
+          height -= is_black(current);
+
+      current = went_left ? current->left.get() : current->right.get();
+  }
+
+  bstree lower(node_alloc, comp), upper(node_alloc, comp);
+
+  int lower_height = 0, upper_height = 0;
+
+  for (auto it = path.rbegin(); it != path.rend(); ++it) {
+
+      node_ptr x = std::move(get_unique_ptr(it->pnode));
+
+      int child_height = it->height - (is_red_black && is_black(x.get()) ? 1 : 0);
+
+      if (it->went_left) {
+
+          node_ptr subtree = as_tree(std::move(x->right), child_height);
+
+          upper_height = upper.join3(std::move(upper.root), upper_height, std::move(x), std::move(subtree), child_height);
+
+      } else {
+
+          node_ptr subtree = as_tree(std::move(x->left), child_height);
+
+          lower_height = lower.join3(std::move(subtree), child_height, std::move(x), std::move(lower.root), lower_height);
+      }
+  }
+
+  return {std::move(lower), std::move(upper)};
+}
+
+// Joins left and right, which share an allocator, and whose keys are in order. The least node of right joins the two.
+template<class Key, class Value, class Compare, class Balance, class Allocator> 
+bstree<Key, Value, Compare, Balance, Allocator> bstree<Key, Value, Compare, Balance, Allocator>::join_trees(bstree& left, bstree& right) noexcept
+{
+  if (left.root == nullptr)
+      return std::move(right);
+
+  if (right.root == nullptr)
+      return std::move(left);
+
+  node_ptr x = right.unlink(right.min(right.root.get()));
+
+  bstree result(left.node_alloc, left.comp);
+
+  result.join3(std::move(left.root), left.black_height(), std::move(x), std::move(right.root), right.black_height());
+
+  return result;
+}
+
+// Points the deleter of every node in subtree at alloc.
+template<class Key, class Value, class Compare, class Balance, class Allocator> void bstree<Key, Value, Compare, Balance, Allocator>::reseat(node_ptr& subtree, node_allocator_type *alloc)
+{
+  std::vector<node_ptr *> stack{&subtree};
+
+  while (!stack.empty()) {
+
+      node_ptr *slot = stack.back();
+      stack.pop_back();
+
+      if (*slot) {
+
+          slot->get_deleter().alloc = alloc;
+
+          stack.push_back(&(*slot)->left);
+          stack.push_back(&(*slot)->right);
+      }
+  }
+}
+
+template<class Key, class Value, class Compare, class Balance, class Allocator> 
+bstree<Key, Value, Compare, Balance, Allocator> bstree<Key, Value, Compare, Balance, Allocator>::join(bstree&& left, bstree&& right)
+{
+  if (left.root && right.root && !left.comp(left.max(left.root.get())->key(), right.min(right.root.get())->key()))
+      throw std::invalid_argument("join(): every key of left must be less than every key of right");
+
+  if (left.node_alloc != right.node_alloc) {
+
+      if (left.can_adopt(*right.node_alloc))
+          reseat(right.root, left.node_alloc.get());
+      else {
+          node_ptr rebuilt = left.rebuild_subtree(right.root.get());
+
+          right.destroy_subtree(right.root); // The moved-from nodes go back to right's allocator.
+
+          right.root = std::move(rebuilt);
+      }
+
+      right.node_alloc = left.node_alloc;
+  }
+
+  return join_trees(left, right);
+}
+
+/*
+ * Walks lhs and rhs in order, collecting pointers to the pairs to keep: those whose keys are only in lhs (if left_only), in both (if
+ * both; lhs's pair is kept) or only in rhs (if right_only). from_sorted() then copies them into a new tree.
+ */
+template<class Key, class Value, class Compare, class Balance, class Allocator> 
+bstree<Key, Value, Compare, Balance, Allocator> bstree<Key, Value, Compare, Balance, Allocator>::merge_walk(const bstree& lhs, const bstree& rhs, bool left_only, bool both, bool right_only)
+{
+  std::vector<const value_type *> kept;
+
+  kept.reserve((left_only ? lhs.size() : 0) + (right_only ? rhs.size() : 0) + (both && !left_only ? std::min(lhs.size(), rhs.size()) : 0));
+
+  auto i = lhs.begin(), j = rhs.begin();
+
+  while (i != lhs.end() && j != rhs.end()) {
+
+      if (lhs.comp(i->first, j->first)) {
+
+          if (left_only)
+              kept.push_back(&*i);
+          ++i;
+
+      } else if (lhs.comp(j->first, i->first)) {
+
+          if (right_only)
+              kept.push_back(&*j);
+          ++j;
+
+      } else {
+
+          if (both)
+              kept.push_back(&*i);
+          ++i;
+          ++j;
+      }
+  }
+
+  for (; left_only && i != lhs.end(); ++i)
+      kept.push_back(&*i);
+
+  for (; right_only && j != rhs.end(); ++j)
+      kept.push_back(&*j);
+
+  return from_sorted(pair_ptr_iterator{kept.data()}, pair_ptr_iterator{kept.data() + kept.size()}, lhs.comp, 
+                     allocator_type(node_traits::select_on_container_copy_construction(*lhs.node_alloc)));
+}
+
+/*
+ * subtree goes to the front of the list. Its least node has no left child, so the list hangs there; the result is a binary tree,
+ * though no longer a search tree, which free_subtree() frees like any other.
+ */
+template<class Key, class Value, class Compare, class Balance, class Allocator> void bstree<Key, Value, Compare, Balance, Allocator>::discard_list::add(node_ptr subtree) noexcept
+{
+  if (!subtree)
+      return;
+
+  Node *least = subtree.get();
+
+  while (least->left)
+      least = least->left.get();
+
+  subtree->parent = nullptr;
+
+  std::lock_guard lock{m};
+
+  least->left = std::move(head);
+
+  if (least->left)
+      least->left->parent = least;
+
+  head = std::move(subtree);
+}
+
+/*
+ * Splits the red-black tree t, of black height height, into the keys less than key (lower), the keys greater (upper) and the node
+ * with key itself (match), which is left with no children. It is split_by() written recursively, so that it allocates nothing:
+ * the recursion is as deep as t is high. lower, upper and match must be empty, and lower_height and upper_height zero.
+ */
+template<class Key, class Value, class Compare, class Balance, class Allocator> template<class K> 
+void bstree<Key, Value, Compare, Balance, Allocator>::split3(node_ptr t, int height, const K& key, bstree& lower, int& lower_height, bstree& upper, int& upper_height, node_ptr& match) noexcept
+{
+  if (!t)
+      return;
+
+  node_ptr x = std::move(t);
+
+  int left_height = height - (is_black(x.get()) ? 1 : 0), right_height = left_height;
+
+  node_ptr left = as_tree(std::move(x->left), left_height);
+  node_ptr right = as_tree(std::move(x->right), right_height);
+
+  if (comp(key, x->key())) {
+
+      split3(std::move(left), left_height, key, lower, lower_height, upper, upper_height, match);
+
+      upper_height = upper.join3(std::move(upper.root), upper_height, std::move(x), std::move(right), right_height);
+
+  } else if (comp(x->key(), key)) {
+
+      split3(std::move(right), right_height, key, lower, lower_height, upper, upper_height, match);
+
+      lower_height = lower.join3(std::move(left), left_height, std::move(x), std::move(lower.root), lower_height);
+
+  } else {
+
+      x->parent = nullptr;
+      update_size(x.get());
+      match = std::move(x);
+
+      lower.root = std::move(left);
+      lower_height = left_height;
+
+      upper.root = std::move(right);
+      upper_height = right_height;
+  }
+}
+
+/*
+ * One step of the divide and conquer: a and b are red-black trees sharing this tree's allocator. The pivot is the root of a for
+ * union and intersection, whose result keeps a's nodes, and the root of b for difference. The other tree is split by the pivot's
+ * key, the two halves are combined, the lower ones by a task on the pool if the trees are large, and the results are joined, with
+ * the pivot in between if its key belongs in the result. Nothing here allocates or throws: dropped nodes go to discarded.
+ */
+template<class Key, class Value, class Compare, class Balance, class Allocator> 
+bstree<Key, Value, Compare, Balance, Allocator> bstree<Key, Value, Compare, Balance, Allocator>::combine(bstree a, bstree b, set_operation op, work_stealing_pool& pool, discard_list& discarded) noexcept
+{
+  if (a.root == nullptr || b.root == nullptr) {
+
+      switch (op) {
+
+        case set_operation::union_of:
+            return a.root ? std::move(a) : std::move(b);
+
+        case set_operation::intersection_of:
+            discarded.add(std::move(a.root));
+            discarded.add(std::move(b.root));
+            return a;
+
+        default:
+            discarded.add(std::move(b.root));
+            return a;
+      }
+  }
+
+  bool parallel = a.size() + b.size() > 2 * min_parallel_grain;
+
+  bool pivot_in_b = op == set_operation::difference_of;
+
+  bstree& pivot_tree = pivot_in_b ? b : a;
+  bstree& split_tree = pivot_in_b ? a : b;
+
+  int pivot_height = pivot_tree.black_height() - 1; // Black height of the pivot's subtrees: the root is black.
+  int split_height = split_tree.black_height();
+
+  node_ptr pivot = std::move(pivot_tree.root);
+
+  int pivot_left_height = pivot_height, pivot_right_height = pivot_height;
+
+  bstree pivot_left(node_alloc, comp), pivot_right(node_alloc, comp);
+
+  pivot_left.root = as_tree(std::move(pivot->left), pivot_left_height);
+  pivot_right.root = as_tree(std::move(pivot->right), pivot_right_height);
+
+  pivot->parent = nullptr;
+  update_size(pivot.get());
+
+  bstree split_lower(node_alloc, comp), split_upper(node_alloc, comp);
+
+  int split_lower_height = 0, split_upper_height = 0;
+
+  node_ptr match;
+
+  split3(std::move(split_tree.root), split_height, pivot->key(), split_lower, split_lower_height, split_upper, split_upper_height, match);
+
+  bstree& a_lower = pivot_in_b ? split_lower : pivot_left;
+  bstree& b_lower = pivot_in_b ? pivot_left : split_lower;
+  bstree& a_upper = pivot_in_b ? split_upper : pivot_right;
+  bstree& b_upper = pivot_in_b ? pivot_right : split_upper;
+
+  bstree lower(node_alloc, comp), upper(node_alloc, comp);
+
+  auto combine_lower = [&] { lower = combine(std::move(a_lower), std::move(b_lower), op, pool, discarded); };
+
+  if (parallel) {
+
+      work_stealing_pool::task_group group{pool};
+
+      bool spawned = true;
+
+      try {
+          group.run(combine_lower);
+
+      } catch (...) { // No memory for the task: do the work here.
+
+          spawned = false;
+      }
+
+      upper = combine(std::move(a_upper), std::move(b_upper), op, pool, discarded);
+
+      if (spawned)
+          group.wait();
+      else
+          combine_lower();
+
+  } else {
+
+      combine_lower();
+      upper = combine(std::move(a_upper), std::move(b_upper), op, pool, discarded);
+  }
+
+  bool keep_pivot = op == set_operation::union_of || (op == set_operation::intersection_of && match);
+
+  discarded.add(std::move(match));
+
+  if (!keep_pivot) {
+
+      discarded.add(std::move(pivot));
+
+      return join_trees(lower, upper);
+  }
+
+  bstree result(node_alloc, comp);
+
+  result.join3(std::move(lower.root), lower.black_height(), std::move(pivot), std::move(upper.root), upper.black_height());
+
+  return result;
+}
+
+template<class Key, class Value, class Compare, class Balance, class Allocator> 
+bstree<Key, Value, Compare, Balance, Allocator> bstree<Key, Value, Compare, Balance, Allocator>::parallel_set_operation(bstree& lhs, bstree& rhs, set_operation op, work_stealing_pool& pool)
+{
+  if constexpr (is_red_black) {
+
+      if (lhs.node_alloc == rhs.node_alloc || lhs.can_adopt(*rhs.node_alloc)) {
+
+          if (lhs.node_alloc != rhs.node_alloc) {
+
+              reseat(rhs.root, lhs.node_alloc.get());
+
+              rhs.node_alloc = lhs.node_alloc;
+          }
+
+          discard_list discarded;
+
+          bstree context(lhs.node_alloc, lhs.comp);
+
+          bstree result = context.combine(std::move(lhs), std::move(rhs), op, pool, discarded);
+
+          free_subtree(discarded.head);
+
+          return result;
+      }
+  }
+
+  bstree result = merge_walk(lhs, rhs, op != set_operation::intersection_of, op != set_operation::difference_of, op == set_operation::union_of);
+
+  lhs.destroy_tree();
+  rhs.destroy_tree();
+
+  return result;
+}
+
+// Returns the node with the smallest key greater than key, or nullptr.
+template<class Key, class Value, class Compare, class Balance, class Allocator> template<class K> typename bstree<Key, Value, Compare, Balance, Allocator>::Node *bstree<Key, Value, Compare, Balance, Allocator>::upper_bound_node(const K& key) const noexcept
+{
+  Node *current = root.get();
+  Node *result = nullptr;
+
+  while (current) {
+
+     if (comp(key, current->key())) {
+
+         result = current;
+         current = current->left.get();
+
+     } else {
+
+         current = current->right.get();
+     }
+  }
+
+  return result;
+}
+
+template<class Key, class Value, class Compare, class Balance, class Allocator> template<class K> 
+const typename bstree<Key, Value, Compare, Balance, Allocator>::node_ptr& bstree<Key, Value, Compare, Balance, Allocator>::get_floor(const typename bstree<Key, Value, Compare, Balance, Allocator>::node_ptr& pnode, const K& key) const noexcept
+{   
+   const node_ptr *current = &pnode;
+   const node_ptr *floor = nullptr;  // Greatest key less than key seen so far.
+
+   while (*current) {
+
+      if (equivalent((*current)->key(), key)) 
+         return *current;
+
+      if (comp(key, (*current)->key())) {
+
+          current = &(*current)->left;
+
+      } else {
+
+          floor = current;
+          current = &(*current)->right;
+      }
+   }
+
+   return floor ? *floor : *current; // *current is nullptr
+}
+
+template<class Key, class Value, class Compare, class Balance, class Allocator> template<class K> 
+const typename bstree<Key, Value, Compare, Balance, Allocator>::node_ptr& bstree<Key, Value, Compare, Balance, Allocator>::get_ceiling(const typename bstree<Key, Value, Compare, Balance, Allocator>::node_ptr& pnode, const K& key) const noexcept
+{   
+   const node_ptr *current = &pnode;
+   const node_ptr *ceiling = nullptr;  // Least key greater than key seen so far.
+
+   while (*current) {
+
+      if (equivalent((*current)->key(), key)) 
+         return *current;
+
+      if (comp(key, (*current)->key())) {
+
+          ceiling = current;
+          current = &(*current)->left;
+
+      } else {
+
+          current = &(*current)->right;
+      }
+   }
+
+   return ceiling ? *ceiling : *current; // *current is nullptr
+}
+
+// After splay_search(), the root holds key or one of its neighbors, so the floor is the root or the root's predecessor.
+template<class Key, class Value, class Compare, class Balance, class Allocator> template<class K> Key bstree<Key, Value, Compare, Balance, Allocator>::splay_floor_key(const K& key)
+{
+  if (isEmpty()) 
+      throw std::logic_error("floor() called with empty tree");
+
+  const Node *pnode = splay_search(key);
+
+  if (comp(key, pnode->key()))
+      pnode = getPredecessor(pnode);
+
+  if (!pnode)
+      throw std::logic_error("argument to floor() is too small");
+
+  return pnode->key();
+}
+
+template<class Key, class Value, class Compare, class Balance, class Allocator> template<class K> Key bstree<Key, Value, Compare, Balance, Allocator>::splay_ceiling_key(const K& key)
+{
+  if (isEmpty()) 
+      throw std::logic_error("ceiling() called with empty tree");
+
+  const Node *pnode = splay_search(key);
+
+  if (comp(pnode->key(), key))
+      pnode = getSuccessor(pnode);
+
+  if (!pnode)
+      throw std::logic_error("argument to ceiling() is too large");
+
+  return pnode->key();
+}
+
+template<class Key, class Value, class Compare, class Balance, class Allocator> template<class K> Key bstree<Key, Value, Compare, Balance, Allocator>::floor_key(const K& key) const
+{
+  if (isEmpty()) 
+      throw std::logic_error("floor() called with empty tree");
+
+  const Node *pnode = get_floor(key);
+  
+  if (!pnode)
+      throw std::logic_error("argument to floor() is too small");
+  else 
+       return pnode->key();
 }
 
-/*
-template<class Key, class Value> bstree<Key, Value>::Node::Node(Key key, const Value& value, Node *ptr2parent)  : parent{ptr2parent}, left{nullptr}, right{nullptr}, \
-        __vt{key, value}
+template<class Key, class Value, class Compare, class Balance, class Allocator> template<class K> Key bstree<Key, Value, Compare, Balance, Allocator>::ceiling_key(const K& key) const
 {
+  if (isEmpty()) 
+      throw std::logic_error("ceiling() called with empty tree");
+
+  const Node *pnode = get_ceiling(key);
+   
+  if (!pnode)
+      throw std::logic_error("argument to ceiling() is too large");
+  else 
+       return pnode->key();
 }
-*/
-template<class Key, class Value> inline bstree<Key, Value>::Node::Node(Node&& node) : __vt{std::move(node.__vt)}, left{std::move(node.left)}, right{std::move(node.right)}, parent{node.ptr2parent} 
+
+template<class Key, class Value, class Compare, class Balance, class Allocator> void bstree<Key, Value, Compare, Balance, Allocator>::insert(std::initializer_list<value_type>& list) noexcept 
 {
+   for (const auto& [key, value] : list) 
+
+      insert_or_assign(key, value);
 }
 
 /*
- * Input:  pnode is a raw Node *.
- * Return: A reference to the unique_ptr that manages pnode.
+ * Algorithm from page 294 of Introduction to Alogorithm, 3rd Edition by Cormen, et. al. findNode() has already descended to parent,
+ * the leaf below which node's key belongs (nullptr if the tree is empty). node becomes parent's left or right child, every ancestor's
+ * size grows by one, and the red-black policy restores its invariants.
  */
-template<class Key, class Value> std::unique_ptr<typename bstree<Key, Value>::Node>& bstree<Key, Value>::get_unique_ptr(Node *pnode) noexcept
+template<class Key, class Value, class Compare, class Balance, class Allocator> typename bstree<Key, Value, Compare, Balance, Allocator>::Node *bstree<Key, Value, Compare, Balance, Allocator>::link_node(node_ptr node, Node *parent) noexcept
 {
-  if (pnode->parent == nullptr) { // Is pnode the root? 
+  Node *pnew = node.get();
 
-     return root; 
+  pnew->parent = parent;
+  pnew->color = Color::red; // A node from another tree keeps its old color.
+  
+  if (!parent)
+     root = std::move(node); // tree was empty
+  else if (comp(pnew->key(), parent->key()))
+       parent->left = std::move(node);
+  else 
+       parent->right = std::move(node);  
 
-  } else {
+  for (; parent != nullptr; parent = parent->parent) // Every ancestor's subtree gained a node.
+      ++parent->size;
 
-     return (pnode->parent->left.get() == pnode) ? pnode->parent->left : pnode->parent->right;  
-  }
+  if constexpr (is_red_black) 
+      insert_fixup(pnew);
+  else if constexpr (is_splay)
+      splay_node(pnew);
+
+  return pnew;
 }
 
-template<class Key, class Value> template<typename Functor> void bstree<Key, Value>::DoInOrderTraverse(Functor f, const std::unique_ptr<Node>& current) const noexcept
+template<class Key, class Value, class Compare, class Balance, class Allocator> template<class K, class... Args> std::pair<typename bstree<Key, Value, Compare, Balance, Allocator>::iterator, bool> bstree<Key, Value, Compare, Balance, Allocator>::try_emplace_key(const Node *finger, K&& key, Args&&... args)
 {
-   if (current == nullptr) {
+  auto [found, pnode] = findNode_near(key, finger);
 
-      return;
-   }
+  Node *parent = const_cast<Node *>(pnode);
+
+  if (found) {
 
-   DoInOrderTraverse(f, current->left);
+      if constexpr (is_splay)
+          splay_node(parent);
 
-   f(current->__vt.__get_value()); 
+      return {iterator{parent, this}, false};
+  }
+
+  node_ptr node = make_node(parent, std::in_place, std::piecewise_construct, std::forward_as_tuple(std::forward<K>(key)),
+                            std::forward_as_tuple(std::forward<Args>(args)...));
 
-   DoInOrderTraverse(f, current->right);
+  return {iterator{link_node(std::move(node), parent), this}, true};
 }
 
-template<class Key, class Value> template<typename Functor> void bstree<Key, Value>::DoPreOrderTraverse(Functor f, const std::unique_ptr<Node>& current) const noexcept
+template<class Key, class Value, class Compare, class Balance, class Allocator> template<class K, class M> std::pair<typename bstree<Key, Value, Compare, Balance, Allocator>::iterator, bool> bstree<Key, Value, Compare, Balance, Allocator>::insert_or_assign_key(const Node *finger, K&& key, M&& obj)
 {
-   if (current == nullptr) {
+  auto [found, pnode] = findNode_near(key, finger);
 
-      return;
-   }
+  Node *parent = const_cast<Node *>(pnode);
 
-   f(current->__vt.__get_value()); 
+  if (found) {
 
-   DoPreOrderTraverse(f, current->left);
+      parent->value() = std::forward<M>(obj);
 
-   DoPreOrderTraverse(f, current->right);
+      if constexpr (is_splay)
+          splay_node(parent);
+
+      return {iterator{parent, this}, false};
+  }
+
+  node_ptr node = make_node(parent, std::in_place, std::forward<K>(key), std::forward<M>(obj));
+
+  return {iterator{link_node(std::move(node), parent), this}, true};
 }
 
-template<class Key, class Value> template<typename Functor> void bstree<Key, Value>::DoPostOrderTraverse(Functor f, const std::unique_ptr<Node>& current) const noexcept
+template<class Key, class Value, class Compare, class Balance, class Allocator> template<class... Args> std::pair<typename bstree<Key, Value, Compare, Balance, Allocator>::iterator, bool> bstree<Key, Value, Compare, Balance, Allocator>::emplace(Args&&... args)
 {
-   if (current == nullptr) {
+  node_ptr node = make_node(nullptr, std::in_place, std::forward<Args>(args)...);
 
-      return;
-   }
+  auto [found, pnode] = findNode(node->key(), root.get());
 
-   DoPostOrderTraverse(f, current->left);
+  Node *parent = const_cast<Node *>(pnode);
 
-   DoPostOrderTraverse(f, current->right);
+  if (found)
+      return {iterator{parent, this}, false}; // node is destroyed
 
-   f(current->__vt.__get_value()); 
+  return {iterator{link_node(std::move(node), parent), this}, true};
 }
+
 /*
- * Post order node destruction
+ * Returns node as a node of this tree. If this tree can adopt node's allocator, the node itself is returned, its deleter now
+ * pointing at this tree's allocator. Otherwise node's key and value are moved into a new node, and the moved-from node stays 
+ * with node.
  */
-template<class Key, class Value> void bstree<Key, Value>::destroy_subtree(std::unique_ptr<Node>& current) noexcept
+template<class Key, class Value, class Compare, class Balance, class Allocator> typename bstree<Key, Value, Compare, Balance, Allocator>::node_ptr bstree<Key, Value, Compare, Balance, Allocator>::adopt(node_ptr& node)
 {
-   if (current == nullptr) {
+  if (can_adopt(*node.get_deleter().alloc))
+      return node_ptr{node.release(), node_deleter{node_alloc.get()}};
 
-      return;
-   }
+  return make_node(nullptr, std::in_place, node->__vt.__move());
+}
+
+template<class Key, class Value, class Compare, class Balance, class Allocator> typename bstree<Key, Value, Compare, Balance, Allocator>::insert_return_type bstree<Key, Value, Compare, Balance, Allocator>::insert(node_type&& nh)
+{
+  if (nh.empty())
+      return {end(), false, node_type{}};
+
+  auto [found, pnode] = findNode(nh.pnode->key(), root.get());
+
+  Node *parent = const_cast<Node *>(pnode);
+
+  if (found)
+      return {iterator{parent, this}, false, std::move(nh)};
 
-   destroy_subtree(current->left);
+  Node *pnew = link_node(adopt(nh.pnode), parent);
 
-   destroy_subtree(current->right);
+  nh = node_type{};
 
-   current.reset();
+  return {iterator{pnew, this}, true, node_type{}};
 }
+
 /*
- * Algorithm taken from page 290 of Introduction to Algorithms by Cormen, 3rd Edition, et. al.
+ * Walks source in order, moving each node whose key is absent from this tree. unlink() relinks nodes rather than moving their 
+ * contents, so the successor found before a node is unlinked is still the next node to visit.
  */
-/*-- Change to return unique_ptr<Node>
-template<class Key, class Value> typename bstree<Key, Value>::Node *bstree<Key, Value>::find(Key key, const std::unique_ptr<Node>& current) const noexcept
+template<class Key, class Value, class Compare, class Balance, class Allocator> void bstree<Key, Value, Compare, Balance, Allocator>::merge(bstree& source)
 {
-  if (!current || current->key() == key)
-     return current.get();
-  if (key < current->key())
-     return find(key, current->left);
-  else return find(key, current->right);
-}
-*/
+  if (&source == this || !source.root)
+      return;
 
-template<class Key, class Value> std::unique_ptr<typename bstree<Key, Value>::Node>& bstree<Key, Value>::find(Key key, std::unique_ptr<Node>& current) const noexcept
-{
-  if (!current || current->key() == key)
-     return current;
-  if (key < current->key())
-     return find(key, current->left);
-  else return find(key, current->right);
-}
+  bool relink = can_adopt(*source.node_alloc);
 
-/*
- * Returns pair<bool, const Node *>, where
- * If key found, {true, Node * of found node}
- * If key not node found, {false, Node * of leadf node where insert should occur}
-*/
-template<class Key, class Value> std::pair<bool, const typename bstree<Key, Value>::Node *> bstree<Key, Value>::findNode(const key_type& key, const typename bstree<Key, Value>::Node *current) const noexcept
-{
-  const Node *parent = nullptr;
+  for (Node *pnode = source.min(source.root.get()); pnode != nullptr; ) {
 
-  while (current != nullptr) {
+      Node *next = source.getSuccessor(pnode);
 
-     if (current->key() ==  key) return {true, current}; 
+      auto [found, parent] = findNode(pnode->key(), root.get());
 
-      parent = current;
+      if (!found) {
 
-      current = (key < current->key()) ? current->left.get() : current->right.get(); 
-  }
-  
-  return {false, parent}; 
-}
+          if (relink) {
 
-template<class Key, class Value> typename bstree<Key, Value>::Node *bstree<Key, Value>::min(typename bstree<Key, Value>::Node *current) const noexcept
-{
-  while (current->left != nullptr) {
+              node_ptr node = source.unlink(pnode);
 
-       current = current->left.get();
-  } 
+              link_node(adopt(node), const_cast<Node *>(parent));
 
-  return current;  
+          } else {
+
+              link_node(make_node(nullptr, std::in_place, pnode->__vt.__move()), const_cast<Node *>(parent));
+
+              source.unlink(pnode); // destroys the moved-from node
+          }
+      }
+
+      pnode = next;
+  }
 }
 
 /*
- The code for tree-successor is broken into two cases. If the right subtree of node x is nonempty, then the successor of x is just the left-most node in the right subtree, which is found
- by calling min(x->right). On the other hand, if the right subtree of node x is empty and x has a successor y, then y is the lowest ancestor of x whose left child is also an ancestor of x.
- To find y, we simply go up the tree from x until we encounter a node that is the left child of its parent.
+ * Left rotation from page 313 of Introduction to Algorithms, 3rd Edition. x's right child y takes x's place, x becomes y's left child,
+ * and y's former left subtree becomes x's right subtree. Ownership moves in the same order as the pointer assignments in CLRS: the
+ * unique_ptr that owned x (either root or a child pointer of x->parent) ends up owning y, and y->left ends up owning x. 
+ */
+template<class Key, class Value, class Compare, class Balance, class Allocator> typename bstree<Key, Value, Compare, Balance, Allocator>::Node *bstree<Key, Value, Compare, Balance, Allocator>::rotate_left(Node *x) noexcept
+{
+  node_ptr& x_owner = get_unique_ptr(x);
 
- Pseudo code 
+  node_ptr y = std::move(x->right);
 
- tree-successor(x)
- {
-    if x->right ==  NIL
-  
-       return min(x->right)
-  
-   y = x->parent
-  
-   while (y != NIL and x = y->right)
-  
-        x = y
-  
-        y = y->parent
-   }
-  
-   return y
- }
- 
-  */
-template<class Key, class Value>  typename bstree<Key, Value>::Node* bstree<Key, Value>::getSuccessor(const typename bstree<Key, Value>::Node *x) const noexcept
-{
-  if (!x->right) 
-      return min(x->right);
+  x->right = std::move(y->left); // y's left subtree becomes x's right subtree
 
-  Node *parent = x->parent;
+  if (x->right) 
+      x->right->parent = x;
 
-  // To find the smallest parent of child whose left child is also an ancestor of x, we ascend the parent chain until we find a node that is a left child.
-  // If its parent is nullptr, then there we are at the root and there is no successor.  
-  while(parent && x == parent->right.get()) {
+  y->parent = x->parent;
+  x->parent = y.get();
 
-       x = parent;
+  y->left = std::move(x_owner);  // x becomes y's left child...
+  x_owner = std::move(y);        // ...and y takes x's former place.
 
-       parent = parent->parent;
-  }
+  update_size(x);
+  update_size(x->parent);
 
-  return parent;
+  return x->parent;
 }
 
-template<class Key, class Value>  
-const typename std::unique_ptr<typename bstree<Key, Value>::Node>& bstree<Key, Value>::get_floor(const typename std::unique_ptr<typename bstree<Key, Value>::Node>& pnode, Key key) const noexcept
-{   
-   if (!pnode) 
-       return pnode;
+// Mirror image of rotate_left().
+template<class Key, class Value, class Compare, class Balance, class Allocator> typename bstree<Key, Value, Compare, Balance, Allocator>::Node *bstree<Key, Value, Compare, Balance, Allocator>::rotate_right(Node *x) noexcept
+{
+  node_ptr& x_owner = get_unique_ptr(x);
 
-   if (key == pnode->key()) 
-      return pnode;
+  node_ptr y = std::move(x->left);
 
-   if (key < pnode->key())
-       return get_floor(pnode->left, key);
+  x->left = std::move(y->right);
 
-   auto& pnode_r = get_floor(pnode->right, key);
+  if (x->left) 
+      x->left->parent = x;
 
-   if (pnode_r) 
-       return pnode_r;   
-   else
-       return pnode;
+  y->parent = x->parent;
+  x->parent = y.get();
+
+  y->right = std::move(x_owner);
+  x_owner = std::move(y);
+
+  update_size(x);
+  update_size(x->parent);
+
+  return x->parent;
 }
 
 /*
- * TODO: What is the terminating test for this algorithm? (taken from https://algs4.cs.princeton.edu/32bst/BST.java.html)
+ * Bottom-up splaying from Sleator and Tarjan, "Self-Adjusting Binary Search Trees" (JACM 1985), built from the rotations above. Until x
+ * is the root, one of three steps moves it up: zig, one rotation when x's parent is the root; zig-zig, when x and its parent are
+ * both left or both right children, rotating the grandparent first and then the parent, which roughly halves the depth of every
+ * node on the path; and zig-zag otherwise, rotating x up twice. The rotations keep every node's size current.
  */
-template<class Key, class Value>  
-const typename std::unique_ptr<typename bstree<Key, Value>::Node>& bstree<Key, Value>::get_ceiling(const std::unique_ptr<typename bstree<Key, Value>::Node>& pnode, Key key) const noexcept
-{   
-   if (!pnode)  // nullptr
-       return pnode;
+template<class Key, class Value, class Compare, class Balance, class Allocator> void bstree<Key, Value, Compare, Balance, Allocator>::splay_node(Node *x) noexcept
+{
+  while (Node *p = x->parent) {
 
-   if (key == pnode->key()) 
-       return pnode;
+      Node *g = p->parent;
 
-   if(key < pnode->key()) {
+      bool x_is_left = x == p->left.get();
 
-      auto& pnode_t = get_ceiling(pnode->left, key); 
+      if (!g) {                                      // zig
 
-      if (pnode_t)  // If pnode_t is not nullptr, return pnode_t
-          return pnode_t;
-      else 
-          return pnode; // else return pnode
-   }
+          x_is_left ? rotate_right(p) : rotate_left(p);
 
-   return get_ceiling(pnode->right, key);
-}
+      } else if (x_is_left == (p == g->left.get())) { // zig-zig
 
-template<class Key, class Value> void bstree<Key, Value>::insert(std::initializer_list<value_type>& list) noexcept 
-{
-   for (const auto& [key, value] : list) 
+          if (x_is_left) {
 
-      insert_or_assign(key, value);
+              rotate_right(g);
+              rotate_right(p);
+
+          } else {
+
+              rotate_left(g);
+              rotate_left(p);
+          }
+
+      } else if (x_is_left) {                        // zig-zag
+
+          rotate_right(p);
+          rotate_left(g);
+
+      } else {
+
+          rotate_left(p);
+          rotate_right(g);
+      }
+  }
 }
 
 /*
- * Algorithm from page 294 of Introduction to Alogorithm, 3rd Edition by Cormen, et. al
- *
+ * RB-INSERT-FIXUP from page 316 of Introduction to Algorithms, 3rd Edition. The new node z is red, so the only property that can be 
+ * violated is that a red node has no red child. Case 1 (red uncle) recolors and moves z two levels up; cases 2 and 3 (black uncle)
+ * finish with at most two rotations. Returns true if case 1 reached the root, whose blackening then raised the tree's black height.
  */
-template<class Key, class Value> bool bstree<Key, Value>::insert_or_assign(const key_type& key, const mapped_type& value) noexcept
+template<class Key, class Value, class Compare, class Balance, class Allocator> bool bstree<Key, Value, Compare, Balance, Allocator>::insert_fixup(Node *z) noexcept
 {
-  Node *parent = nullptr;
- 
-  Node *current = root.get();
- 
-  // parent will become the parent of the new node. One of its children (that is nullptr) will become the new node. 
-  while (current) { 
- 
-      parent = current;
- 
-      if (key == current->key()) {
+  while (is_red(z->parent)) {
 
-          current->value() = value;
-          return false;
-      }
- 
-      else if (key < current->key())
-           current = current->left.get();
-      else
-           current = current->right.get();
-  }     
-  std::unique_ptr<Node> node = std::make_unique<Node>(key, value, parent); 
-  
-  if (!parent)
-     root = std::move(node); // tree was empty
-  else if (node->key() < parent->key())
-       parent->left = std::move(node);
-  else 
-       parent->right = std::move(node);  
+     Node *p = z->parent; 
+     Node *g = p->parent; // p is red, so it is not the root, and g is not nullptr.
+
+     if (p == g->left.get()) {
+
+         Node *uncle = g->right.get();
+
+         if (is_red(uncle)) {        // case 1
+
+             p->color = Color::black;
+             uncle->color = Color::black;
+             g->color = Color::red;
+             z = g;
+
+         } else {
+
+             if (z == p->right.get()) { // case 2: turned into case 3
+
+                 z = p;
+                 rotate_left(z);
+                 p = z->parent;
+             }
+
+             p->color = Color::black;   // case 3
+             g->color = Color::red;
+             rotate_right(g);
+         }
+
+     } else { // Same as above with left and right exchanged.
 
-  ++size;
-  return true;
+         Node *uncle = g->left.get();
+
+         if (is_red(uncle)) { 
+
+             p->color = Color::black;
+             uncle->color = Color::black;
+             g->color = Color::red;
+             z = g;
+
+         } else {
+
+             if (z == p->left.get()) { 
+
+                 z = p;
+                 rotate_right(z);
+                 p = z->parent;
+             }
+
+             p->color = Color::black;
+             g->color = Color::red;
+             rotate_left(g);
+         }
+     }
+  }
+
+  bool grew = is_red(root.get()); // Blackening a red root adds one to every path's black count.
+
+  root->color = Color::black;
+
+  return grew;
 }
 
 /*
@@ -987,111 +3906,201 @@ pseudocode
 
 }
  */
-template<class Key, class Value> bool bstree<Key, Value>::remove(Key key, std::unique_ptr<Node>& root_sub) noexcept // root of subtree
+template<class Key, class Value, class Compare, class Balance, class Allocator> template<class K> bool bstree<Key, Value, Compare, Balance, Allocator>::remove(const K& key, node_ptr& root_sub) noexcept // root of subtree
 {
-  std::unique_ptr<Node>& pnode = find(key, root_sub);
+  node_ptr& pnode = find(key, root_sub);
   
   if (!pnode) return false;
 
-  // There are three cases to consider:
- 
-  // Case 1: If both children are NIL, we can simply delete the node (which sets it to NIL). 
-  if (!pnode->left && !pnode->right) 
-      pnode.reset();    
+  unlink(pnode.get()); // The returned unique_ptr deletes the node.
 
-  // Case 2: pnode has just one child, thus we elevate that child to take pnode's position in the tree
-  // by modifying pnode's parent to replace pnode by it's child.
+  return true; 
+}
 
-  /*
-   Case 2: Both children are non-NIL. We find pnode's successor y, which we know lies in pnode's right subtree and has no left child.
-   We want to splice y out of its current location and have it replace pnode in the tree. There are two cases to consider:
-  
-   1. The easier case is, if y is pnode's right child, then we replace pnode by y, leaving y’s right child alone. Easy case.
-  
-   2. Otherwise, y lies within pnode's right subtree but is not pnode's right child (part (d)). In this case, we first
-      replace y by its own right child, and then we replace pnode by y.
-  */
-  else if (pnode->left && pnode->right) {  // (pnode->left && p->right) == true
+/*
+ * tree-delete(z) from page 298 of Introduction to Algorithms, 3rd Edition, with red-black bookkeeping from RB-DELETE on page 324.
+ * It detaches z from the tree by relinking nodes, rather than by copying the successor's key and value into z, and returns ownership
+ * of z. There are three cases:
+ *
+ * 1. z has no left child: replace z by its right child (which may be nullptr).
+ * 2. z has a left child but no right child: replace z by its left child.
+ * 3. z has two children: its successor y is min(z->right), and y has no left child.
+ *    a. If y is z's right child, y simply replaces z, and z's left subtree becomes y's left subtree.
+ *    b. Otherwise we first replace y by its own right child, then make z's right subtree y's right subtree, and then proceed as in a.
+ *
+ * x is the node that moves into the position vacated by y (or by z in cases 1 and 2). Since x may be nullptr, its parent is tracked
+ * separately in x_parent. If the node removed from its position was black, remove_fixup() restores the red-black properties.
+ */
+template<class Key, class Value, class Compare, class Balance, class Allocator> typename bstree<Key, Value, Compare, Balance, Allocator>::node_ptr bstree<Key, Value, Compare, Balance, Allocator>::unlink(Node *z) noexcept
+{
+  Color removed_color = z->color;
 
-      if (!pnode->right->left) { // sub-case 1: Since pnode->right->left is NIL, we know the successor must be pnode->right.
+  Node *x;
+  Node *x_parent;
+  node_ptr owner; // will own z
 
-          pnode->right->parent = pnode->parent; // Before the move-assignment of pnode with pnode->right, adjust pnode->right->parent
-                                                // to be pnode's parent  
- 
-          pnode = std::move(pnode->right); // move-assign pdnoe with its right child, thus, deleting pnode.
+  if (!z->left) {                     // case 1
 
-      } else  { 
+      x = z->right.get();
+      x_parent = z->parent;
+      owner = transplant(z, std::move(z->right));
 
-          // Because pnode has two children, we know its successor y lies within pnode's right subtree.
+  } else if (!z->right) {             // case 2
 
-          Node *suc = min(pnode->right); // In this case, we swap pnode's underlying pointer with y's underlying pointer, and then we replace pnode by it's right child, which before the 
-                                                        // swap was y's right child.
+      x = z->left.get();
+      x_parent = z->parent;
+      owner = transplant(z, std::move(z->left));
 
-          std::unique_ptr<Node>& y = suc->parent->left.get() == suc ? suc->parent->left : suc->parent->right;
+  } else {                            // case 3
 
-          /*
-          pnode.swap(y);    // Q: Doesn't y->parent need to be set?
-          pnode = std::move(pnode->right);
-           */
+      Node *y = min(z->right.get()); 
 
-          pnode->__vt = std::move(y->__vt); // move-assign successor's values to pnode's values. No pointers change
-          y = std::move(y->right);          // Replace successor with its right child.
-      }
-      
-  } else { // Case 3: pnode has only one child. 
+      removed_color = y->color;
+      x = y->right.get();
 
-      std::unique_ptr<Node>& onlyChild = pnode->left ? pnode->left : pnode->right;
+      node_ptr y_owner;
 
-      onlyChild->parent = pnode->parent; // Before the move-assignment, we set onlyChild->parent to 
-                                         // pnode's parent.
+      if (y->parent == z) {           // case 3a
 
-      pnode = std::move(onlyChild);      // Replace pnode by move-assignmetn with its only non-NIL child, thus, deleting pnode.
+          x_parent = y;
+          y_owner = std::move(z->right);
+
+      } else {                        // case 3b
+
+          x_parent = y->parent;
+          y_owner = transplant(y, std::move(y->right));
+
+          y_owner->right = std::move(z->right);
+          y_owner->right->parent = y;
+      }
+
+      y_owner->left = std::move(z->left);
+      y_owner->left->parent = y;
+      y->color = z->color;
+
+      owner = transplant(z, std::move(y_owner));
   }  
 
-  --size; 
+  owner->parent = nullptr;
+  owner->size = 1;
 
-  return true; 
+  for (Node *pnode = x_parent; pnode != nullptr; pnode = pnode->parent) // This path includes y, if it took z's place.
+      update_size(pnode);
+
+  if constexpr (is_red_black) {
+
+      if (removed_color == Color::black)
+          remove_fixup(x, x_parent);
+  }
+
+  return owner;
 }
 
 /*
-transplant replaces one subtree rooted at pnode as a child of its parent with another subtree rooted at suc(cessor).
-transplant does not update v.left or v.right <-- Well, I did update them.
+transplant replaces the subtree rooted at u, as a child of its parent, with the subtree rooted at v. Like TRANSPLANT on page 296 of 
+Introduction to Algorithms, 3rd Edition, it does not update v->left or v->right; doing so is the caller's responsibility. The unique_ptr
+that owned u now owns v, and ownership of u is returned to the caller.
  */
+template<class Key, class Value, class Compare, class Balance, class Allocator> typename bstree<Key, Value, Compare, Balance, Allocator>::node_ptr bstree<Key, Value, Compare, Balance, Allocator>::transplant(Node *u, node_ptr v) noexcept
+{
+   node_ptr& u_owner = get_unique_ptr(u);
+
+   if (v) 
+      v->parent = u->parent;
+
+   node_ptr tmp = std::move(u_owner);
+
+   u_owner = std::move(v); 
+
+   return tmp;
+}
 
-template<class Key, class Value> void bstree<Key, Value>::transplant(std::unique_ptr<Node>& pnode, std::unique_ptr<Node>&suc) noexcept
+/*
+ * RB-DELETE-FIXUP from page 326 of Introduction to Algorithms, 3rd Edition. x carries an "extra black". Case 1 (red sibling w) is 
+ * converted to case 2, 3 or 4; case 2 moves the extra black up the tree; cases 3 and 4 terminate after at most three rotations.
+ */
+template<class Key, class Value, class Compare, class Balance, class Allocator> void bstree<Key, Value, Compare, Balance, Allocator>::remove_fixup(Node *x, Node *x_parent) noexcept
 {
-   // Save for later 
-    Node *parent = pnode->parent;
+  while (x != root.get() && is_black(x)) {
 
-    auto is_left_child = parent->left == pnode ? true : false;
+     if (x == x_parent->left.get()) {
 
-   // release right child of pnode
-    std::unique_ptr<Node> r{  std::move( pnode->right.release() ) }; 
+         Node *w = x_parent->right.get(); // Since x is doubly black, its sibling w cannot be nullptr.
 
-    r->left.release(); // BUG: Causes suc to dangle because r->left == suc.
+         if (is_red(w)) {                                   // case 1
 
-    r->connectLeft(suc->right);  // suc->right is x
+             w->color = Color::black;
+             x_parent->color = Color::red;
+             rotate_left(x_parent);
+             w = x_parent->right.get();
+         }
 
-    suc->connectRight(r);
+         if (is_black(w->left.get()) && is_black(w->right.get())) { // case 2
 
-    // Save pnode's left child. It will become suc left child.
-    std::unique_ptr pnode_left{ std::move(pnode->left) }; 
+             w->color = Color::red;
+             x = x_parent;
+             x_parent = x->parent;
 
-    if (is_left_child) {
-       
-       parent->connectLeft(suc);
-       
-    }
-    else {
-       parent->connectRight(suc); 
+         } else {
 
-    }
+             if (is_black(w->right.get())) {                // case 3
 
-    suc->connectLeft(pnode_left);
-    
+                 w->left->color = Color::black;
+                 w->color = Color::red;
+                 rotate_right(w);
+                 w = x_parent->right.get();
+             }
+
+             w->color = x_parent->color;                    // case 4
+             x_parent->color = Color::black;
+             w->right->color = Color::black;
+             rotate_left(x_parent);
+             x = root.get();
+         }
+
+     } else { // Same as above with left and right exchanged.
+
+         Node *w = x_parent->left.get();
+
+         if (is_red(w)) {
+
+             w->color = Color::black;
+             x_parent->color = Color::red;
+             rotate_right(x_parent);
+             w = x_parent->left.get();
+         }
+
+         if (is_black(w->right.get()) && is_black(w->left.get())) {
+
+             w->color = Color::red;
+             x = x_parent;
+             x_parent = x->parent;
+
+         } else {
+
+             if (is_black(w->left.get())) {
+
+                 w->right->color = Color::black;
+                 w->color = Color::red;
+                 rotate_left(w);
+                 w = x_parent->left.get();
+             }
+
+             w->color = x_parent->color;
+             x_parent->color = Color::black;
+             w->left->color = Color::black;
+             rotate_right(x_parent);
+             x = root.get();
+         }
+     }
+  }
+
+  if (x) 
+      x->color = Color::black;
 }
 
-template<class Key, class Value> inline int bstree<Key, Value>::height() const noexcept
+
+template<class Key, class Value, class Compare, class Balance, class Allocator> inline int bstree<Key, Value, Compare, Balance, Allocator>::height() const noexcept
 {
    return height(root.get());
 }
@@ -1104,7 +4113,7 @@ template<class Key, class Value> inline int bstree<Key, Value>::height() const n
  *          3 for level immediately below level 2
  *          etc. 
  */
-template<class Key, class Value> int bstree<Key, Value>::depth(const Node *pnode) const noexcept
+template<class Key, class Value, class Compare, class Balance, class Allocator> int bstree<Key, Value, Compare, Balance, Allocator>::depth(const Node *pnode) const noexcept
 {
     if (pnode == nullptr) return -1;
 
@@ -1112,11 +4121,11 @@ template<class Key, class Value> int bstree<Key, Value>::depth(const Node *pnode
       
     for (const Node *current = root; current != nullptr; ++depth) {
 
-      if (current->key() == pnode->key()) {
+      if (equivalent(current->key(), pnode->key())) {
 
           return depth;
 
-      } else if (pnode->key() < current->key()) {
+      } else if (comp(pnode->key(), current->key())) {
 
           current = current->left;
 
@@ -1129,19 +4138,57 @@ template<class Key, class Value> int bstree<Key, Value>::depth(const Node *pnode
     return -1; // not found
 }
 
-template<class Key, class Value> int bstree<Key, Value>::height(const Node* pnode) const noexcept
+/*
+ * Returns the number of edges on the longest path from pnode down to a leaf, or -1 if pnode is nullptr. The subtree is walked in 
+ * pre-order with the parent pointers (see DoPreOrderTraverse()), tracking the depth of the current node.
+ */
+template<class Key, class Value, class Compare, class Balance, class Allocator> int bstree<Key, Value, Compare, Balance, Allocator>::height(const Node* pnode) const noexcept
 {
    if (pnode == nullptr) {
 
        return -1;
+   }
 
-   } else {
+   int height = 0;
+   int depth = 0;
+
+   const Node *current = pnode;
+
+   while (true) {
+
+      height = std::max(height, depth);
+
+      if (current->left) {
+
+          current = current->left.get();
+          ++depth;
+
+      } else if (current->right) {
 
-      return 1 + std::max(height(pnode->left.get()), height(pnode->right.get()));
+          current = current->right.get();
+          ++depth;
+
+      } else {
+
+          const Node *child;
+
+          do {
+              child = current;
+              current = current->parent;
+              --depth;
+
+          } while (child != pnode && (child == current->right.get() || !current->right));
+
+          if (child == pnode)
+              return height;
+
+          current = current->right.get();
+          ++depth;
+      }
    }
 }
  
-template<class Key, class Value> bool bstree<Key, Value>::isBalanced(const Node* pnode) const noexcept
+template<class Key, class Value, class Compare, class Balance, class Allocator> bool bstree<Key, Value, Compare, Balance, Allocator>::isBalanced(const Node* pnode) const noexcept
 {
    if (pnode == nullptr || findNode(pnode->key(), pnode)) return false; 
        
@@ -1156,7 +4203,7 @@ template<class Key, class Value> bool bstree<Key, Value>::isBalanced(const Node*
 
 
 // Visits each Node, testing whether it is balanced. Returns false if any node is not balanced.
-template<class Key, class Value> bool bstree<Key, Value>::isBalanced() const noexcept
+template<class Key, class Value, class Compare, class Balance, class Allocator> bool bstree<Key, Value, Compare, Balance, Allocator>::isBalanced() const noexcept
 {
    std::stack<Node> nodes;
 
@@ -1179,7 +4226,7 @@ template<class Key, class Value> bool bstree<Key, Value>::isBalanced() const noe
 }
 
 // Breadth-first traversal. Useful for display the tree (with a functor that knows how to pad with spaces based on level).
-template<class Key, class Value> template<typename Functor> void bstree<Key, Value>::levelOrderTraverse(Functor f) const noexcept
+template<class Key, class Value, class Compare, class Balance, class Allocator> template<typename Functor> void bstree<Key, Value, Compare, Balance, Allocator>::levelOrderTraverse(Functor f) const noexcept
 {
    std::queue< std::pair<const Node*, int> > queue; 
 
@@ -0,0 +1,756 @@
+#ifndef compact_bst_h_7461029385
+#define compact_bst_h_7461029385
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+ * A search tree for memory-bound workloads with many small entries. A bstree node links to its children with two std::unique_ptrs,
+ * which carry their allocator pointers, and to its parent with a raw pointer, and also keeps its subtree size and color: for
+ * bstree<int, int> that is 56 bytes of bookkeeping around 8 bytes of payload. Here the nodes live in one std::vector and link to
+ * each other by 32-bit index, the color is the top bit of the left link, and the parent link is optional, so a
+ * compact_bstree<int, int> node takes 16 bytes (20 with ParentLinks). Index 0 means no node, so the tree holds up to 2^31 - 1
+ * entries. Removed nodes' slots are chained through their right links and reused by later inserts.
+ *
+ * The tree is a left-leaning red-black tree (Sedgewick and Wayne, Algorithms, 4th Edition, section 3.3; RedBlackBST.java is the
+ * balanced sibling of java-bst.java). Its insert and remove are recursive and restore the balance on the way back up, so they need
+ * no parent links, and the recursion is at most 2 log2(n + 1) deep. With ParentLinks the tree also has bidirectional iterators,
+ * which climb through the parents; without them it offers inOrderTraverse(), which keeps its own stack.
+ *
+ * Indices stay valid while the tree is not modified; pointers returned by lookup() stay valid until the next insert (which may
+ * grow the vector) or remove. There is no order statistics support (bstree keeps subtree sizes for that). Like bstree, a
+ * compact_bstree is not thread safe.
+ */
+template<class Key, class Value, class Compare = std::less<Key>, bool ParentLinks = false> class compact_bstree {
+
+     static constexpr bool has_transparent_compare = requires { typename Compare::is_transparent; };
+
+     using index_type = std::uint32_t;
+
+     static constexpr index_type nil = 0;
+     static constexpr index_type red_bit = index_type(1) << 31;
+     static constexpr index_type max_nodes = red_bit - 1;
+
+     struct no_parent {};
+
+     struct Node {
+
+         Key   key;
+         Value value;
+
+         index_type left;  // The top bit is set if the node is red.
+         index_type right; // Also the next free slot, for a removed node.
+
+         [[no_unique_address]] std::conditional_t<ParentLinks, index_type, no_parent> parent;
+
+         template<class K, class V> Node(K&& key_in, V&& value_in) : key(std::forward<K>(key_in)), value(std::forward<V>(value_in)),
+             left{red_bit}, right{nil}, parent{}
+         {
+         }
+     };
+
+     std::vector<Node> nodes;  // Node i is nodes[i - 1].
+
+     index_type root = nil;
+     index_type free_list = nil;
+
+     std::size_t count = 0;
+
+     [[no_unique_address]] Compare comp;
+
+     Node& node(index_type i) noexcept { return nodes[i - 1]; }
+     const Node& node(index_type i) const noexcept { return nodes[i - 1]; }
+
+     index_type left(index_type i) const noexcept { return node(i).left & ~red_bit; }
+     index_type right(index_type i) const noexcept { return node(i).right; }
+
+     bool is_red(index_type i) const noexcept
+     {
+        return i != nil && (node(i).left & red_bit);
+     }
+
+     void set_red(index_type i, bool red) noexcept
+     {
+        node(i).left = (node(i).left & ~red_bit) | (red ? red_bit : 0);
+     }
+
+     void set_parent(index_type child, index_type parent) noexcept
+     {
+        if constexpr (ParentLinks)
+            if (child != nil)
+                node(child).parent = parent;
+     }
+
+     void set_left(index_type i, index_type child) noexcept
+     {
+        node(i).left = (node(i).left & red_bit) | child;
+        set_parent(child, i);
+     }
+
+     void set_right(index_type i, index_type child) noexcept
+     {
+        node(i).right = child;
+        set_parent(child, i);
+     }
+
+     template<class K1, class K2> bool equivalent(const K1& a, const K2& b) const noexcept
+     {
+        return !comp(a, b) && !comp(b, a);
+     }
+
+     template<class K, class V> index_type new_node(K&& key, V&& value);
+
+     void free_node(index_type i) noexcept;
+
+     // The rotations and color flip of a left-leaning red-black tree. A rotation returns the subtree's new root, whose parent link
+     // the caller sets by storing it.
+     index_type rotate_left(index_type h) noexcept;
+     index_type rotate_right(index_type h) noexcept;
+     void flip_colors(index_type h) noexcept;
+
+     index_type balance(index_type h) noexcept;
+     index_type move_red_left(index_type h) noexcept;
+     index_type move_red_right(index_type h) noexcept;
+
+     template<class K, class M> index_type insert_or_assign(index_type h, K&& key, M&& obj, bool& inserted);
+
+     template<class K> index_type remove(index_type h, const K& key) noexcept;
+
+     index_type remove_min(index_type h) noexcept;
+
+     void set_root(index_type h) noexcept
+     {
+        root = h;
+
+        if (root != nil) {
+
+            set_red(root, false);
+            set_parent(root, nil);
+        }
+     }
+
+     template<class K> index_type find_index(const K& key) const noexcept
+     {
+        index_type current = root;
+
+        while (current != nil && !equivalent(node(current).key, key))
+            current = comp(key, node(current).key) ? left(current) : right(current);
+
+        return current;
+     }
+
+     // The node with the greatest key not greater than key (floor) or the least key not less than key (ceiling), or nil.
+     template<class K> index_type bound_index(const K& key, bool floor) const noexcept
+     {
+        index_type current = root;
+        index_type bound = nil;
+
+        while (current != nil) {
+
+            if (equivalent(node(current).key, key))
+                return current;
+
+            bool go_left = comp(key, node(current).key);
+
+            if (go_left != floor)
+                bound = current;
+
+            current = go_left ? left(current) : right(current);
+        }
+
+        return bound;
+     }
+
+     template<class K> Key floor_key(const K& key) const
+     {
+        if (isEmpty())
+            throw std::logic_error("floor() called with empty tree");
+
+        index_type i = bound_index(key, true);
+
+        if (i == nil)
+            throw std::logic_error("argument to floor() is too small");
+
+        return node(i).key;
+     }
+
+     template<class K> Key ceiling_key(const K& key) const
+     {
+        if (isEmpty())
+            throw std::logic_error("ceiling() called with empty tree");
+
+        index_type i = bound_index(key, false);
+
+        if (i == nil)
+            throw std::logic_error("argument to ceiling() is too large");
+
+        return node(i).key;
+     }
+
+     template<class K> bool remove_key(const K& key) noexcept
+     {
+        if (find_index(key) == nil)
+            return false;
+
+        // The recursion expects a red root or a red child of it to push down; making the root red supplies one when needed.
+        if (!is_red(left(root)) && !is_red(right(root)))
+            set_red(root, true);
+
+        set_root(remove(root, key));
+
+        --count;
+
+        return true;
+     }
+
+  public:
+
+     using key_type    = Key;
+     using mapped_type = Value;
+     using key_compare = Compare;
+
+     explicit compact_bstree(const Compare& comp_in = Compare()) : comp{comp_in}
+     {
+     }
+
+     std::size_t size() const noexcept
+     {
+        return count;
+     }
+
+     bool isEmpty() const noexcept
+     {
+        return root == nil;
+     }
+
+     int height() const noexcept; // edges on the longest path, as in bstree: -1 if empty
+
+     // Bytes held by the node vector, counting free slots and spare capacity: the tree's whole footprint apart from the object.
+     std::size_t memory_bytes() const noexcept
+     {
+        return nodes.capacity() * sizeof(Node);
+     }
+
+     // Makes room for n entries, so that inserting them allocates once and leaves no spare capacity.
+     void reserve(std::size_t n)
+     {
+        nodes.reserve(std::min<std::size_t>(n, max_nodes));
+     }
+
+     /*
+      * Moves the nodes to the slots 1 to size() in key order and frees the rest of the vector. This drops the free slots that
+      * removals leave and the spare capacity that growth leaves, and an in-order walk then reads the vector front to back. O(n).
+      * The nodes are moved into a second vector of size() nodes, next to a temporary of 4 bytes per slot, so the peak footprint is
+      * about twice that of the tree.
+      */
+     void shrink_to_fit();
+
+     // Returns true if key was inserted, false if its value was assigned.
+     template<class K, class M> bool insert_or_assign(K&& key, M&& obj)
+     {
+        bool inserted = false;
+
+        set_root(insert_or_assign(root, std::forward<K>(key), std::forward<M>(obj), inserted));
+
+        count += inserted;
+
+        return inserted;
+     }
+
+     bool insert(const Key& key, const Value& value)
+     {
+        return insert_or_assign(key, value);
+     }
+
+     bool remove(const Key& key) noexcept
+     {
+        return remove_key(key);
+     }
+
+     template<class K> requires has_transparent_compare bool remove(const K& key) noexcept
+     {
+        return remove_key(key);
+     }
+
+     bool find(const Key& key) const noexcept
+     {
+        return find_index(key) != nil;
+     }
+
+     template<class K> requires has_transparent_compare bool find(const K& key) const noexcept
+     {
+        return find_index(key) != nil;
+     }
+
+     // Returns a pointer to key's value, or nullptr.
+     const Value *lookup(const Key& key) const noexcept
+     {
+        index_type i = find_index(key);
+
+        return i != nil ? &node(i).value : nullptr;
+     }
+
+     template<class K> requires has_transparent_compare const Value *lookup(const K& key) const noexcept
+     {
+        index_type i = find_index(key);
+
+        return i != nil ? &node(i).value : nullptr;
+     }
+
+     Key floor(const Key& key) const
+     {
+        return floor_key(key);
+     }
+
+     template<class K> requires has_transparent_compare Key floor(const K& key) const
+     {
+        return floor_key(key);
+     }
+
+     Key ceiling(const Key& key) const
+     {
+        return ceiling_key(key);
+     }
+
+     template<class K> requires has_transparent_compare Key ceiling(const K& key) const
+     {
+        return ceiling_key(key);
+     }
+
+     // Calls f(key, value) for each key in ascending order.
+     template<class Functor> void inOrderTraverse(Functor f) const
+     {
+        std::vector<index_type> stack;
+
+        for (index_type current = root; current != nil || !stack.empty(); ) {
+
+            for (; current != nil; current = left(current))
+                stack.push_back(current);
+
+            current = stack.back();
+            stack.pop_back();
+
+            f(node(current).key, node(current).value);
+
+            current = right(current);
+        }
+     }
+
+     /*
+      * With ParentLinks, a bidirectional iterator over (key, value) pairs of references in ascending key order. The successor is
+      * found as in bstree, through the parent links, so an iterator is just a tree pointer and an index.
+      */
+     class const_iterator {
+
+         const compact_bstree *tree;
+         index_type current;
+
+         friend class compact_bstree;
+
+         const_iterator(const compact_bstree *tree_in, index_type current_in) noexcept : tree{tree_in}, current{current_in} {}
+
+       public:
+
+         using iterator_category = std::bidirectional_iterator_tag;
+         using value_type        = std::pair<const Key&, const Value&>;
+         using difference_type   = std::ptrdiff_t;
+         using reference         = value_type;
+
+         // operator-> returns this, which holds the pair it points to.
+         struct pointer {
+
+             value_type entry;
+
+             const value_type *operator->() const noexcept
+             {
+                 return &entry;
+             }
+         };
+
+         const_iterator() noexcept : tree{nullptr}, current{nil} {}
+
+         reference operator*() const noexcept
+         {
+             return {tree->node(current).key, tree->node(current).value};
+         }
+
+         pointer operator->() const noexcept
+         {
+             return {**this};
+         }
+
+         const_iterator& operator++() noexcept
+         {
+             if (tree->right(current) != nil) {
+
+                 current = tree->right(current);
+
+                 while (tree->left(current) != nil)
+                     current = tree->left(current);
+
+             } else {
+
+                 index_type child = current;
+
+                 for (current = tree->node(current).parent; current != nil && tree->right(current) == child; current = tree->node(current).parent)
+                     child = current;
+             }
+
+             return *this;
+         }
+
+         const_iterator& operator--() noexcept
+         {
+             if (current == nil) {
+
+                 current = tree->root;
+
+                 while (current != nil && tree->right(current) != nil)
+                     current = tree->right(current);
+
+             } else if (tree->left(current) != nil) {
+
+                 current = tree->left(current);
+
+                 while (tree->right(current) != nil)
+                     current = tree->right(current);
+
+             } else {
+
+                 index_type child = current;
+
+                 for (current = tree->node(current).parent; current != nil && tree->left(current) == child; current = tree->node(current).parent)
+                     child = current;
+             }
+
+             return *this;
+         }
+
+         const_iterator operator++(int) noexcept
+         {
+             const_iterator tmp{*this};
+             ++*this;
+             return tmp;
+         }
+
+         const_iterator operator--(int) noexcept
+         {
+             const_iterator tmp{*this};
+             --*this;
+             return tmp;
+         }
+
+         friend bool operator==(const const_iterator& lhs, const const_iterator& rhs) noexcept
+         {
+             return lhs.current == rhs.current;
+         }
+     };
+
+     const_iterator begin() const noexcept requires ParentLinks
+     {
+        index_type current = root;
+
+        while (current != nil && left(current) != nil)
+            current = left(current);
+
+        return {this, current};
+     }
+
+     const_iterator end() const noexcept requires ParentLinks
+     {
+        return {this, nil};
+     }
+};
+
+template<class Key, class Value, class Compare, bool ParentLinks> template<class K, class V>
+typename compact_bstree<Key, Value, Compare, ParentLinks>::index_type compact_bstree<Key, Value, Compare, ParentLinks>::new_node(K&& key, V&& value)
+{
+  if (free_list != nil) {
+
+      index_type i = free_list;
+
+      free_list = right(i);
+
+      node(i) = Node(std::forward<K>(key), std::forward<V>(value));
+
+      return i;
+  }
+
+  if (nodes.size() == max_nodes)
+      throw std::length_error("compact_bstree: too many entries for 31-bit indices");
+
+  nodes.emplace_back(std::forward<K>(key), std::forward<V>(value));
+
+  return static_cast<index_type>(nodes.size());
+}
+
+// The slot keeps its key and value until it is reused; only the links change.
+template<class Key, class Value, class Compare, bool ParentLinks> void compact_bstree<Key, Value, Compare, ParentLinks>::free_node(index_type i) noexcept
+{
+  node(i).left = nil;
+  node(i).right = free_list;
+
+  free_list = i;
+}
+
+/*
+ * h's right child x takes h's place, with h's color, and h becomes x's red left child.
+ */
+template<class Key, class Value, class Compare, bool ParentLinks>
+typename compact_bstree<Key, Value, Compare, ParentLinks>::index_type compact_bstree<Key, Value, Compare, ParentLinks>::rotate_left(index_type h) noexcept
+{
+  index_type x = right(h);
+
+  set_right(h, left(x));
+  set_left(x, h);
+
+  set_red(x, is_red(h));
+  set_red(h, true);
+
+  return x;
+}
+
+template<class Key, class Value, class Compare, bool ParentLinks>
+typename compact_bstree<Key, Value, Compare, ParentLinks>::index_type compact_bstree<Key, Value, Compare, ParentLinks>::rotate_right(index_type h) noexcept
+{
+  index_type x = left(h);
+
+  set_left(h, right(x));
+  set_right(x, h);
+
+  set_red(x, is_red(h));
+  set_red(h, true);
+
+  return x;
+}
+
+template<class Key, class Value, class Compare, bool ParentLinks> void compact_bstree<Key, Value, Compare, ParentLinks>::flip_colors(index_type h) noexcept
+{
+  set_red(h, !is_red(h));
+  set_red(left(h), !is_red(left(h)));
+  set_red(right(h), !is_red(right(h)));
+}
+
+// Restores the left-leaning invariant at h on the way up: no right-leaning red link and no two red links in a row.
+template<class Key, class Value, class Compare, bool ParentLinks>
+typename compact_bstree<Key, Value, Compare, ParentLinks>::index_type compact_bstree<Key, Value, Compare, ParentLinks>::balance(index_type h) noexcept
+{
+  if (is_red(right(h)) && !is_red(left(h)))
+      h = rotate_left(h);
+
+  if (is_red(left(h)) && is_red(left(left(h))))
+      h = rotate_right(h);
+
+  if (is_red(left(h)) && is_red(right(h)))
+      flip_colors(h);
+
+  return h;
+}
+
+// h is red and its left child and that child's left child are black: makes the left child or one of its children red.
+template<class Key, class Value, class Compare, bool ParentLinks>
+typename compact_bstree<Key, Value, Compare, ParentLinks>::index_type compact_bstree<Key, Value, Compare, ParentLinks>::move_red_left(index_type h) noexcept
+{
+  flip_colors(h);
+
+  if (is_red(left(right(h)))) {
+
+      set_right(h, rotate_right(right(h)));
+      h = rotate_left(h);
+      flip_colors(h);
+  }
+
+  return h;
+}
+
+// h is red and its right child and that child's left child are black: makes the right child or one of its children red.
+template<class Key, class Value, class Compare, bool ParentLinks>
+typename compact_bstree<Key, Value, Compare, ParentLinks>::index_type compact_bstree<Key, Value, Compare, ParentLinks>::move_red_right(index_type h) noexcept
+{
+  flip_colors(h);
+
+  if (is_red(left(left(h)))) {
+
+      h = rotate_right(h);
+      flip_colors(h);
+  }
+
+  return h;
+}
+
+/*
+ * new_node() may grow the vector, so no reference to a node is held across the recursive calls: nodes are named by index only.
+ */
+template<class Key, class Value, class Compare, bool ParentLinks> template<class K, class M>
+typename compact_bstree<Key, Value, Compare, ParentLinks>::index_type compact_bstree<Key, Value, Compare, ParentLinks>::insert_or_assign(index_type h, K&& key, M&& obj, bool& inserted)
+{
+  if (h == nil) {
+
+      inserted = true;
+
+      return new_node(std::forward<K>(key), std::forward<M>(obj)); // red
+  }
+
+  if (comp(key, node(h).key))
+      set_left(h, insert_or_assign(left(h), std::forward<K>(key), std::forward<M>(obj), inserted));
+  else if (comp(node(h).key, key))
+      set_right(h, insert_or_assign(right(h), std::forward<K>(key), std::forward<M>(obj), inserted));
+  else
+      node(h).value = std::forward<M>(obj);
+
+  return balance(h);
+}
+
+// Removes the least node of the subtree h, in which h or its left child is red.
+template<class Key, class Value, class Compare, bool ParentLinks>
+typename compact_bstree<Key, Value, Compare, ParentLinks>::index_type compact_bstree<Key, Value, Compare, ParentLinks>::remove_min(index_type h) noexcept
+{
+  if (left(h) == nil) {
+
+      free_node(h);
+
+      return nil;
+  }
+
+  if (!is_red(left(h)) && !is_red(left(left(h))))
+      h = move_red_left(h);
+
+  set_left(h, remove_min(left(h)));
+
+  return balance(h);
+}
+
+/*
+ * Removes key, which is in the subtree h, keeping a red link on the search path so that the node finally removed is red (or has a
+ * red child) and its removal leaves the black heights unchanged. A node with two children takes over its successor's key and value,
+ * and the successor is removed from the right subtree instead.
+ */
+template<class Key, class Value, class Compare, bool ParentLinks> template<class K>
+typename compact_bstree<Key, Value, Compare, ParentLinks>::index_type compact_bstree<Key, Value, Compare, ParentLinks>::remove(index_type h, const K& key) noexcept
+{
+  if (comp(key, node(h).key)) {
+
+      if (!is_red(left(h)) && !is_red(left(left(h))))
+          h = move_red_left(h);
+
+      set_left(h, remove(left(h), key));
+
+  } else {
+
+      if (is_red(left(h)))
+          h = rotate_right(h);
+
+      if (!comp(node(h).key, key) && right(h) == nil) {
+
+          free_node(h);
+
+          return nil;
+      }
+
+      if (!is_red(right(h)) && !is_red(left(right(h))))
+          h = move_red_right(h);
+
+      if (!comp(node(h).key, key)) {
+
+          index_type successor = right(h);
+
+          while (left(successor) != nil)
+              successor = left(successor);
+
+          node(h).key = std::move(node(successor).key);
+          node(h).value = std::move(node(successor).value);
+
+          set_right(h, remove_min(right(h)));
+
+      } else {
+
+          set_right(h, remove(right(h), key));
+      }
+  }
+
+  return balance(h);
+}
+
+template<class Key, class Value, class Compare, bool ParentLinks> int compact_bstree<Key, Value, Compare, ParentLinks>::height() const noexcept
+{
+  int height = -1;
+
+  std::vector<std::pair<index_type, int>> stack;
+
+  if (root != nil)
+      stack.push_back({root, 0});
+
+  while (!stack.empty()) {
+
+      auto [current, depth] = stack.back();
+      stack.pop_back();
+
+      height = std::max(height, depth);
+
+      if (left(current) != nil)
+          stack.push_back({left(current), depth + 1});
+
+      if (right(current) != nil)
+          stack.push_back({right(current), depth + 1});
+  }
+
+  return height;
+}
+
+/*
+ * Two in-order walks: the first numbers the live nodes 1 to size(), and the second moves each node, in that order, to the end of the
+ * new vector, translating its links.
+ */
+template<class Key, class Value, class Compare, bool ParentLinks> void compact_bstree<Key, Value, Compare, ParentLinks>::shrink_to_fit()
+{
+  std::vector<index_type> renumbered(nodes.size() + 1, nil);
+
+  index_type next = 0;
+
+  std::vector<Node> moved;
+
+  moved.reserve(count);
+
+  auto in_order = [this](auto visit) {
+
+     std::vector<index_type> stack;
+
+     for (index_type current = root; current != nil || !stack.empty(); ) {
+
+         for (; current != nil; current = left(current))
+             stack.push_back(current);
+
+         current = stack.back();
+         stack.pop_back();
+
+         visit(current);
+
+         current = right(current);
+     }
+  };
+
+  in_order([&](index_type i) { renumbered[i] = ++next; });
+
+  in_order([&](index_type i) {
+
+     Node& target = moved.emplace_back(std::move(node(i).key), std::move(node(i).value));
+
+     target.left = (node(i).left & red_bit) | renumbered[left(i)];
+     target.right = renumbered[right(i)];
+
+     if constexpr (ParentLinks)
+         target.parent = renumbered[node(i).parent];
+  });
+
+  nodes = std::move(moved);
+  root = renumbered[root];
+  free_list = nil;
+}
+#endif
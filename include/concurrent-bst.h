@@ -0,0 +1,589 @@
+#ifndef concurrent_bst_h_5520194837
+#define concurrent_bst_h_5520194837
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "epoch-reclaimer.h"
+
+/*
+ * A binary search tree that many threads may read and write at once. Unlike bstree, it is a leaf-oriented (external) tree: the
+ * key/value pairs live in the leaves, and each internal node holds a routing key: the keys less than it are in its left subtree, the
+ * others in its right subtree. A search for key goes left at an internal node if key < routing key and right otherwise, and always ends at a leaf. Inserting a new key replaces
+ * a leaf by an internal node with two leaves; removing a key replaces the leaf's parent by the leaf's sibling. Both change a single
+ * child pointer, which is what lets readers run without locks.
+ *
+ * Leaves are immutable. insert_or_assign() on a present key publishes a new leaf in place of the old one, so a reader never sees a
+ * value that is being assigned.
+ *
+ * Every internal node has a version, a sequence lock: it is odd while a writer holds the node and is bumped by each change.
+ *
+ *  Readers (find, lookup, floor, ceiling) take no locks. They descend from the root recording each internal node with the version it
+ *  had, then re-read the versions. If none changed, all the child pointers they followed were in place at one instant, and the
+ *  result is that of a search at that instant; otherwise they retry.
+ *
+ *  Writers (insert_or_assign, remove) descend the same way and then lock just the nodes whose child pointer they change, the parent
+ *  for an insert and the grandparent and parent for a remove, by compare-and-swapping each recorded version to version + 1. If a node
+ *  changed since it was read, the writer unlocks what it holds and retries. Writers never wait while holding a lock, so they cannot
+ *  deadlock, and writers in different subtrees do not contend.
+ *
+ * Unlinked nodes are freed by the process-wide epoch_reclaimer once no reader can still hold them.
+ *
+ * The tree is not balanced, so like bstree<..., unbalanced> it degenerates when keys arrive in sorted order. Nodes come from new
+ * and delete, since pool_allocator is not thread safe. The destructor must not run concurrently with any other method.
+ */
+template<class Key, class Value, class Compare = std::less<Key>> class concurrent_bstree {
+
+     static constexpr bool has_transparent_compare = requires { typename Compare::is_transparent; };
+
+     struct node {
+
+         const bool is_leaf;
+     };
+
+     struct leaf : node {
+
+         const Key key;
+         const Value value;
+
+         template<class K, class V> leaf(K&& key_in, V&& value_in) : node{true}, key(std::forward<K>(key_in)),
+             value(std::forward<V>(value_in))
+         {
+         }
+     };
+
+     // The root is a keyless internal_node whose left child is the tree (nullptr if empty). Searches always go left at the root.
+     struct internal_node : node {
+
+         std::atomic<std::uint64_t> version{0};
+
+         std::atomic<node *> left;
+         std::atomic<node *> right;
+
+         internal_node(node *left_in, node *right_in) noexcept : node{false}, left{left_in}, right{right_in}
+         {
+         }
+
+         std::atomic<node *>& child(bool go_left) noexcept
+         {
+            return go_left ? left : right;
+         }
+     };
+
+     struct routing_node : internal_node {
+
+         const Key key;
+
+         routing_node(const Key& key_in, node *left_in, node *right_in) : internal_node(left_in, right_in), key(key_in)
+         {
+         }
+     };
+
+     // An internal node on a search path, the version it had when it was read, and the direction the search took from it.
+     struct path_entry {
+
+         internal_node *pnode;
+         std::uint64_t version;
+         bool went_left;
+     };
+
+     using path_type = std::vector<path_entry>;
+
+     internal_node root;
+
+     [[no_unique_address]] Compare comp;
+
+     std::atomic<std::size_t> count;
+
+     template<class K1, class K2> bool equivalent(const K1& a, const K2& b) const noexcept
+     {
+        return !comp(a, b) && !comp(b, a);
+     }
+
+     static void pause() noexcept
+     {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#else
+        std::this_thread::yield();
+#endif
+     }
+
+     // Returns pnode's version once no writer holds it.
+     static std::uint64_t stable_version(const internal_node *pnode) noexcept
+     {
+        std::uint64_t version;
+
+        while ((version = pnode->version.load(std::memory_order_acquire)) & 1)
+            pause();
+
+        return version;
+     }
+
+     // True if no node on the path has changed since it was read.
+     static bool validate(const path_type& path) noexcept
+     {
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        for (const auto& entry : path)
+            if (entry.pnode->version.load(std::memory_order_relaxed) != entry.version)
+                return false;
+
+        return true;
+     }
+
+     // Locks pnode if its version is still version.
+     static bool try_lock(internal_node *pnode, std::uint64_t version) noexcept
+     {
+        return pnode->version.compare_exchange_strong(version, version + 1, std::memory_order_acquire);
+     }
+
+     // Unlocks pnode after changing it; readers holding the old version will retry.
+     static void unlock(internal_node *pnode) noexcept
+     {
+        pnode->version.fetch_add(1, std::memory_order_release);
+     }
+
+     // Unlocks pnode without having changed it, restoring the version it was locked at.
+     static void unlock_unchanged(internal_node *pnode, std::uint64_t version) noexcept
+     {
+        pnode->version.store(version, std::memory_order_release);
+     }
+
+     // One search path per thread, reused to avoid an allocation per operation.
+     static path_type& local_path()
+     {
+        thread_local path_type path;
+
+        path.clear();
+        return path;
+     }
+
+     // Follows child from pnode, recording pnode. stable_version() is read before the child pointer.
+     static node *step(path_type& path, const internal_node *pnode, bool go_left)
+     {
+        std::uint64_t version = stable_version(pnode);
+
+        node *child = (go_left ? pnode->left : pnode->right).load(std::memory_order_acquire);
+
+        path.push_back({const_cast<internal_node *>(pnode), version, go_left}); // Only writers modify the nodes on a path.
+
+        return child;
+     }
+
+     /*
+      * Descends from the root towards key, recording the internal nodes passed, and returns the leaf reached, or nullptr if the tree
+      * is empty. The caller validates the path.
+      */
+     template<class K> leaf *descend(const K& key, path_type& path) const
+     {
+        node *current = step(path, &root, true);
+
+        while (current && !current->is_leaf) {
+
+            routing_node *pnode = static_cast<routing_node *>(current);
+
+            current = step(path, pnode, comp(key, pnode->key));
+        }
+
+        return static_cast<leaf *>(current);
+     }
+
+     // Descends from pnode's go_left child, always turning the other way, i.e. to the greatest leaf of pnode's left subtree or the
+     // least leaf of its right subtree.
+     static leaf *descend_extreme(internal_node *pnode, bool go_left, path_type& path)
+     {
+        node *current = step(path, pnode, go_left);
+
+        while (!current->is_leaf)
+            current = step(path, static_cast<internal_node *>(current), !go_left);
+
+        return static_cast<leaf *>(current);
+     }
+
+     /*
+      * Returns the leaf holding key, or nullptr. The result is valid while the caller's guard is alive.
+      */
+     template<class K> const leaf *find_leaf(const K& key) const
+     {
+        for (;;) {
+
+            path_type& path = local_path();
+
+            leaf *pleaf = descend(key, path);
+
+            if (validate(path))
+                return (pleaf && equivalent(pleaf->key, key)) ? pleaf : nullptr;
+        }
+     }
+
+     /*
+      * Returns the leaf with the greatest key not greater than key (floor) or the least key not less than key (ceiling), or nullptr.
+      * If the search leaf does not qualify, the answer is the greatest leaf left of the search path (for floor): the last leaf of the
+      * left subtree of the deepest node where the search went right. The nodes on the way down to it join the validated path.
+      */
+     template<class K> const leaf *bound_leaf(const K& key, bool floor) const
+     {
+        for (;;) {
+
+            path_type& path = local_path();
+
+            leaf *pleaf = descend(key, path);
+
+            if (pleaf && (floor ? !comp(key, pleaf->key) : !comp(pleaf->key, key))) {
+
+                if (validate(path))
+                    return pleaf;
+
+                continue;
+            }
+
+            pleaf = nullptr;
+
+            for (std::size_t i = path.size(); i-- > 1; ) { // path[0] is the root, where every search goes left.
+
+                if (path[i].went_left != floor) {
+
+                    pleaf = descend_extreme(path[i].pnode, floor, path);
+                    break;
+                }
+            }
+
+            if (validate(path))
+                return pleaf;
+        }
+     }
+
+     template<class K> std::optional<Value> lookup_key(const K& key) const
+     {
+        epoch_reclaimer::guard guard;
+
+        const leaf *pleaf = find_leaf(key);
+
+        return pleaf ? std::optional<Value>{pleaf->value} : std::nullopt;
+     }
+
+     template<class K> Key floor_key(const K& key) const
+     {
+        epoch_reclaimer::guard guard;
+
+        const leaf *pleaf = bound_leaf(key, true);
+
+        if (!pleaf)
+            throw std::logic_error("argument to floor() is too small or the tree is empty");
+
+        return pleaf->key;
+     }
+
+     template<class K> Key ceiling_key(const K& key) const
+     {
+        epoch_reclaimer::guard guard;
+
+        const leaf *pleaf = bound_leaf(key, false);
+
+        if (!pleaf)
+            throw std::logic_error("argument to ceiling() is too large or the tree is empty");
+
+        return pleaf->key;
+     }
+
+     template<class K> bool remove_key(const K& key);
+
+     static void retire(node *pnode)
+     {
+        if (pnode->is_leaf)
+            epoch_reclaimer::instance().retire(static_cast<leaf *>(pnode));
+        else
+            epoch_reclaimer::instance().retire(static_cast<routing_node *>(pnode));
+     }
+
+  public:
+
+     using key_type    = Key;
+     using mapped_type = Value;
+     using key_compare = Compare;
+
+     explicit concurrent_bstree(const Compare& comp_in = Compare()) : root{nullptr, nullptr}, comp{comp_in}, count{0}
+     {
+     }
+
+     concurrent_bstree(const concurrent_bstree&) = delete;
+     concurrent_bstree& operator=(const concurrent_bstree&) = delete;
+
+    ~concurrent_bstree();
+
+     // The number of keys. While writers are active it may be momentarily off by the number of operations in flight.
+     std::size_t size() const noexcept
+     {
+        return count.load(std::memory_order_relaxed);
+     }
+
+     bool isEmpty() const noexcept
+     {
+        return size() == 0;
+     }
+
+     // Inserts key with value obj, or publishes a new leaf holding obj if key is present. Returns true if key was inserted.
+     template<class K, class M> bool insert_or_assign(K&& key, M&& obj);
+
+     bool insert(const Key& key, const Value& value)
+     {
+        return insert_or_assign(key, value);
+     }
+
+     bool remove(const Key& key)
+     {
+        return remove_key(key);
+     }
+
+     template<class K> requires has_transparent_compare bool remove(const K& key)
+     {
+        return remove_key(key);
+     }
+
+     bool find(const Key& key) const
+     {
+        epoch_reclaimer::guard guard;
+
+        return find_leaf(key) != nullptr;
+     }
+
+     template<class K> requires has_transparent_compare bool find(const K& key) const
+     {
+        epoch_reclaimer::guard guard;
+
+        return find_leaf(key) != nullptr;
+     }
+
+     // Returns a copy of key's value, if key is present.
+     std::optional<Value> lookup(const Key& key) const
+     {
+        return lookup_key(key);
+     }
+
+     template<class K> requires has_transparent_compare std::optional<Value> lookup(const K& key) const
+     {
+        return lookup_key(key);
+     }
+
+     Key floor(const Key& key) const
+     {
+        return floor_key(key);
+     }
+
+     template<class K> requires has_transparent_compare Key floor(const K& key) const
+     {
+        return floor_key(key);
+     }
+
+     Key ceiling(const Key& key) const
+     {
+        return ceiling_key(key);
+     }
+
+     template<class K> requires has_transparent_compare Key ceiling(const K& key) const
+     {
+        return ceiling_key(key);
+     }
+
+     /*
+      * Calls f(key, value) for every key in ascending order. The traversal takes no locks and is not a snapshot: a key inserted or
+      * removed while it runs may or may not be visited, but every key present throughout is visited exactly once.
+      */
+     template<class Functor> void inOrderTraverse(Functor f) const;
+};
+
+template<class Key, class Value, class Compare> concurrent_bstree<Key, Value, Compare>::~concurrent_bstree()
+{
+  std::vector<node *> stack;
+
+  if (node *pnode = root.left.load(std::memory_order_relaxed))
+      stack.push_back(pnode);
+
+  while (!stack.empty()) {
+
+      node *pnode = stack.back();
+      stack.pop_back();
+
+      if (pnode->is_leaf) {
+
+          delete static_cast<leaf *>(pnode);
+
+      } else {
+
+          routing_node *prouting = static_cast<routing_node *>(pnode);
+
+          stack.push_back(prouting->left.load(std::memory_order_relaxed));
+          stack.push_back(prouting->right.load(std::memory_order_relaxed));
+
+          delete prouting;
+      }
+  }
+}
+
+/*
+ * The new leaf is built before the search, so a retry never needs key or obj again. The search ends at the leaf where key belongs
+ * (or at the empty root), and only its parent is locked:
+ *
+ *  1. empty tree:        the root's left child becomes the new leaf.
+ *  2. key is present:    the new leaf replaces the old one, which is retired.
+ *  3. otherwise:         a routing node with the old and the new leaf as children replaces the old leaf. Its routing key is the
+ *                        greater of the two keys, which goes right.
+ */
+template<class Key, class Value, class Compare> template<class K, class M> bool concurrent_bstree<Key, Value, Compare>::insert_or_assign(K&& key, M&& obj)
+{
+  leaf *pnew = new leaf(std::forward<K>(key), std::forward<M>(obj));
+
+  epoch_reclaimer::guard guard;
+
+  for (;;) {
+
+      path_type& path = local_path();
+
+      leaf *pleaf = descend(pnew->key, path);
+
+      path_entry parent = path.back();
+
+      if (!validate(path) || !try_lock(parent.pnode, parent.version))
+          continue;
+
+      std::atomic<node *>& link = parent.pnode->child(parent.went_left);
+
+      if (!pleaf) {                                          // case 1
+
+          link.store(pnew, std::memory_order_release);
+          unlock(parent.pnode);
+
+          count.fetch_add(1, std::memory_order_relaxed);
+          return true;
+      }
+
+      if (equivalent(pleaf->key, pnew->key)) {               // case 2
+
+          link.store(pnew, std::memory_order_release);
+          unlock(parent.pnode);
+
+          retire(pleaf);
+          return false;
+      }
+
+      routing_node *prouting;                                // case 3
+
+      try {
+
+          prouting = comp(pnew->key, pleaf->key) ? new routing_node(pleaf->key, pnew, pleaf) : new routing_node(pnew->key, pleaf, pnew);
+
+      } catch (...) {
+
+          unlock_unchanged(parent.pnode, parent.version);
+          delete pnew;
+          throw;
+      }
+
+      link.store(prouting, std::memory_order_release);
+      unlock(parent.pnode);
+
+      count.fetch_add(1, std::memory_order_relaxed);
+      return true;
+  }
+}
+
+/*
+ * The search ends at key's leaf. If its parent is the root, the tree becomes empty. Otherwise the grandparent and then the parent are
+ * locked, and the leaf's sibling takes the parent's place under the grandparent; the parent and the leaf are retired. The parent's
+ * version is bumped too, so a concurrent insert below it, which holds the parent's old version, fails to lock it and retries.
+ */
+template<class Key, class Value, class Compare> template<class K> bool concurrent_bstree<Key, Value, Compare>::remove_key(const K& key)
+{
+  epoch_reclaimer::guard guard;
+
+  for (;;) {
+
+      path_type& path = local_path();
+
+      leaf *pleaf = descend(key, path);
+
+      if (!validate(path))
+          continue;
+
+      if (!pleaf || !equivalent(pleaf->key, key))
+          return false;
+
+      path_entry parent = path.back();
+
+      if (path.size() == 1) { // The leaf is the root's child.
+
+          if (!try_lock(parent.pnode, parent.version))
+              continue;
+
+          parent.pnode->left.store(nullptr, std::memory_order_release);
+          unlock(parent.pnode);
+
+      } else {
+
+          path_entry grandparent = path[path.size() - 2];
+
+          if (!try_lock(grandparent.pnode, grandparent.version))
+              continue;
+
+          if (!try_lock(parent.pnode, parent.version)) {
+
+              unlock_unchanged(grandparent.pnode, grandparent.version);
+              continue;
+          }
+
+          node *sibling = parent.pnode->child(!parent.went_left).load(std::memory_order_relaxed);
+
+          grandparent.pnode->child(grandparent.went_left).store(sibling, std::memory_order_release);
+
+          unlock(parent.pnode);
+          unlock(grandparent.pnode);
+
+          retire(parent.pnode);
+      }
+
+      retire(pleaf);
+
+      count.fetch_sub(1, std::memory_order_relaxed);
+      return true;
+  }
+}
+
+template<class Key, class Value, class Compare> template<class Functor> void concurrent_bstree<Key, Value, Compare>::inOrderTraverse(Functor f) const
+{
+  epoch_reclaimer::guard guard;
+
+  std::vector<node *> stack; // right subtrees still to visit, nearest on top
+
+  node *current = root.left.load(std::memory_order_acquire);
+
+  while (current || !stack.empty()) {
+
+      if (!current) {
+
+          current = stack.back();
+          stack.pop_back();
+      }
+
+      while (!current->is_leaf) {
+
+          const internal_node *pnode = static_cast<const internal_node *>(current);
+
+          stack.push_back(pnode->right.load(std::memory_order_acquire));
+          current = pnode->left.load(std::memory_order_acquire);
+      }
+
+      const leaf *pleaf = static_cast<const leaf *>(current);
+
+      f(pleaf->key, pleaf->value);
+
+      current = nullptr;
+  }
+}
+#endif
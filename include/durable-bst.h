@@ -0,0 +1,529 @@
+#ifndef durable_bst_h_5820913746
+#define durable_bst_h_5820913746
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "bst.h"
+
+/*
+ * An append-only log file with group commit. append() copies a record into a buffer and returns at once; a background thread writes
+ * the buffer and calls fdatasync() once per batch, a batch being whatever was appended during the last group_interval, or sooner
+ * if group_bytes have piled up. Many appends thus share one sync, which costs about as much as the disk's write latency however
+ * much it covers. sync() waits until everything appended so far is on disk.
+ *
+ * Records are opaque bytes here. An error writing the file is remembered, and rethrown as std::system_error by the next append()
+ * or sync(). The log is POSIX only.
+ */
+class write_ahead_log {
+
+     int fd = -1;
+
+     std::size_t group_bytes;
+     std::chrono::milliseconds group_interval;
+
+     std::mutex m;
+     std::condition_variable flush_needed;
+     std::condition_variable flushed;
+
+     std::vector<char> pending;     // Appended but not yet written.
+     std::uint64_t appended = 0;    // Records appended since the log was opened; a record's sequence number is its count.
+     std::uint64_t durable = 0;     // Records known to be on disk.
+     std::uint64_t size_bytes = 0;  // Of the file, including pending.
+     int error = 0;                 // errno of the first failed write or sync.
+     bool flush_requested = false;  // By a thread waiting in wait_durable().
+     bool stopping = false;
+
+     std::thread flusher;
+
+     static void write_all(int fd, const char *data, std::size_t size)
+     {
+        while (size > 0) {
+
+            ssize_t written = ::write(fd, data, size);
+
+            if (written < 0) {
+
+                if (errno == EINTR)
+                    continue;
+
+                throw std::system_error(errno, std::generic_category(), "write_ahead_log: write");
+            }
+
+            data += written;
+            size -= static_cast<std::size_t>(written);
+        }
+     }
+
+     void throw_if_failed() const
+     {
+        if (error)
+            throw std::system_error(error, std::generic_category(), "write_ahead_log: an earlier write failed");
+     }
+
+     // The flusher thread: takes the pending batch, writes and syncs it outside the lock, and wakes the threads waiting for it.
+     void flush_loop()
+     {
+        std::unique_lock lock{m};
+
+        while (true) {
+
+            flush_needed.wait_for(lock, group_interval, [this] { return stopping || flush_requested || pending.size() >= group_bytes; });
+
+            flush_requested = false;
+
+            if (error)
+                pending.clear(); // append() throws from now on, and nothing more is written.
+
+            if (pending.empty()) {
+
+                if (stopping)
+                    return;
+
+                continue;
+            }
+
+            std::vector<char> batch;
+            batch.swap(pending);
+
+            std::uint64_t batch_end = appended;
+
+            lock.unlock();
+
+            int result = 0;
+
+            try {
+                write_all(fd, batch.data(), batch.size());
+
+                if (::fdatasync(fd) != 0)
+                    result = errno;
+
+            } catch (const std::system_error& e) {
+
+                result = e.code().value();
+            }
+
+            lock.lock();
+
+            if (result)
+                error = result;
+            else
+                durable = batch_end;
+
+            flushed.notify_all();
+        }
+     }
+
+  public:
+
+     write_ahead_log(std::size_t group_bytes_in, std::chrono::milliseconds group_interval_in) noexcept :
+         group_bytes{group_bytes_in}, group_interval{group_interval_in}
+     {
+     }
+
+     write_ahead_log(const write_ahead_log&) = delete;
+     write_ahead_log& operator=(const write_ahead_log&) = delete;
+
+    ~write_ahead_log()
+     {
+        close();
+     }
+
+     // Starts appending to the open file descriptor fd_in, whose current size is size. The log takes ownership of fd_in.
+     void open(int fd_in, std::uint64_t size)
+     {
+        fd = fd_in;
+        size_bytes = size;
+        flusher = std::thread(&write_ahead_log::flush_loop, this);
+     }
+
+     // Writes what is pending, stops the flusher and closes the file. Errors are ignored: a destructor calls this.
+     void close() noexcept
+     {
+        if (fd < 0)
+            return;
+
+        {
+           std::lock_guard lock{m};
+           stopping = true;
+        }
+
+        flush_needed.notify_one();
+        flusher.join();
+
+        ::close(fd);
+        fd = -1;
+     }
+
+     // Returns the record's sequence number, for wait_durable().
+     std::uint64_t append(const void *record, std::size_t size)
+     {
+        std::unique_lock lock{m};
+
+        throw_if_failed();
+
+        pending.insert(pending.end(), static_cast<const char *>(record), static_cast<const char *>(record) + size);
+        size_bytes += size;
+
+        std::uint64_t sequence = ++appended;
+
+        if (pending.size() >= group_bytes) {
+
+            lock.unlock();
+            flush_needed.notify_one();
+        }
+
+        return sequence;
+     }
+
+     // Blocks until the record with the given sequence number, and all before it, are on disk.
+     void wait_durable(std::uint64_t sequence)
+     {
+        std::unique_lock lock{m};
+
+        if (durable < sequence && pending.size() > 0) {
+
+            flush_requested = true; // Do not make the caller wait out the rest of the interval.
+            flush_needed.notify_one();
+        }
+
+        flushed.wait(lock, [this, sequence] { return durable >= sequence || error; });
+
+        throw_if_failed();
+     }
+
+     void sync()
+     {
+        std::uint64_t sequence;
+
+        {
+           std::lock_guard lock{m};
+           sequence = appended;
+        }
+
+        wait_durable(sequence);
+     }
+
+     std::uint64_t size() noexcept
+     {
+        std::lock_guard lock{m};
+
+        return size_bytes;
+     }
+
+     // Cuts the file back to its first size bytes, e.g. to drop the records a checkpoint has made redundant. Syncs first.
+     void truncate(std::uint64_t size)
+     {
+        sync();
+
+        std::lock_guard lock{m};
+
+        if (::ftruncate(fd, static_cast<off_t>(size)) != 0 || ::lseek(fd, 0, SEEK_END) < 0 || ::fdatasync(fd) != 0)
+            throw std::system_error(errno, std::generic_category(), "write_ahead_log: truncate");
+
+        size_bytes = size;
+     }
+};
+
+/*
+ * A bstree whose mutations survive a crash. The directory holds two files: snapshot, the tree as of the last checkpoint in the
+ * format of bstree::serialize(), and wal, the insert_or_assign() and remove() calls made since, one fixed-size record each. Every
+ * mutation is appended to the log before it is applied to the tree. Opening a durable_bstree recovers the tree: it loads the
+ * snapshot and replays the log on top of it. A crash can tear the last records of the log; each record carries a checksum, and
+ * replay stops at the first record that fails it and cuts the log there.
+ *
+ * Mutations are committed in groups (see write_ahead_log), so by default a mutation returns before it is on disk, and a crash
+ * loses at most the last group_interval of them. Call sync() to wait until everything so far is on disk, e.g. once per batch of
+ * mutations, or set sync_each_write to wait after every mutation.
+ *
+ * A checkpoint writes a new snapshot and empties the log, which bounds the replay at the next open. One runs automatically when the
+ * log outgrows checkpoint_bytes. The snapshot is written to a temporary file and renamed over the old one, so a crash leaves either
+ * snapshot in place; a crash after the rename but before the log is emptied replays the old log over the new snapshot, which is
+ * harmless: replaying a log leaves every key it mentions as its last record says and every other key alone, so it is idempotent.
+ *
+ * Key and Value must be trivially copyable. Like bstree, a durable_bstree is not thread safe. The files are POSIX only.
+ */
+template<class Key, class Value, class Compare = std::less<Key>, class Balance = red_black, class Allocator = pool_allocator<std::pair<const Key, Value>>> class durable_bstree {
+
+     static_assert(std::is_trivially_copyable_v<Key> && std::is_trivially_copyable_v<Value>,
+                   "durable_bstree stores Key and Value as their bytes");
+
+  public:
+
+     using tree_type = bstree<Key, Value, Compare, Balance, Allocator>;
+
+     struct options {
+
+         std::size_t group_bytes = 1 << 20;                  // Write a group early once this much is pending.
+         std::chrono::milliseconds group_interval{5};        // The longest a mutation waits to be written.
+         bool sync_each_write = false;                       // Make each mutation wait until it is on disk.
+         std::uint64_t checkpoint_bytes = 64 << 20;          // Checkpoint when the log grows past this; 0 for never.
+     };
+
+  private:
+
+     enum class operation : std::uint32_t { insert_or_assign = 1, remove = 2 };
+
+     /*
+      * A log record. It is zeroed before the fields are set, so that its padding, which the checksum covers too, is deterministic.
+      * The checksum is FNV-1a over the bytes that follow it.
+      */
+     struct record {
+
+         std::uint32_t checksum;
+         operation     op;
+         Key           key;
+         Value         value;    // Zero for remove.
+
+         std::uint32_t compute_checksum() const noexcept
+         {
+            const unsigned char *bytes = reinterpret_cast<const unsigned char *>(this);
+
+            std::uint32_t hash = 2166136261u;
+
+            for (std::size_t i = sizeof(checksum); i < sizeof(record); ++i)
+                hash = (hash ^ bytes[i]) * 16777619u;
+
+            return hash;
+         }
+     };
+
+     struct log_header {
+
+         char          magic[8];
+         std::uint32_t version;
+         std::uint32_t record_size;
+
+         bool operator==(const log_header&) const = default;
+     };
+
+     static constexpr log_header expected_header{{'b', 's', 't', 'w', 'a', 'l', '0', '1'}, 1, sizeof(record)};
+
+     std::filesystem::path directory;
+
+     options opt;
+
+     tree_type tree;
+
+     write_ahead_log log;
+
+     std::filesystem::path snapshot_path() const { return directory / "snapshot"; }
+     std::filesystem::path log_path() const { return directory / "wal"; }
+
+     static void sync_path(const std::filesystem::path& path, int flags)
+     {
+        int fd = ::open(path.c_str(), flags);
+
+        if (fd < 0 || ::fsync(fd) != 0) {
+
+            int e = errno;
+
+            if (fd >= 0)
+                ::close(fd);
+
+            throw std::system_error(e, std::generic_category(), "durable_bstree: cannot sync " + path.string());
+        }
+
+        ::close(fd);
+     }
+
+     void recover();
+
+     void log_mutation(operation op, const Key& key, const Value *value);
+
+     // Called after a mutation is applied, so that the snapshot includes it.
+     void checkpoint_if_due()
+     {
+        if (opt.checkpoint_bytes && log.size() > opt.checkpoint_bytes)
+            checkpoint();
+     }
+
+  public:
+
+     // Opens the tree stored in directory, creating the directory if need be, and recovers its contents.
+     explicit durable_bstree(std::filesystem::path directory_in, options opt_in = options()) :
+         directory{std::move(directory_in)}, opt{opt_in}, log{opt_in.group_bytes, opt_in.group_interval}
+     {
+        std::filesystem::create_directories(directory);
+
+        recover();
+     }
+
+     durable_bstree(const durable_bstree&) = delete;
+     durable_bstree& operator=(const durable_bstree&) = delete;
+
+     // The recovered tree, for lookups. Mutations must go through durable_bstree, or they are not logged.
+     const tree_type& view() const noexcept
+     {
+        return tree;
+     }
+
+     std::size_t size() const noexcept
+     {
+        return tree.size();
+     }
+
+     bool find(const Key& key) const noexcept
+     {
+        return tree.find(key);
+     }
+
+     // Returns true if key was inserted, false if its value was assigned.
+     bool insert_or_assign(const Key& key, const Value& value)
+     {
+        log_mutation(operation::insert_or_assign, key, &value);
+
+        bool inserted = tree.insert_or_assign(key, value).second;
+
+        checkpoint_if_due();
+
+        return inserted;
+     }
+
+     bool remove(const Key& key)
+     {
+        log_mutation(operation::remove, key, nullptr);
+
+        bool removed = tree.remove(key);
+
+        checkpoint_if_due();
+
+        return removed;
+     }
+
+     // Waits until every mutation so far is on disk.
+     void sync()
+     {
+        log.sync();
+     }
+
+     // Writes the tree as the new snapshot and empties the log.
+     void checkpoint();
+};
+
+/*
+ * Loads the snapshot, if there is one, then replays the log's valid records in order and cuts off whatever follows them: the torn
+ * remains of the records being written when the process died. A missing or empty log is created with just its header.
+ */
+template<class Key, class Value, class Compare, class Balance, class Allocator> void durable_bstree<Key, Value, Compare, Balance, Allocator>::recover()
+{
+  if (std::filesystem::exists(snapshot_path())) {
+
+      std::ifstream file(snapshot_path(), std::ios::binary);
+
+      tree = tree_type::deserialize(file);
+  }
+
+  int fd = ::open(log_path().c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+  if (fd < 0)
+      throw std::system_error(errno, std::generic_category(), "durable_bstree: cannot open " + log_path().string());
+
+  std::uint64_t valid_size = sizeof(log_header);
+
+  {
+     std::ifstream file(log_path(), std::ios::binary);
+
+     log_header header{};
+
+     if (file.read(reinterpret_cast<char *>(&header), sizeof header) && !(header == expected_header)) {
+
+         ::close(fd);
+         throw std::runtime_error("durable_bstree: " + log_path().string() + " is not a log of this key and value type");
+     }
+
+     record r;
+
+     while (file.read(reinterpret_cast<char *>(&r), sizeof r) && r.checksum == r.compute_checksum()) {
+
+         if (r.op == operation::insert_or_assign)
+             tree.insert_or_assign(r.key, r.value);
+         else if (r.op == operation::remove)
+             tree.remove(r.key);
+         else
+             break;
+
+         valid_size += sizeof r;
+     }
+  }
+
+  // A log too short for its header was being created when the process died, and is started over.
+  if (::ftruncate(fd, static_cast<off_t>(valid_size)) != 0 || ::pwrite(fd, &expected_header, sizeof expected_header, 0) != sizeof expected_header ||
+      ::lseek(fd, 0, SEEK_END) < 0 || ::fsync(fd) != 0) {
+
+      int e = errno;
+      ::close(fd);
+      throw std::system_error(e, std::generic_category(), "durable_bstree: cannot repair " + log_path().string());
+  }
+
+  sync_path(directory, O_RDONLY | O_DIRECTORY); // Makes a newly created log's directory entry durable.
+
+  log.open(fd, valid_size);
+}
+
+template<class Key, class Value, class Compare, class Balance, class Allocator> void durable_bstree<Key, Value, Compare, Balance, Allocator>::log_mutation(operation op, const Key& key, const Value *value)
+{
+  record r;
+
+  std::memset(&r, 0, sizeof r);
+
+  r.op = op;
+  std::memcpy(&r.key, &key, sizeof(Key));
+
+  if (value)
+      std::memcpy(&r.value, value, sizeof(Value));
+
+  r.checksum = r.compute_checksum();
+
+  std::uint64_t sequence = log.append(&r, sizeof r);
+
+  if (opt.sync_each_write)
+      log.wait_durable(sequence);
+}
+
+/*
+ * The log is synced first, so the snapshot covers everything a reader of the log could find. The new snapshot is synced before it
+ * replaces the old one, and the rename is synced before the log is emptied.
+ */
+template<class Key, class Value, class Compare, class Balance, class Allocator> void durable_bstree<Key, Value, Compare, Balance, Allocator>::checkpoint()
+{
+  log.sync();
+
+  std::filesystem::path temporary = directory / "snapshot.tmp";
+
+  {
+     std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+
+     tree.serialize(file);
+
+     file.close();
+
+     if (!file)
+         throw std::runtime_error("durable_bstree: cannot write " + temporary.string());
+  }
+
+  sync_path(temporary, O_RDONLY);
+
+  std::filesystem::rename(temporary, snapshot_path());
+
+  sync_path(directory, O_RDONLY | O_DIRECTORY);
+
+  log.truncate(sizeof(log_header));
+}
+#endif
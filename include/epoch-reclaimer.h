@@ -0,0 +1,191 @@
+#ifndef epoch_reclaimer_h_7719283746
+#define epoch_reclaimer_h_7719283746
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+/*
+ * Epoch-based memory reclamation, for data structures whose readers take no locks. A reader enters a guard before it loads any
+ * shared pointer and leaves it when it no longer uses what it loaded. A writer that has unlinked a node retire()s it instead of
+ * deleting it, and the node is deleted once every thread that might still hold a pointer to it has left its guard.
+ *
+ * Each thread announces the global epoch it observed when it entered its guard. The global epoch only advances once every thread
+ * inside a guard has observed the current epoch, so when the global epoch has moved two past the epoch in which a node was retired,
+ * no guard that began before the node was unlinked can still be active, and the node can be deleted.
+ *
+ * There is one reclaimer per process, shared by all data structures. Per-thread records are kept in a lock-free list and reused
+ * after their thread exits, together with any nodes it had retired but not yet deleted.
+ */
+class epoch_reclaimer {
+
+     static constexpr std::uint64_t quiescent = ~std::uint64_t{0};
+
+     struct retired_node {
+
+         void *pnode;
+         void (*deleter)(void *);
+         std::uint64_t epoch;
+     };
+
+     struct alignas(64) thread_record {
+
+         std::atomic<std::uint64_t> epoch{quiescent}; // The epoch observed on entering the outermost guard.
+         std::atomic<bool> in_use{true};
+
+         thread_record *next = nullptr;
+
+         unsigned nesting = 0;                        // Guards may nest; only the outermost one announces an epoch.
+
+         std::vector<retired_node> retired;
+     };
+
+     // Releases the calling thread's record when the thread exits.
+     struct record_owner {
+
+         thread_record *record;
+
+        ~record_owner()
+         {
+            record->in_use.store(false, std::memory_order_release);
+         }
+     };
+
+     static constexpr std::size_t reclaim_interval = 64; // retire() calls between attempts to advance the epoch.
+
+     std::atomic<std::uint64_t> global_epoch{0};
+
+     std::atomic<thread_record *> records{nullptr};
+
+     epoch_reclaimer() = default;
+
+    ~epoch_reclaimer()
+     {
+        thread_record *record = records.load();
+
+        while (record) {
+
+            for (auto& node : record->retired)
+                node.deleter(node.pnode);
+
+            thread_record *next = record->next;
+            delete record;
+            record = next;
+        }
+     }
+
+     thread_record *acquire_record()
+     {
+        for (thread_record *record = records.load(std::memory_order_acquire); record != nullptr; record = record->next) {
+
+            bool expected = false;
+
+            if (!record->in_use.load(std::memory_order_relaxed) && record->in_use.compare_exchange_strong(expected, true))
+                return record;
+        }
+
+        thread_record *record = new thread_record;
+
+        record->next = records.load(std::memory_order_relaxed);
+
+        while (!records.compare_exchange_weak(record->next, record, std::memory_order_release, std::memory_order_relaxed))
+            ;
+
+        return record;
+     }
+
+     thread_record& local()
+     {
+        thread_local record_owner owner{acquire_record()};
+
+        return *owner.record;
+     }
+
+     // Advances the global epoch if every thread inside a guard has observed it.
+     void try_advance() noexcept
+     {
+        std::uint64_t epoch = global_epoch.load();
+
+        for (thread_record *record = records.load(std::memory_order_acquire); record != nullptr; record = record->next) {
+
+            std::uint64_t observed = record->epoch.load();
+
+            if (observed != quiescent && observed != epoch)
+                return;
+        }
+
+        global_epoch.compare_exchange_strong(epoch, epoch + 1);
+     }
+
+     void reclaim(thread_record& record) noexcept
+     {
+        std::uint64_t epoch = global_epoch.load();
+
+        auto keep = record.retired.begin();
+
+        for (auto& node : record.retired) {
+
+            if (node.epoch + 2 <= epoch)
+                node.deleter(node.pnode);
+            else
+                *keep++ = node;
+        }
+
+        record.retired.erase(keep, record.retired.end());
+     }
+
+  public:
+
+     epoch_reclaimer(const epoch_reclaimer&) = delete;
+     epoch_reclaimer& operator=(const epoch_reclaimer&) = delete;
+
+     static epoch_reclaimer& instance()
+     {
+        static epoch_reclaimer reclaimer;
+
+        return reclaimer;
+     }
+
+     // While a guard is alive, nothing retired after the guard was entered is deleted.
+     class guard {
+
+         thread_record& record;
+
+       public:
+
+         guard() : record{instance().local()}
+         {
+            if (record.nesting++ == 0) {
+
+                record.epoch.store(instance().global_epoch.load());
+
+                std::atomic_thread_fence(std::memory_order_seq_cst); // The announcement precedes every later load.
+            }
+         }
+
+         guard(const guard&) = delete;
+         guard& operator=(const guard&) = delete;
+
+        ~guard()
+         {
+            if (--record.nesting == 0)
+                record.epoch.store(quiescent, std::memory_order_release);
+         }
+     };
+
+     // Schedules delete pnode. pnode must already be unreachable for threads that enter a guard from now on.
+     template<class T> void retire(T *pnode)
+     {
+        thread_record& record = local();
+
+        record.retired.push_back({pnode, [](void *p) { delete static_cast<T *>(p); }, global_epoch.load()});
+
+        if (record.retired.size() % reclaim_interval == 0) {
+
+            try_advance();
+            reclaim(record);
+        }
+     }
+};
+#endif
@@ -0,0 +1,570 @@
+#ifndef frozen_bst_h_29384729384
+#define frozen_bst_h_29384729384
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <memory>
+#include <span>
+#include <string>
+#include <iterator>
+#include <type_traits>
+#include <istream>
+#include <ostream>
+#include <fstream>
+#include <stdexcept>
+#include <system_error>
+#include <functional>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+ * An immutable search structure built by bstree::freeze(). The keys are stored in one array in Eytzinger (BFS) order: the root is at
+ * index 1 and the children of index k are at 2k and 2k + 1 (the arrays below are 0-based, so index k lives at [k - 1]). The values are
+ * kept in a parallel array, so a search only touches key cache lines.
+ *
+ * A search descends with k = 2k + (comparison result), which compiles to a conditional move rather than a branch, and it prefetches
+ * the cache line holding the node's descendants a few levels down, so those loads overlap the comparisons. The path taken is encoded
+ * in the bits of the final k: a right turn appends a 1 bit and a left turn a 0 bit. The last right (or left) turn therefore recovers
+ * the floor (or ceiling) without any bookkeeping during the descent.
+ *
+ * Keys are ordered by Compare, which must match the bstree's. As in bstree, a transparent Compare enables lookups by any type
+ * comparable with Key. Key and Value must be default constructible.
+ *
+ * The arrays are immutable once built, so copies share them: copying a frozen_bstree is O(1). They live either on the heap or, for a
+ * tree returned by map(), in a read-only mapping of a file written by write(), which is unmapped when the last copy goes away.
+ */
+template<class Key, class Value, class Compare = std::less<Key>> class frozen_bstree {
+
+     struct arrays {
+
+         std::vector<Key>   keys;
+         std::vector<Value> values;
+     };
+
+     std::shared_ptr<const void> storage; // Owns the arrays: an arrays object or a file mapping.
+
+     std::span<const Key>   keys;
+     std::span<const Value> values;
+
+     [[no_unique_address]] Compare comp;
+
+     static constexpr bool has_transparent_compare = requires { typename Compare::is_transparent; };
+
+     // Prefetching keys[k * prefetch_stride] fetches the line that holds k's descendants log2(prefetch_stride) levels down.
+     static constexpr std::size_t prefetch_stride = (sizeof(Key) < 64) ? 64 / sizeof(Key) : 1;
+
+     // The in-order walk over the implicit tree: its first index, and the index after k, or 0 after the last.
+     static std::size_t first_index(std::size_t n) noexcept
+     {
+        if (n == 0)
+            return 0;
+
+        std::size_t k = 1;
+
+        while (2 * k <= n)  // leftmost node
+            k *= 2;
+
+        return k;
+     }
+
+     static std::size_t next_index(std::size_t k, std::size_t n) noexcept
+     {
+        if (2 * k + 1 <= n) {      // successor is the leftmost node of the right subtree
+
+            k = 2 * k + 1;
+
+            while (2 * k <= n)
+                k *= 2;
+
+        } else {                   // ascend past right children (odd indices), then once more
+
+            while (k & 1)
+                k /= 2;
+
+            k /= 2;
+        }
+
+        return k;
+     }
+
+     static int trailing_zeros(std::size_t k) noexcept
+     {
+#if defined(__GNUC__)
+        return __builtin_ctzll(k);
+#else
+        int count = 0;
+
+        for (; (k & 1) == 0; k >>= 1)
+            ++count;
+
+        return count;
+#endif
+     }
+
+     void prefetch(std::size_t k) const noexcept
+     {
+#if defined(__GNUC__)
+        __builtin_prefetch(keys.data() + k * prefetch_stride);
+#endif
+     }
+
+     /*
+      * Descends from the root, appending a 1 bit to k whenever go_right(keys[k]) is true and a 0 bit otherwise, until k runs off the
+      * bottom of the tree.
+      */
+     template<class GoRight> std::size_t descend(GoRight go_right) const noexcept
+     {
+        std::size_t k = 1;
+        std::size_t n = keys.size();
+
+        while (k <= n) {
+
+           prefetch(k);
+           k = 2 * k + (go_right(keys[k - 1]) ? 1 : 0);
+        }
+
+        return k;
+     }
+
+     // Index of the first key not less than key, or 0 if there is none: strip the trailing right turns and the final left turn.
+     template<class K> std::size_t lower_bound_index(const K& key) const noexcept
+     {
+        std::size_t k = descend([this, &key](const Key& current) { return comp(current, key); });
+
+        return k >> (trailing_zeros(~k) + 1);
+     }
+
+     // Index of the last key not greater than key, or 0 if there is none.
+     template<class K> std::size_t floor_index(const K& key) const noexcept
+     {
+        std::size_t k = descend([this, &key](const Key& current) { return !comp(key, current); });
+
+        return k >> (trailing_zeros(k) + 1);
+     }
+
+     template<class K> bool contains(const K& key) const noexcept
+     {
+        std::size_t k = lower_bound_index(key);
+
+        return k != 0 && !comp(key, keys[k - 1]);
+     }
+
+     template<class K> const Value *value_of(const K& key) const noexcept
+     {
+        std::size_t k = lower_bound_index(key);
+
+        return (k != 0 && !comp(key, keys[k - 1])) ? &values[k - 1] : nullptr;
+     }
+
+     template<class K> Key floor_key(const K& key) const
+     {
+        if (isEmpty())
+            throw std::logic_error("floor() called with empty tree");
+
+        std::size_t k = floor_index(key);
+
+        if (k == 0)
+            throw std::logic_error("argument to floor() is too small");
+
+        return keys[k - 1];
+     }
+
+     template<class K> Key ceiling_key(const K& key) const
+     {
+        if (isEmpty())
+            throw std::logic_error("ceiling() called with empty tree");
+
+        std::size_t k = lower_bound_index(key);
+
+        if (k == 0)
+            throw std::logic_error("argument to ceiling() is too large");
+
+        return keys[k - 1];
+     }
+
+     /*
+      * The file format of write() and map(): this header, then the keys and then the values, each array in the order above and
+      * starting on a 64-byte boundary, so that a mapping, which starts on a page boundary, leaves both arrays aligned. Key and
+      * Value are stored as their object representations, which is why they must be trivially copyable, and a file is only read
+      * back by a build whose Key and Value have the same sizes, alignments and byte order.
+      */
+     struct file_header {
+
+         char          magic[8];
+         std::uint32_t version;
+         std::uint32_t byte_order;  // byte_order_mark, as written by the writer
+         std::uint32_t key_size;
+         std::uint32_t key_align;
+         std::uint32_t value_size;
+         std::uint32_t value_align;
+         std::uint64_t count;
+         std::uint64_t keys_offset;
+         std::uint64_t values_offset;
+         std::uint64_t file_size;
+
+         bool operator==(const file_header&) const = default;
+     };
+
+     static constexpr char file_magic[8] = {'f', 'r', 'o', 'z', 'e', 'n', 'b', 't'};
+     static constexpr std::uint32_t file_version = 1;
+     static constexpr std::uint32_t byte_order_mark = 0x01020304;
+
+     static constexpr bool trivially_copyable = std::is_trivially_copyable_v<Key> && std::is_trivially_copyable_v<Value>;
+
+     static constexpr std::uint64_t align_up(std::uint64_t offset, std::size_t alignment) noexcept
+     {
+        alignment = std::max<std::size_t>(alignment, 64);
+
+        return (offset + alignment - 1) / alignment * alignment;
+     }
+
+     // The header of a file of count entries. A header read from a file is valid if and only if it equals this.
+     static file_header make_header(std::uint64_t count) noexcept
+     {
+        file_header header{};
+
+        std::memcpy(header.magic, file_magic, sizeof header.magic);
+
+        header.version     = file_version;
+        header.byte_order  = byte_order_mark;
+        header.key_size    = sizeof(Key);
+        header.key_align   = alignof(Key);
+        header.value_size  = sizeof(Value);
+        header.value_align = alignof(Value);
+        header.count       = count;
+
+        header.keys_offset   = align_up(sizeof(file_header), alignof(Key));
+        header.values_offset = align_up(header.keys_offset + count * sizeof(Key), alignof(Value));
+        header.file_size     = header.values_offset + count * sizeof(Value);
+
+        return header;
+     }
+
+     // Throws std::runtime_error unless header is that of a file of this type with no more than available bytes.
+     static void check_header(const file_header& header, std::uint64_t available)
+     {
+        // A count this large would overflow the offsets.
+        if (header.count > UINT64_MAX / 2 / (sizeof(Key) + sizeof(Value)) || !(header == make_header(header.count)))
+            throw std::runtime_error("frozen_bstree: not a file of this key and value type");
+
+        if (header.file_size > available)
+            throw std::runtime_error("frozen_bstree: file is truncated");
+     }
+
+     // Points keys and values at count entries of each, which storage keeps alive.
+     void attach(std::shared_ptr<const void> storage_in, const Key *key_data, const Value *value_data, std::size_t count) noexcept
+     {
+        storage = std::move(storage_in);
+        keys    = std::span<const Key>(key_data, count);
+        values  = std::span<const Value>(value_data, count);
+     }
+
+  public:
+
+     using key_type    = Key;
+     using mapped_type = Value;
+     using key_compare = Compare;
+
+     frozen_bstree() = default;
+
+     explicit frozen_bstree(const Compare& comp_in) : comp{comp_in}
+     {
+     }
+
+     /*
+      * Builds the layout from n pairs in ascending key order, such as a bstree's [begin(), end()). The pairs are visited once, in
+      * order, while k walks the implicit tree in-order.
+      */
+     template<class InputIt> frozen_bstree(InputIt first, std::size_t n, const Compare& comp_in = Compare()) : comp{comp_in}
+     {
+        auto built = std::make_shared<arrays>();
+
+        built->keys.resize(n);
+        built->values.resize(n);
+
+        for (std::size_t i = 0, k = first_index(n); i < n; ++i, ++first, k = next_index(k, n)) {
+
+            built->keys[k - 1]   = first->first;
+            built->values[k - 1] = first->second;
+        }
+
+        attach(built, built->keys.data(), built->values.data(), n);
+     }
+
+     /*
+      * Visits the entries in ascending key order, e.g. to rebuild a bstree with bstree::from_sorted(). An entry is a pair of
+      * references into the arrays.
+      */
+     class const_iterator {
+
+         const frozen_bstree *tree;
+         std::size_t k;           // 1-based index of the current entry; 0 at the end
+
+         friend class frozen_bstree;
+
+         const_iterator(const frozen_bstree *tree_in, std::size_t k_in) noexcept : tree{tree_in}, k{k_in} {}
+
+       public:
+
+         using iterator_category = std::forward_iterator_tag;
+         using value_type        = std::pair<const Key&, const Value&>;
+         using difference_type   = std::ptrdiff_t;
+         using reference         = value_type;
+
+         // operator-> returns this, which holds the pair it points to.
+         struct pointer {
+
+             value_type entry;
+
+             const value_type *operator->() const noexcept
+             {
+                 return &entry;
+             }
+         };
+
+         const_iterator() noexcept : tree{nullptr}, k{0} {}
+
+         reference operator*() const noexcept
+         {
+             return {tree->keys[k - 1], tree->values[k - 1]};
+         }
+
+         pointer operator->() const noexcept
+         {
+             return {**this};
+         }
+
+         const_iterator& operator++() noexcept
+         {
+             k = next_index(k, tree->size());
+             return *this;
+         }
+
+         const_iterator operator++(int) noexcept
+         {
+             const_iterator tmp{*this};
+             ++*this;
+             return tmp;
+         }
+
+         friend bool operator==(const const_iterator& lhs, const const_iterator& rhs) noexcept
+         {
+             return lhs.k == rhs.k;
+         }
+     };
+
+     const_iterator begin() const noexcept
+     {
+        return {this, first_index(size())};
+     }
+
+     const_iterator end() const noexcept
+     {
+        return {this, 0};
+     }
+
+     /*
+      * Writes the layout to ostr in the format described at file_header, for map() or read() to load. Throws std::runtime_error if
+      * the stream fails.
+      */
+     void write(std::ostream& ostr) const requires trivially_copyable
+     {
+        file_header header = make_header(size());
+
+        auto pad_to = [&ostr](std::uint64_t from, std::uint64_t to) {
+           for (; from < to; ++from)
+               ostr.put('\0');
+        };
+
+        ostr.write(reinterpret_cast<const char *>(&header), sizeof header);
+
+        pad_to(sizeof header, header.keys_offset);
+
+        ostr.write(reinterpret_cast<const char *>(keys.data()), keys.size_bytes());
+
+        pad_to(header.keys_offset + keys.size_bytes(), header.values_offset);
+
+        ostr.write(reinterpret_cast<const char *>(values.data()), values.size_bytes());
+
+        if (!ostr)
+            throw std::runtime_error("frozen_bstree::write(): the stream failed");
+     }
+
+     // Reads a layout written by write() into memory. Throws std::runtime_error if istr does not hold one.
+     static frozen_bstree read(std::istream& istr, const Compare& comp = Compare()) requires trivially_copyable
+     {
+        file_header header;
+
+        if (!istr.read(reinterpret_cast<char *>(&header), sizeof header))
+            throw std::runtime_error("frozen_bstree::read(): the stream failed");
+
+        check_header(header, UINT64_MAX); // The stream's length is unknown; a short stream fails the reads below.
+
+        auto loaded = std::make_shared<arrays>();
+
+        loaded->keys.resize(header.count);
+        loaded->values.resize(header.count);
+
+        istr.ignore(header.keys_offset - sizeof header);
+        istr.read(reinterpret_cast<char *>(loaded->keys.data()), header.count * sizeof(Key));
+
+        istr.ignore(header.values_offset - header.keys_offset - header.count * sizeof(Key));
+        istr.read(reinterpret_cast<char *>(loaded->values.data()), header.count * sizeof(Value));
+
+        if (!istr)
+            throw std::runtime_error("frozen_bstree::read(): file is truncated");
+
+        frozen_bstree tree(comp);
+
+        tree.attach(loaded, loaded->keys.data(), loaded->values.data(), header.count);
+
+        return tree;
+     }
+
+     /*
+      * Maps the file at path, written by write(), read-only into memory and serves lookups straight from the mapping: nothing is
+      * read or built up front, and the operating system pages the arrays in as searches touch them, so a restart can answer its
+      * first lookups at once. The mapping is shared with other processes mapping the file and lasts as long as the tree or any
+      * copy of it; the file must not be modified meanwhile. Where mmap() is unavailable the file is read with read() instead.
+      *
+      * Throws std::system_error if the file cannot be opened or mapped, and std::runtime_error if it is not a file of this type.
+      */
+     static frozen_bstree map(const char *path, const Compare& comp = Compare()) requires trivially_copyable
+     {
+#if defined(__unix__) || defined(__APPLE__)
+        int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+
+        if (fd < 0)
+            throw std::system_error(errno, std::generic_category(), std::string("frozen_bstree::map(): cannot open ") + path);
+
+        struct stat st;
+
+        if (::fstat(fd, &st) != 0) {
+
+            int error = errno;
+            ::close(fd);
+            throw std::system_error(error, std::generic_category(), std::string("frozen_bstree::map(): cannot stat ") + path);
+        }
+
+        std::size_t length = static_cast<std::size_t>(st.st_size);
+
+        if (length < sizeof(file_header)) {
+
+            ::close(fd);
+            throw std::runtime_error("frozen_bstree: not a file of this key and value type");
+        }
+
+        void *base = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+
+        int error = errno;
+
+        ::close(fd); // The mapping keeps the file open.
+
+        if (base == MAP_FAILED)
+            throw std::system_error(error, std::generic_category(), std::string("frozen_bstree::map(): cannot map ") + path);
+
+        // Should allocating the control block fail, shared_ptr unmaps before rethrowing.
+        std::shared_ptr<const void> mapping(base, [length](const void *p) { ::munmap(const_cast<void *>(p), length); });
+
+        const char *bytes = static_cast<const char *>(base);
+
+        file_header header;
+
+        std::memcpy(&header, bytes, sizeof header);
+
+        check_header(header, length);
+
+        frozen_bstree tree(comp);
+
+        tree.attach(std::move(mapping), reinterpret_cast<const Key *>(bytes + header.keys_offset),
+                    reinterpret_cast<const Value *>(bytes + header.values_offset), header.count);
+
+        return tree;
+#else
+        std::ifstream file(path, std::ios::binary);
+
+        if (!file)
+            throw std::system_error(errno, std::generic_category(), std::string("frozen_bstree::map(): cannot open ") + path);
+
+        return read(file, comp);
+#endif
+     }
+
+     // Writes the layout to the file at path (see write()).
+     void write(const char *path) const requires trivially_copyable
+     {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+
+        if (!file)
+            throw std::system_error(errno, std::generic_category(), std::string("frozen_bstree::write(): cannot create ") + path);
+
+        write(file);
+
+        file.close();
+
+        if (!file)
+            throw std::runtime_error(std::string("frozen_bstree::write(): cannot write ") + path);
+     }
+
+     std::size_t size() const noexcept
+     {
+        return keys.size();
+     }
+
+     bool isEmpty() const noexcept
+     {
+        return keys.empty();
+     }
+
+     bool find(const Key& key) const noexcept
+     {
+        return contains(key);
+     }
+
+     template<class K> requires has_transparent_compare bool find(const K& key) const noexcept
+     {
+        return contains(key);
+     }
+
+     // Returns a pointer to the value associated with key, or nullptr.
+     const Value *lookup(const Key& key) const noexcept
+     {
+        return value_of(key);
+     }
+
+     template<class K> requires has_transparent_compare const Value *lookup(const K& key) const noexcept
+     {
+        return value_of(key);
+     }
+
+     Key floor(const Key& key) const
+     {
+        return floor_key(key);
+     }
+
+     template<class K> requires has_transparent_compare Key floor(const K& key) const
+     {
+        return floor_key(key);
+     }
+
+     Key ceiling(const Key& key) const
+     {
+        return ceiling_key(key);
+     }
+
+     template<class K> requires has_transparent_compare Key ceiling(const K& key) const
+     {
+        return ceiling_key(key);
+     }
+};
+#endif
@@ -0,0 +1,756 @@
+#ifndef intrusive_bst_h_3091827465
+#define intrusive_bst_h_3091827465
+
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include "bst.h" // for the balancing policies, unbalanced and red_black
+
+/*
+ * The links an object needs to be an element of an intrusive_bstree. A type derives from bstree_hook<Tag> once for each tree it is
+ * to be in at the same time, with a different Tag for each. Copying an object does not copy its links: the copy starts out unlinked,
+ * and assigning to a linked object leaves its links alone.
+ */
+template<class Tag = void> struct bstree_hook {
+
+     enum class Color : char { unlinked, red, black }; // unbalanced trees color their nodes black
+
+     bstree_hook *left   = nullptr;
+     bstree_hook *right  = nullptr;
+     bstree_hook *parent = nullptr;
+
+     Color color = Color::unlinked;
+
+     bstree_hook() noexcept = default;
+
+     bstree_hook(const bstree_hook&) noexcept {}
+
+     bstree_hook& operator=(const bstree_hook&) noexcept
+     {
+        return *this;
+     }
+
+     // True while the object is in a tree.
+     bool is_linked() const noexcept
+     {
+        return color != Color::unlinked;
+     }
+};
+
+/*
+ * An ordered set of objects the tree does not own. Each T derives from bstree_hook<Tag>, which holds the left, right and parent
+ * links bstree keeps in its Node, so insert(), unlink() and remove() only relink the object: they never allocate, copy or move it. A
+ * lookup returns an iterator to the object itself. The caller keeps the objects alive, and does not change their keys, while they
+ * are in the tree; the destructor and clear() unlink them all.
+ *
+ * The algorithms are bstree's: insertion and tree-delete from chapter 12 of Introduction to Algorithms, 3rd Edition, with the
+ * red-black fix-ups of chapter 13 when Balance is red_black, and the parent-pointer successor walk for iteration. There is no size
+ * field in the hook, so there is no order statistics support.
+ *
+ * Compare orders T objects. If it declares is_transparent, find(), lower_bound(), upper_bound() and remove() also accept any type it
+ * can compare with T, such as the key member alone.
+ */
+template<class T, class Compare = std::less<T>, class Balance = unbalanced, class Tag = void> class intrusive_bstree {
+
+     using hook  = bstree_hook<Tag>;
+     using Color = typename hook::Color;
+
+     static_assert(std::is_base_of_v<hook, T>, "T must derive from bstree_hook<Tag>");
+
+     static constexpr bool is_red_black = std::is_same_v<Balance, red_black>;
+
+     static constexpr bool has_transparent_compare = requires { typename Compare::is_transparent; };
+
+     hook *root = nullptr;
+
+     std::size_t count = 0;
+
+     [[no_unique_address]] Compare comp;
+
+     static T& object(hook *h) noexcept
+     {
+        return static_cast<T&>(*h);
+     }
+
+     static const T& object(const hook *h) noexcept
+     {
+        return static_cast<const T&>(*h);
+     }
+
+     static bool is_red(const hook *h) noexcept
+     {
+        return h && h->color == Color::red;
+     }
+
+     static bool is_black(const hook *h) noexcept
+     {
+        return !is_red(h);
+     }
+
+     static hook *min(hook *current) noexcept
+     {
+        while (current->left)
+            current = current->left;
+
+        return current;
+     }
+
+     static hook *max(hook *current) noexcept
+     {
+        while (current->right)
+            current = current->right;
+
+        return current;
+     }
+
+     // tree-successor(x) from page 292 of Introduction to Algorithms, 3rd Edition, as bstree::getSuccessor().
+     static hook *successor(const hook *x) noexcept
+     {
+        if (x->right)
+            return min(x->right);
+
+        hook *parent = x->parent;
+
+        while (parent && x == parent->right) {
+
+            x = parent;
+            parent = parent->parent;
+        }
+
+        return parent;
+     }
+
+     static hook *predecessor(const hook *x) noexcept
+     {
+        if (x->left)
+            return max(x->left);
+
+        hook *parent = x->parent;
+
+        while (parent && x == parent->left) {
+
+            x = parent;
+            parent = parent->parent;
+        }
+
+        return parent;
+     }
+
+     // The link that points to x: root or a child link of x's parent.
+     hook *& owner(hook *x) noexcept
+     {
+        if (!x->parent)
+            return root;
+
+        return x == x->parent->left ? x->parent->left : x->parent->right;
+     }
+
+     void rotate_left(hook *x) noexcept;
+     void rotate_right(hook *x) noexcept;
+
+     void insert_fixup(hook *z) noexcept;
+     void remove_fixup(hook *x, hook *x_parent) noexcept;
+
+     void transplant(hook *u, hook *v) noexcept;
+
+     void unlink_node(hook *z) noexcept;
+
+     // True if h is linked into this tree rather than another one with the same Tag. O(height).
+     bool contains_node(const hook *h) const noexcept
+     {
+        if (!h->is_linked())
+            return false;
+
+        while (h->parent)
+            h = h->parent;
+
+        return h == root;
+     }
+
+     // Returns the node with an equivalent key if there is one, and otherwise the node below which key belongs, or nullptr.
+     template<class K> std::pair<bool, hook *> find_node(const K& key) const noexcept
+     {
+        hook *current = root;
+        hook *parent = nullptr;
+
+        while (current) {
+
+            if (comp(key, object(current)))
+                parent = current, current = current->left;
+            else if (comp(object(current), key))
+                parent = current, current = current->right;
+            else
+                return {true, current};
+        }
+
+        return {false, parent};
+     }
+
+     template<class K> hook *lower_bound_node(const K& key) const noexcept
+     {
+        hook *result = nullptr;
+
+        for (hook *current = root; current; )
+            if (comp(object(current), key))
+                current = current->right;
+            else
+                result = current, current = current->left;
+
+        return result;
+     }
+
+     template<class K> hook *upper_bound_node(const K& key) const noexcept
+     {
+        hook *result = nullptr;
+
+        for (hook *current = root; current; )
+            if (comp(key, object(current)))
+                result = current, current = current->left;
+            else
+                current = current->right;
+
+        return result;
+     }
+
+     template<class K> std::size_t remove_key(const K& key) noexcept
+     {
+        auto [found, h] = find_node(key);
+
+        if (!found)
+            return 0;
+
+        unlink_node(h);
+
+        return 1;
+     }
+
+  public:
+
+    template<bool IsConst> class tree_iterator {
+
+        friend class intrusive_bstree;
+
+        using tree_type = std::conditional_t<IsConst, const intrusive_bstree, intrusive_bstree>;
+
+        hook *current;
+        tree_type *tree;  // end() is nullptr, so -- needs the tree to find the last node.
+
+        tree_iterator(hook *current_in, tree_type *tree_in) noexcept : current{current_in}, tree{tree_in} {}
+
+      public:
+
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type        = T;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = std::conditional_t<IsConst, const T *, T *>;
+        using reference         = std::conditional_t<IsConst, const T&, T&>;
+
+        tree_iterator() noexcept : current{nullptr}, tree{nullptr} {}
+
+        template<bool RhsConst, class = std::enable_if_t<IsConst && !RhsConst>>
+        tree_iterator(const tree_iterator<RhsConst>& lhs) noexcept : current{lhs.current}, tree{lhs.tree} {}
+
+        reference operator*() const noexcept
+        {
+            return object(current);
+        }
+
+        pointer operator->() const noexcept
+        {
+            return &object(current);
+        }
+
+        tree_iterator& operator++() noexcept
+        {
+            current = successor(current);
+            return *this;
+        }
+
+        tree_iterator operator++(int) noexcept
+        {
+            tree_iterator tmp{*this};
+            ++*this;
+            return tmp;
+        }
+
+        tree_iterator& operator--() noexcept
+        {
+            current = current ? predecessor(current) : max(tree->root);
+            return *this;
+        }
+
+        tree_iterator operator--(int) noexcept
+        {
+            tree_iterator tmp{*this};
+            --*this;
+            return tmp;
+        }
+
+        friend bool operator==(const tree_iterator& lhs, const tree_iterator& rhs) noexcept
+        {
+            return lhs.current == rhs.current;
+        }
+
+        template<bool> friend class tree_iterator;
+    };
+
+    using value_type     = T;
+    using key_compare    = Compare;
+    using iterator       = tree_iterator<false>;
+    using const_iterator = tree_iterator<true>;
+
+    explicit intrusive_bstree(const Compare& comp_in = Compare()) noexcept : comp{comp_in}
+    {
+    }
+
+    intrusive_bstree(const intrusive_bstree&) = delete;
+    intrusive_bstree& operator=(const intrusive_bstree&) = delete;
+
+    // The objects change trees; their links are not touched.
+    intrusive_bstree(intrusive_bstree&& lhs) noexcept : root{std::exchange(lhs.root, nullptr)}, count{std::exchange(lhs.count, 0)}, comp{lhs.comp}
+    {
+    }
+
+    intrusive_bstree& operator=(intrusive_bstree&& lhs) noexcept
+    {
+        if (this != &lhs) {
+
+            clear();
+
+            root  = std::exchange(lhs.root, nullptr);
+            count = std::exchange(lhs.count, 0);
+            comp  = lhs.comp;
+        }
+
+        return *this;
+    }
+
+   ~intrusive_bstree()
+    {
+        clear();
+    }
+
+    std::size_t size() const noexcept
+    {
+        return count;
+    }
+
+    bool isEmpty() const noexcept
+    {
+        return root == nullptr;
+    }
+
+    iterator begin() noexcept { return {root ? min(root) : nullptr, this}; }
+    iterator end() noexcept { return {nullptr, this}; }
+
+    const_iterator begin() const noexcept { return {root ? min(root) : nullptr, this}; }
+    const_iterator end() const noexcept { return {nullptr, this}; }
+
+    // The iterator to t, which must be in this tree, in O(1).
+    iterator iterator_to(T& t) noexcept
+    {
+        return {static_cast<hook *>(&t), this};
+    }
+
+    /*
+     * Links t unless an equivalent object is present. Returns an iterator to t or to that object, and whether t was inserted. If t is
+     * already linked, into this tree or another, nothing changes and {end(), false} is returned.
+     */
+    std::pair<iterator, bool> insert(T& t) noexcept;
+
+    /*
+     * Unlinks the object t itself, as opposed to remove(), which looks up an object by key. Returns false, changing nothing, if t is
+     * not linked into this tree. The check climbs from t to the root, so this takes O(height).
+     */
+    bool unlink(T& t) noexcept
+    {
+        hook *h = static_cast<hook *>(&t);
+
+        if (!contains_node(h))
+            return false;
+
+        unlink_node(h);
+
+        return true;
+    }
+
+    // Unlinks the object equivalent to key, if there is one, and returns the number unlinked.
+    std::size_t remove(const T& key) noexcept requires (!has_transparent_compare)
+    {
+        return remove_key(key);
+    }
+
+    template<class K> requires has_transparent_compare std::size_t remove(const K& key) noexcept
+    {
+        return remove_key(key);
+    }
+
+    // Unlinks the object at pos and returns an iterator to the next one.
+    iterator erase(iterator pos) noexcept
+    {
+        iterator next = std::next(pos);
+
+        unlink_node(pos.current);
+
+        return next;
+    }
+
+    // Unlinks every object, in O(n). The objects themselves are untouched apart from their hooks.
+    void clear() noexcept;
+
+    iterator find(const T& key) noexcept
+    {
+        auto [found, h] = find_node(key);
+
+        return {found ? h : nullptr, this};
+    }
+
+    const_iterator find(const T& key) const noexcept
+    {
+        auto [found, h] = find_node(key);
+
+        return {found ? h : nullptr, this};
+    }
+
+    template<class K> requires has_transparent_compare iterator find(const K& key) noexcept
+    {
+        auto [found, h] = find_node(key);
+
+        return {found ? h : nullptr, this};
+    }
+
+    template<class K> requires has_transparent_compare const_iterator find(const K& key) const noexcept
+    {
+        auto [found, h] = find_node(key);
+
+        return {found ? h : nullptr, this};
+    }
+
+    // The first object not less than key, and the first greater than key.
+    iterator lower_bound(const T& key) noexcept { return {lower_bound_node(key), this}; }
+    iterator upper_bound(const T& key) noexcept { return {upper_bound_node(key), this}; }
+
+    template<class K> requires has_transparent_compare iterator lower_bound(const K& key) noexcept { return {lower_bound_node(key), this}; }
+    template<class K> requires has_transparent_compare iterator upper_bound(const K& key) noexcept { return {upper_bound_node(key), this}; }
+};
+
+/*
+ * Algorithm from page 294 of Introduction to Algorithms, 3rd Edition, as bstree::link_node(): descend to the leaf below which t
+ * belongs, hang t there, and let the red-black policy restore its invariants.
+ */
+template<class T, class Compare, class Balance, class Tag>
+std::pair<typename intrusive_bstree<T, Compare, Balance, Tag>::iterator, bool> intrusive_bstree<T, Compare, Balance, Tag>::insert(T& t) noexcept
+{
+  if (static_cast<hook&>(t).is_linked())
+      return {end(), false};
+
+  auto [found, parent] = find_node(t);
+
+  if (found)
+      return {iterator{parent, this}, false};
+
+  hook *z = static_cast<hook *>(&t);
+
+  z->left = z->right = nullptr;
+  z->parent = parent;
+  z->color = is_red_black ? Color::red : Color::black;
+
+  if (!parent)
+      root = z;
+  else if (comp(t, object(parent)))
+      parent->left = z;
+  else
+      parent->right = z;
+
+  ++count;
+
+  if constexpr (is_red_black)
+      insert_fixup(z);
+
+  return {iterator{z, this}, true};
+}
+
+// Left rotation from page 313 of Introduction to Algorithms, 3rd Edition: x's right child y takes x's place.
+template<class T, class Compare, class Balance, class Tag> void intrusive_bstree<T, Compare, Balance, Tag>::rotate_left(hook *x) noexcept
+{
+  hook *y = x->right;
+
+  x->right = y->left;
+
+  if (y->left)
+      y->left->parent = x;
+
+  owner(x) = y;
+  y->parent = x->parent;
+
+  y->left = x;
+  x->parent = y;
+}
+
+// Mirror image of rotate_left().
+template<class T, class Compare, class Balance, class Tag> void intrusive_bstree<T, Compare, Balance, Tag>::rotate_right(hook *x) noexcept
+{
+  hook *y = x->left;
+
+  x->left = y->right;
+
+  if (y->right)
+      y->right->parent = x;
+
+  owner(x) = y;
+  y->parent = x->parent;
+
+  y->right = x;
+  x->parent = y;
+}
+
+// RB-INSERT-FIXUP from page 316 of Introduction to Algorithms, 3rd Edition. See bstree::insert_fixup().
+template<class T, class Compare, class Balance, class Tag> void intrusive_bstree<T, Compare, Balance, Tag>::insert_fixup(hook *z) noexcept
+{
+  while (is_red(z->parent)) {
+
+     hook *p = z->parent;
+     hook *g = p->parent; // p is red, so it is not the root, and g is not nullptr.
+
+     if (p == g->left) {
+
+         hook *uncle = g->right;
+
+         if (is_red(uncle)) {        // case 1
+
+             p->color = Color::black;
+             uncle->color = Color::black;
+             g->color = Color::red;
+             z = g;
+
+         } else {
+
+             if (z == p->right) {    // case 2: turned into case 3
+
+                 z = p;
+                 rotate_left(z);
+                 p = z->parent;
+             }
+
+             p->color = Color::black; // case 3
+             g->color = Color::red;
+             rotate_right(g);
+         }
+
+     } else { // Same as above with left and right exchanged.
+
+         hook *uncle = g->left;
+
+         if (is_red(uncle)) {
+
+             p->color = Color::black;
+             uncle->color = Color::black;
+             g->color = Color::red;
+             z = g;
+
+         } else {
+
+             if (z == p->left) {
+
+                 z = p;
+                 rotate_right(z);
+                 p = z->parent;
+             }
+
+             p->color = Color::black;
+             g->color = Color::red;
+             rotate_left(g);
+         }
+     }
+  }
+
+  root->color = Color::black;
+}
+
+// TRANSPLANT from page 296 of Introduction to Algorithms, 3rd Edition: v takes u's place as a child of u's parent.
+template<class T, class Compare, class Balance, class Tag> void intrusive_bstree<T, Compare, Balance, Tag>::transplant(hook *u, hook *v) noexcept
+{
+  owner(u) = v;
+
+  if (v)
+      v->parent = u->parent;
+}
+
+/*
+ * tree-delete(z) from page 298 of Introduction to Algorithms, 3rd Edition, with the red-black bookkeeping of RB-DELETE on page 324,
+ * exactly as bstree::unlink(): z is detached by relinking, never by copying its successor into it, so no other object moves.
+ */
+template<class T, class Compare, class Balance, class Tag> void intrusive_bstree<T, Compare, Balance, Tag>::unlink_node(hook *z) noexcept
+{
+  Color removed_color = z->color;
+
+  hook *x;
+  hook *x_parent;
+
+  if (!z->left) {                     // case 1
+
+      x = z->right;
+      x_parent = z->parent;
+      transplant(z, z->right);
+
+  } else if (!z->right) {             // case 2
+
+      x = z->left;
+      x_parent = z->parent;
+      transplant(z, z->left);
+
+  } else {                            // case 3
+
+      hook *y = min(z->right);
+
+      removed_color = y->color;
+      x = y->right;
+
+      if (y->parent == z) {           // case 3a
+
+          x_parent = y;
+
+      } else {                        // case 3b
+
+          x_parent = y->parent;
+          transplant(y, y->right);
+
+          y->right = z->right;
+          y->right->parent = y;
+      }
+
+      transplant(z, y);
+
+      y->left = z->left;
+      y->left->parent = y;
+      y->color = z->color;
+  }
+
+  z->left = z->right = z->parent = nullptr;
+  z->color = Color::unlinked;
+
+  --count;
+
+  if constexpr (is_red_black) {
+
+      if (removed_color == Color::black)
+          remove_fixup(x, x_parent);
+  }
+}
+
+// RB-DELETE-FIXUP from page 326 of Introduction to Algorithms, 3rd Edition. See bstree::remove_fixup().
+template<class T, class Compare, class Balance, class Tag> void intrusive_bstree<T, Compare, Balance, Tag>::remove_fixup(hook *x, hook *x_parent) noexcept
+{
+  while (x != root && is_black(x)) {
+
+     if (x == x_parent->left) {
+
+         hook *w = x_parent->right; // Since x is doubly black, its sibling w cannot be nullptr.
+
+         if (is_red(w)) {                                   // case 1
+
+             w->color = Color::black;
+             x_parent->color = Color::red;
+             rotate_left(x_parent);
+             w = x_parent->right;
+         }
+
+         if (is_black(w->left) && is_black(w->right)) {     // case 2
+
+             w->color = Color::red;
+             x = x_parent;
+             x_parent = x->parent;
+
+         } else {
+
+             if (is_black(w->right)) {                      // case 3
+
+                 w->left->color = Color::black;
+                 w->color = Color::red;
+                 rotate_right(w);
+                 w = x_parent->right;
+             }
+
+             w->color = x_parent->color;                    // case 4
+             x_parent->color = Color::black;
+             w->right->color = Color::black;
+             rotate_left(x_parent);
+             x = root;
+         }
+
+     } else { // Same as above with left and right exchanged.
+
+         hook *w = x_parent->left;
+
+         if (is_red(w)) {
+
+             w->color = Color::black;
+             x_parent->color = Color::red;
+             rotate_right(x_parent);
+             w = x_parent->left;
+         }
+
+         if (is_black(w->right) && is_black(w->left)) {
+
+             w->color = Color::red;
+             x = x_parent;
+             x_parent = x->parent;
+
+         } else {
+
+             if (is_black(w->left)) {
+
+                 w->right->color = Color::black;
+                 w->color = Color::red;
+                 rotate_left(w);
+                 w = x_parent->left;
+             }
+
+             w->color = x_parent->color;
+             x_parent->color = Color::black;
+             w->left->color = Color::black;
+             rotate_right(x_parent);
+             x = root;
+         }
+     }
+  }
+
+  if (x)
+      x->color = Color::black;
+}
+
+// An iterative post-order walk, as bstree's destruction: a node is reset once both of its subtrees are done.
+template<class T, class Compare, class Balance, class Tag> void intrusive_bstree<T, Compare, Balance, Tag>::clear() noexcept
+{
+  hook *current = root;
+
+  while (current) {
+
+      if (current->left) {
+
+          current = current->left;
+
+      } else if (current->right) {
+
+          current = current->right;
+
+      } else {
+
+          hook *parent = current->parent;
+
+          if (parent)
+              (current == parent->left ? parent->left : parent->right) = nullptr;
+
+          current->parent = nullptr;
+          current->color = Color::unlinked;
+
+          current = parent;
+      }
+  }
+
+  root = nullptr;
+  count = 0;
+}
+#endif
@@ -0,0 +1,461 @@
+#ifndef persistent_bst_h_6630917245
+#define persistent_bst_h_6630917245
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/*
+ * A persistent (copy-on-write) search tree. snapshot() returns, in O(1), a tree that shares every node with this one, and writes to
+ * either tree afterwards copy only the nodes on the path they change, O(log n) of them, leaving the nodes the other tree sees
+ * untouched. bstree cannot work this way: its nodes have parent pointers and unique owners, so a node cannot be shared by two trees.
+ *
+ * Nodes are reference counted with std::shared_ptr. A write modifies a node in place when this tree is its only owner, and replaces
+ * it by a modified copy otherwise, so a tree that is never snapshotted pays no copying at all. The tree is an AVL tree, which keeps
+ * the paths, and so the copies, short: the height is below 1.44 log2(n + 2).
+ *
+ * Because shared nodes are never modified and the reference counts are atomic, different persistent_bstree objects may be used by
+ * different threads at once, e.g. readers holding snapshots while a writer updates the tree they were taken from. A single object
+ * is not thread safe.
+ */
+template<class Key, class Value, class Compare = std::less<Key>> class persistent_bstree {
+
+     static constexpr bool has_transparent_compare = requires { typename Compare::is_transparent; };
+
+     struct Node;
+
+     using node_ptr = std::shared_ptr<Node>;
+
+     struct Node {
+
+         Key key;
+         Value value;
+
+         node_ptr left;
+         node_ptr right;
+
+         int height; // of the subtree rooted here; a leaf has height 1
+
+         template<class K, class V> Node(K&& key_in, V&& value_in) : key(std::forward<K>(key_in)), value(std::forward<V>(value_in)),
+             left{nullptr}, right{nullptr}, height{1}
+         {
+         }
+
+         Node(const Node&) = default;
+     };
+
+     node_ptr root;
+
+     std::size_t count;
+
+     [[no_unique_address]] Compare comp;
+
+     template<class K1, class K2> bool equivalent(const K1& a, const K2& b) const noexcept
+     {
+        return !comp(a, b) && !comp(b, a);
+     }
+
+     static int height(const node_ptr& pnode) noexcept
+     {
+        return pnode ? pnode->height : 0;
+     }
+
+     static void update_height(Node *pnode) noexcept
+     {
+        pnode->height = 1 + std::max(height(pnode->left), height(pnode->right));
+     }
+
+     /*
+      * Returns pnode as a node this tree may modify. If another tree (or snapshot) also owns it, it is replaced by a copy first; the
+      * copy shares the children. A use_count() of 1 cannot go up behind our back, since only an owner can make another owner, and the
+      * fence orders our writes after the reads of any owner that just let go.
+      */
+     static Node *own(node_ptr& pnode)
+     {
+        if (pnode.use_count() != 1)
+            pnode = std::make_shared<Node>(*pnode);
+        else
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+        return pnode.get();
+     }
+
+     static void rotate_left(node_ptr& pnode);
+     static void rotate_right(node_ptr& pnode);
+     static void rebalance(node_ptr& pnode);
+
+     template<class K, class M> bool insert_or_assign(node_ptr& pnode, K&& key, M&& obj);
+
+     template<class K> bool remove(node_ptr& pnode, const K& key);
+
+     static node_ptr take_min(node_ptr& pnode);
+
+     template<class K> const Node *find_node(const K& key) const noexcept
+     {
+        const Node *current = root.get();
+
+        while (current && !equivalent(current->key, key))
+            current = comp(key, current->key) ? current->left.get() : current->right.get();
+
+        return current;
+     }
+
+     // The node with the greatest key not greater than key (floor) or the least key not less than key (ceiling), or nullptr.
+     template<class K> const Node *bound_node(const K& key, bool floor) const noexcept
+     {
+        const Node *current = root.get();
+        const Node *bound = nullptr;
+
+        while (current) {
+
+            if (equivalent(current->key, key))
+                return current;
+
+            bool go_left = comp(key, current->key);
+
+            if (go_left != floor)
+                bound = current;
+
+            current = go_left ? current->left.get() : current->right.get();
+        }
+
+        return bound;
+     }
+
+     template<class K> Key floor_key(const K& key) const
+     {
+        if (isEmpty())
+            throw std::logic_error("floor() called with empty tree");
+
+        const Node *pnode = bound_node(key, true);
+
+        if (!pnode)
+            throw std::logic_error("argument to floor() is too small");
+
+        return pnode->key;
+     }
+
+     template<class K> Key ceiling_key(const K& key) const
+     {
+        if (isEmpty())
+            throw std::logic_error("ceiling() called with empty tree");
+
+        const Node *pnode = bound_node(key, false);
+
+        if (!pnode)
+            throw std::logic_error("argument to ceiling() is too large");
+
+        return pnode->key;
+     }
+
+  public:
+
+     using key_type    = Key;
+     using mapped_type = Value;
+     using key_compare = Compare;
+
+     explicit persistent_bstree(const Compare& comp_in = Compare()) : root{nullptr}, count{0}, comp{comp_in}
+     {
+     }
+
+     // Copies share all nodes, so copying is O(1), like snapshot().
+     persistent_bstree(const persistent_bstree&) = default;
+     persistent_bstree& operator=(const persistent_bstree&) = default;
+
+     persistent_bstree(persistent_bstree&& lhs) noexcept : root{std::move(lhs.root)}, count{lhs.count}, comp{lhs.comp}
+     {
+        lhs.count = 0;
+     }
+
+     persistent_bstree& operator=(persistent_bstree&& lhs) noexcept
+     {
+        root = std::move(lhs.root);
+        count = lhs.count;
+        comp = lhs.comp;
+        lhs.count = 0;
+        return *this;
+     }
+
+     // Returns an immutable view of the current version in O(1). Later writes to this tree do not affect it, nor it this tree.
+     persistent_bstree snapshot() const
+     {
+        return *this;
+     }
+
+     std::size_t size() const noexcept
+     {
+        return count;
+     }
+
+     bool isEmpty() const noexcept
+     {
+        return root == nullptr;
+     }
+
+     int height() const noexcept
+     {
+        return height(root) - 1; // edges on the longest path, as in bstree: -1 if empty
+     }
+
+     // Returns true if key was inserted, false if its value was assigned.
+     template<class K, class M> bool insert_or_assign(K&& key, M&& obj)
+     {
+        bool inserted = insert_or_assign(root, std::forward<K>(key), std::forward<M>(obj));
+
+        count += inserted;
+
+        return inserted;
+     }
+
+     bool insert(const Key& key, const Value& value)
+     {
+        return insert_or_assign(key, value);
+     }
+
+     bool remove(const Key& key)
+     {
+        bool removed = remove(root, key);
+
+        count -= removed;
+
+        return removed;
+     }
+
+     template<class K> requires has_transparent_compare bool remove(const K& key)
+     {
+        bool removed = remove(root, key);
+
+        count -= removed;
+
+        return removed;
+     }
+
+     bool find(const Key& key) const noexcept
+     {
+        return find_node(key) != nullptr;
+     }
+
+     template<class K> requires has_transparent_compare bool find(const K& key) const noexcept
+     {
+        return find_node(key) != nullptr;
+     }
+
+     // Returns a pointer to key's value, or nullptr. It stays valid until this tree is next written to.
+     const Value *lookup(const Key& key) const noexcept
+     {
+        const Node *pnode = find_node(key);
+
+        return pnode ? &pnode->value : nullptr;
+     }
+
+     template<class K> requires has_transparent_compare const Value *lookup(const K& key) const noexcept
+     {
+        const Node *pnode = find_node(key);
+
+        return pnode ? &pnode->value : nullptr;
+     }
+
+     Key floor(const Key& key) const
+     {
+        return floor_key(key);
+     }
+
+     template<class K> requires has_transparent_compare Key floor(const K& key) const
+     {
+        return floor_key(key);
+     }
+
+     Key ceiling(const Key& key) const
+     {
+        return ceiling_key(key);
+     }
+
+     template<class K> requires has_transparent_compare Key ceiling(const K& key) const
+     {
+        return ceiling_key(key);
+     }
+
+     // Calls f(key, value) for each key in ascending order.
+     template<class Functor> void inOrderTraverse(Functor f) const
+     {
+        std::vector<const Node *> stack;
+
+        for (const Node *current = root.get(); current || !stack.empty(); ) {
+
+            for (; current; current = current->left.get())
+                stack.push_back(current);
+
+            current = stack.back();
+            stack.pop_back();
+
+            f(current->key, current->value);
+
+            current = current->right.get();
+        }
+     }
+};
+
+/*
+ * pnode's right child y takes pnode's place and pnode becomes y's left child. Both nodes change, so both are owned first.
+ */
+template<class Key, class Value, class Compare> void persistent_bstree<Key, Value, Compare>::rotate_left(node_ptr& pnode)
+{
+  Node *x = own(pnode);
+
+  node_ptr y = std::move(x->right);
+
+  own(y);
+
+  x->right = std::move(y->left);
+  update_height(x);
+
+  y->left = std::move(pnode);
+  update_height(y.get());
+
+  pnode = std::move(y);
+}
+
+template<class Key, class Value, class Compare> void persistent_bstree<Key, Value, Compare>::rotate_right(node_ptr& pnode)
+{
+  Node *x = own(pnode);
+
+  node_ptr y = std::move(x->left);
+
+  own(y);
+
+  x->left = std::move(y->right);
+  update_height(x);
+
+  y->right = std::move(pnode);
+  update_height(y.get());
+
+  pnode = std::move(y);
+}
+
+/*
+ * Restores the AVL property at pnode, whose subtrees are AVL trees whose heights differ by at most two. A single rotation fixes the
+ * left-left and right-right cases; the left-right and right-left cases first rotate the child.
+ */
+template<class Key, class Value, class Compare> void persistent_bstree<Key, Value, Compare>::rebalance(node_ptr& pnode)
+{
+  Node *p = own(pnode);
+
+  int balance = height(p->left) - height(p->right);
+
+  if (balance > 1) {
+
+      if (height(p->left->left) < height(p->left->right))
+          rotate_left(p->left);
+
+      rotate_right(pnode);
+
+  } else if (balance < -1) {
+
+      if (height(p->right->right) < height(p->right->left))
+          rotate_right(p->right);
+
+      rotate_left(pnode);
+
+  } else {
+
+      update_height(p);
+  }
+}
+
+/*
+ * Every node on the search path is owned (copied if shared) on the way down, so the new or assigned node hangs from nodes that only
+ * this tree sees. Rebalancing on the way back up then touches only owned nodes and their children.
+ */
+template<class Key, class Value, class Compare> template<class K, class M>
+bool persistent_bstree<Key, Value, Compare>::insert_or_assign(node_ptr& pnode, K&& key, M&& obj)
+{
+  if (!pnode) {
+
+      pnode = std::make_shared<Node>(std::forward<K>(key), std::forward<M>(obj));
+      return true;
+  }
+
+  if (equivalent(pnode->key, key)) {
+
+      own(pnode)->value = std::forward<M>(obj);
+      return false;
+  }
+
+  Node *p = own(pnode);
+
+  bool inserted = comp(key, p->key) ? insert_or_assign(p->left, std::forward<K>(key), std::forward<M>(obj))
+                                    : insert_or_assign(p->right, std::forward<K>(key), std::forward<M>(obj));
+  if (inserted)
+      rebalance(pnode);
+
+  return inserted;
+}
+
+// Detaches the node with the least key from the subtree rooted at pnode and returns it.
+template<class Key, class Value, class Compare> typename persistent_bstree<Key, Value, Compare>::node_ptr persistent_bstree<Key, Value, Compare>::take_min(node_ptr& pnode)
+{
+  if (!pnode->left) {
+
+      node_ptr min = pnode;
+
+      pnode = min->right; // min itself is not modified, so other trees sharing it are unaffected
+
+      return min;
+  }
+
+  node_ptr min = take_min(own(pnode)->left);
+
+  rebalance(pnode);
+
+  return min;
+}
+
+/*
+ * A node with two children is replaced by its successor, the least node of its right subtree, which is detached and then owned, so
+ * that it can take over the removed node's children.
+ */
+template<class Key, class Value, class Compare> template<class K> bool persistent_bstree<Key, Value, Compare>::remove(node_ptr& pnode, const K& key)
+{
+  if (!pnode)
+      return false;
+
+  if (equivalent(pnode->key, key)) {
+
+      if (!pnode->left || !pnode->right) {
+
+          node_ptr child = pnode->left ? pnode->left : pnode->right;
+
+          pnode = std::move(child);
+          return true;
+      }
+
+      Node *p = own(pnode);
+
+      node_ptr successor = take_min(p->right);
+
+      Node *s = own(successor);
+
+      s->left = std::move(p->left);
+      s->right = std::move(p->right);
+
+      pnode = std::move(successor);
+
+      rebalance(pnode);
+      return true;
+  }
+
+  Node *p = own(pnode);
+
+  bool removed = comp(key, p->key) ? remove(p->left, key) : remove(p->right, key);
+
+  if (removed)
+      rebalance(pnode);
+
+  return removed;
+}
+#endif
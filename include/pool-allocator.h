@@ -0,0 +1,251 @@
+#ifndef pool_allocator_h_3498273492
+#define pool_allocator_h_3498273492
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <vector>
+#include <algorithm>
+
+/*
+ * node_pool hands out fixed-size blocks carved from large slabs. Freed blocks are pushed onto an intrusive free list, so
+ * allocate() and deallocate() are O(1) and blocks allocated one after another are contiguous in memory. The block size is fixed
+ * by the first call to allocate(), which lets allocators rebound to different types share one pool: requests of any other size
+ * are forwarded to ::operator new. release() returns every slab at once, without visiting the individual blocks.
+ *
+ * adopt() lets a pool take over blocks that another pool handed out, so that a node can move between containers with different
+ * pools without being copied. The pools stay separate: each keeps its own free list, and an adopted block is freed onto the free
+ * list of the pool that frees it. The slabs are reference counted instead, so a slab outlives its pool while another pool that
+ * adopted from it is alive and has not been released.
+ *
+ * node_pool is not thread safe, but different pools may be used by different threads at once, also after one adopted from the other.
+ */
+class node_pool {
+
+     struct free_block {
+         free_block *next;
+     };
+
+     // The slabs of one pool. They are freed when the last pool holding the list lets go of it, so a list holds no other lists.
+     struct slab_list {
+
+         std::size_t align;
+
+         std::vector<std::pair<void *, std::size_t>> slabs; // Each slab with its size in bytes.
+
+         explicit slab_list(std::size_t align_in) noexcept : align{align_in}
+         {
+         }
+
+         slab_list(const slab_list&) = delete;
+         slab_list& operator=(const slab_list&) = delete;
+
+        ~slab_list() noexcept
+         {
+            for (auto& [slab, bytes] : slabs)
+                ::operator delete(slab, bytes, std::align_val_t{align});
+         }
+     };
+
+     std::size_t block_size;
+     std::size_t block_align;
+     std::size_t blocks_per_slab;
+
+     free_block *free_list;
+
+     char *cursor; // Unused portion of the most recent slab.
+     char *end;
+
+     std::shared_ptr<slab_list> slabs; // Created by the first add_slab().
+
+     std::vector<std::shared_ptr<slab_list>> adopted; // Other pools' slabs, which blocks handed to adopt() may live in.
+
+     void add_slab()
+     {
+        std::size_t bytes = block_size * blocks_per_slab;
+
+        if (!slabs)
+            slabs = std::make_shared<slab_list>(block_align);
+
+        slabs->slabs.reserve(slabs->slabs.size() + 1);
+
+        void *slab = ::operator new(bytes, std::align_val_t{block_align});
+
+        slabs->slabs.emplace_back(slab, bytes);
+
+        cursor = static_cast<char *>(slab);
+        end = cursor + bytes;
+
+        blocks_per_slab = std::min<std::size_t>(blocks_per_slab * 2, 64 * 1024); // Grow geometrically up to a limit.
+     }
+
+  public:
+
+     explicit node_pool(std::size_t blocks_per_slab_in = 64) noexcept : block_size{0}, block_align{0}, blocks_per_slab{blocks_per_slab_in},
+        free_list{nullptr}, cursor{nullptr}, end{nullptr}
+     {
+     }
+
+     node_pool(const node_pool&) = delete;
+     node_pool& operator=(const node_pool&) = delete;
+
+    ~node_pool() noexcept
+     {
+        release();
+     }
+
+     // Returns true if blocks of the given size and alignment come from the slabs.
+     bool serves(std::size_t size, std::size_t align) noexcept
+     {
+        align = std::max(align, alignof(free_block));
+        size = (std::max(size, sizeof(free_block)) + align - 1) / align * align;
+
+        if (block_size == 0) { // The first request fixes the block size.
+
+            block_size = size;
+            block_align = align;
+        }
+
+        return size == block_size && align == block_align;
+     }
+
+     void *allocate()
+     {
+        if (free_list) {
+
+            free_block *block = free_list;
+            free_list = block->next;
+            return block;
+        }
+
+        if (cursor == end)
+            add_slab();
+
+        void *block = cursor;
+        cursor += block_size;
+        return block;
+     }
+
+     void deallocate(void *p) noexcept
+     {
+        free_block *block = static_cast<free_block *>(p);
+        block->next = free_list;
+        free_list = block;
+     }
+
+     /*
+      * Lets blocks that donor allocated, or adopted, so far be deallocated into this pool. Afterwards this pool keeps donor's slabs
+      * until it is released, even if donor is released or destroyed first. Returns false, adopting nothing, unless both pools carve
+      * blocks of the same size and alignment. O(number of pools donor adopted from).
+      */
+     bool adopt(const node_pool& donor)
+     {
+        if (&donor == this)
+            return true;
+
+        if (donor.block_size == 0 || !serves(donor.block_size, donor.block_align))
+            return false;
+
+        auto hold = [this](const std::shared_ptr<slab_list>& list) {
+           if (list && list != slabs && std::find(adopted.begin(), adopted.end(), list) == adopted.end())
+               adopted.push_back(list);
+        };
+
+        adopted.reserve(adopted.size() + donor.adopted.size() + 1);
+
+        hold(donor.slabs);
+
+        for (const auto& list : donor.adopted)
+            hold(list);
+
+        return true;
+     }
+
+     /*
+      * Frees all slabs, unless a pool that adopted blocks from this one still holds them. Any object still living in a block must have
+      * been destroyed (or be trivially destructible), and that includes blocks this pool adopted.
+      */
+     void release() noexcept
+     {
+        slabs.reset();
+        adopted.clear();
+        free_list = nullptr;
+        cursor = end = nullptr;
+     }
+};
+
+/*
+ * A standard allocator backed by a node_pool. Copies, including rebound copies, share the same pool and compare equal. A default
+ * constructed pool_allocator creates a new pool. Single-object allocations come from the pool; array allocations go to ::operator new.
+ *
+ * A copied container gets a new pool from select_on_container_copy_construction(): node_pool is not thread safe, so two containers
+ * sharing one could not be used from different threads, and their nodes would be interleaved in the same slabs. Containers with
+ * different pools can still hand nodes to each other without copying them, through adopt().
+ */
+template<class T> class pool_allocator {
+
+     template<class U> friend class pool_allocator;
+
+     std::shared_ptr<node_pool> pool;
+
+  public:
+
+     using value_type = T;
+
+     using propagate_on_container_move_assignment = std::true_type;
+     using propagate_on_container_swap            = std::true_type;
+
+     pool_allocator() : pool{std::make_shared<node_pool>()} {}
+
+     template<class U> pool_allocator(const pool_allocator<U>& lhs) noexcept : pool{lhs.pool} {}
+
+     pool_allocator select_on_container_copy_construction() const
+     {
+        return pool_allocator();
+     }
+
+     T *allocate(std::size_t n)
+     {
+        if (n == 1 && pool->serves(sizeof(T), alignof(T)))
+            return static_cast<T *>(pool->allocate());
+
+        return std::allocator<T>{}.allocate(n);
+     }
+
+     void deallocate(T *p, std::size_t n) noexcept
+     {
+        if (n == 1 && pool->serves(sizeof(T), alignof(T)))
+            pool->deallocate(p);
+        else
+            std::allocator<T>{}.deallocate(p, n);
+     }
+
+     /*
+      * Lets this allocator deallocate the objects that lhs has allocated so far, as if it had allocated them itself; see
+      * node_pool::adopt(). Returns false, adopting nothing, unless objects of type T come from both pools.
+      */
+     template<class U> bool adopt(const pool_allocator<U>& lhs)
+     {
+        if (pool == lhs.pool)
+            return true;
+
+        return pool->serves(sizeof(T), alignof(T)) && lhs.pool->serves(sizeof(T), alignof(T)) && pool->adopt(*lhs.pool);
+     }
+
+     // True if no other allocator shares this allocator's pool, so release() cannot free memory that someone else still uses.
+     bool owns_pool() const noexcept
+     {
+        return pool.use_count() == 1;
+     }
+
+     void release() noexcept
+     {
+        pool->release();
+     }
+
+     template<class U> bool operator==(const pool_allocator<U>& lhs) const noexcept
+     {
+        return pool == lhs.pool;
+     }
+};
+#endif
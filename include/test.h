@@ -2,23 +2,50 @@
 #define test_h_
 
 #include <iostream>
+#include <cstddef>
 
 struct Test {
 
    int i;
 
+   // Number of copy and move operations (constructions plus assignments) performed on all Test objects. Call reset_counts() before 
+   // the code being measured.
+   static inline std::size_t copies = 0;
+   static inline std::size_t moves  = 0;
+
+   static void reset_counts() noexcept
+   {
+      copies = moves = 0;
+   }
+
    bool operator!=(const Test& lhs) const { return !(operator==(lhs)); }
 
    Test() : i{0} {}
    Test(int in) : i{in} {}
 
-   Test(const Test& ) = default;
+   Test(const Test& lhs) : i{lhs.i}
+   {
+      ++copies;
+   }
 
-   Test(Test&& ) = default;
+   Test(Test&& lhs) noexcept : i{lhs.i}
+   {
+      ++moves;
+   }
 
-   Test& operator=(const Test&) = default;
+   Test& operator=(const Test& lhs)
+   {
+      i = lhs.i;
+      ++copies;
+      return *this;
+   }
    
-   Test& operator=(Test&&) = default;
+   Test& operator=(Test&& lhs) noexcept
+   {
+      i = lhs.i;
+      ++moves;
+      return *this;
+   }
    
    bool operator<(const Test& t) const noexcept
    {
@@ -0,0 +1,252 @@
+#ifndef thread_pool_h_4182630597
+#define thread_pool_h_4182630597
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/*
+ * A fork-join thread pool with work stealing. Each worker has its own deque of tasks: it pushes the tasks it spawns and pops its next
+ * task at the back, so it keeps working on what it just split off while that is still in its cache, and an idle worker steals from
+ * the front of another's deque, taking the oldest, and so usually the largest, piece of outstanding work. Tasks submitted from
+ * outside the pool are spread over the deques round-robin.
+ *
+ * Tasks are grouped with a task_group, whose wait() does not block while tasks are queued: the waiting thread runs queued tasks
+ * itself, so a pool of any size, even one worker, makes progress when its tasks wait on nested groups.
+ */
+class work_stealing_pool {
+
+     struct alignas(64) worker_queue {
+
+         std::mutex m;
+         std::deque<std::function<void()>> tasks;
+     };
+
+     std::vector<std::unique_ptr<worker_queue>> queues; // One per worker.
+
+     std::vector<std::thread> workers;
+
+     std::atomic<std::size_t> queued{0};        // Tasks in all queues; idle workers sleep while it is zero.
+     std::atomic<unsigned> next_queue{0};       // Round-robin position for tasks submitted from outside the pool.
+     std::atomic<bool> stopping{false};
+
+     std::mutex sleep_mutex;
+     std::condition_variable wake;
+
+     static inline thread_local const work_stealing_pool *current_pool = nullptr;
+     static inline thread_local unsigned current_index = 0;
+
+     // The calling worker's queue, or queues.size() if the caller is not one of this pool's workers.
+     unsigned local_index() const noexcept
+     {
+        return current_pool == this ? current_index : static_cast<unsigned>(queues.size());
+     }
+
+     void push(std::function<void()> task)
+     {
+        unsigned index = local_index();
+
+        if (index == queues.size())
+            index = next_queue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+
+        {
+           std::lock_guard lock{queues[index]->m};
+           queues[index]->tasks.push_back(std::move(task));
+        }
+
+        queued.fetch_add(1);
+
+        { std::lock_guard lock{sleep_mutex}; } // A worker between checking queued and sleeping holds sleep_mutex, so it cannot miss this.
+
+        wake.notify_one();
+     }
+
+     // Runs one task, from the back of queue home if it has one, else stolen from the front of another queue.
+     bool try_run_one(unsigned home)
+     {
+        std::function<void()> task;
+
+        if (home < queues.size()) {
+
+            std::lock_guard lock{queues[home]->m};
+
+            if (!queues[home]->tasks.empty()) {
+
+                task = std::move(queues[home]->tasks.back());
+                queues[home]->tasks.pop_back();
+            }
+        }
+
+        for (std::size_t i = 1; !task && i <= queues.size(); ++i) {
+
+            worker_queue& victim = *queues[(home + i) % queues.size()];
+
+            std::lock_guard lock{victim.m};
+
+            if (!victim.tasks.empty()) {
+
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+            }
+        }
+
+        if (!task)
+            return false;
+
+        queued.fetch_sub(1);
+
+        task();
+
+        return true;
+     }
+
+     void work(unsigned index)
+     {
+        current_pool = this;
+        current_index = index;
+
+        while (true) {
+
+            if (try_run_one(index))
+                continue;
+
+            std::unique_lock lock{sleep_mutex};
+
+            wake.wait(lock, [this] { return stopping || queued > 0; });
+
+            if (stopping && queued == 0)
+                return;
+        }
+     }
+
+  public:
+
+     explicit work_stealing_pool(unsigned thread_count = std::max(1u, std::thread::hardware_concurrency()))
+     {
+        thread_count = std::max(1u, thread_count);
+
+        for (unsigned i = 0; i < thread_count; ++i)
+            queues.push_back(std::make_unique<worker_queue>());
+
+        for (unsigned i = 0; i < thread_count; ++i)
+            workers.emplace_back(&work_stealing_pool::work, this, i);
+     }
+
+     work_stealing_pool(const work_stealing_pool&) = delete;
+     work_stealing_pool& operator=(const work_stealing_pool&) = delete;
+
+    ~work_stealing_pool()
+     {
+        {
+           std::lock_guard lock{sleep_mutex};
+           stopping = true;
+        }
+
+        wake.notify_all();
+
+        for (auto& worker : workers)
+            worker.join();
+     }
+
+     // The process-wide pool, with one worker per hardware thread.
+     static work_stealing_pool& instance()
+     {
+        static work_stealing_pool pool;
+
+        return pool;
+     }
+
+     unsigned size() const noexcept
+     {
+        return static_cast<unsigned>(workers.size());
+     }
+
+     // Runs f on a worker without waiting for it to finish. f must not throw. Tasks still queued when the pool is destroyed are run first.
+     template<class F> void submit(F f)
+     {
+        push(std::move(f));
+     }
+
+     /*
+      * A set of tasks that can be waited for. The first exception a task throws is rethrown by wait(); the remaining tasks still run.
+      * The destructor waits too, so a group must not be destroyed by one of its own tasks.
+      */
+     class task_group {
+
+         work_stealing_pool& pool;
+
+         std::atomic<std::size_t> pending{0};
+
+         std::mutex error_mutex;
+         std::exception_ptr error;
+
+         void drain()
+         {
+            while (pending.load(std::memory_order_acquire) != 0)
+                if (!pool.try_run_one(pool.local_index()))
+                    std::this_thread::yield();
+         }
+
+       public:
+
+         explicit task_group(work_stealing_pool& pool_in = work_stealing_pool::instance()) : pool{pool_in}
+         {
+         }
+
+         task_group(const task_group&) = delete;
+         task_group& operator=(const task_group&) = delete;
+
+        ~task_group()
+         {
+            drain();
+         }
+
+         // Counts the task before queueing it, so that it cannot finish, and bring pending below zero, first. If queueing throws
+         // (std::bad_alloc), the task was never queued, and the count is taken back before the exception propagates.
+         template<class F> void run(F f)
+         {
+            pending.fetch_add(1, std::memory_order_relaxed);
+
+            try {
+                pool.push([this, f = std::move(f)]() mutable {
+                   try {
+                       f();
+
+                   } catch (...) {
+
+                       std::lock_guard lock{error_mutex};
+
+                       if (!error)
+                           error = std::current_exception();
+                   }
+
+                   pending.fetch_sub(1, std::memory_order_release); // The last access to *this.
+                });
+
+            } catch (...) {
+
+                pending.fetch_sub(1, std::memory_order_relaxed);
+                throw;
+            }
+         }
+
+         // Runs queued tasks until every task of this group has finished.
+         void wait()
+         {
+            drain();
+
+            if (error)
+                std::rethrow_exception(std::exchange(error, nullptr));
+         }
+     };
+};
+#endif
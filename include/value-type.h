@@ -126,7 +126,8 @@ template <class _Key, class _Value> struct __value_type {
         return *this;
     }
 
-    template<typename T1, typename T2> __value_type(T1&& first, T2&& second) : __cc(std::forward<T1>(first), std::forward<T2>(second))
+    template<typename T1, typename T2, class = typename std::enable_if<!__is_same_uncvref<T1, std::in_place_t>::value>::type> 
+    __value_type(T1&& first, T2&& second) : __cc(std::forward<T1>(first), std::forward<T2>(second))
     {
     } 
 
@@ -134,7 +135,12 @@ template <class _Key, class _Value> struct __value_type {
     {
     } 
 
-    explicit __value_type(std::pair<_Key, _Value>&& pr) : __cc(pr)
+    explicit __value_type(std::pair<_Key, _Value>&& pr) : __cc(std::move(pr))
+    {
+    }
+
+    // Constructs the pair in place from any arguments std::pair<const key_type, mapped_type> accepts, including piecewise_construct.
+    template<typename... Args> explicit __value_type(std::in_place_t, Args&&... args) : __cc(std::forward<Args>(args)...)
     {
     }
 
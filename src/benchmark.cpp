@@ -0,0 +1,527 @@
+#include <cstdlib>
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <cmath>
+#include <utility>
+#include <vector>
+#include <map>
+#include <string>
+#include <random>
+#include <numeric>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <type_traits>
+#include <sys/resource.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+#include "test.h"
+#include "bst.h"
+
+using namespace std;
+
+/*
+ * Benchmarks for bstree, in the style of Google Benchmark but without the dependency. For every tree type, key distribution and size
+ * it times insert_or_assign() (also hinted with the previous insert's position), find() (also on the frozen copy from freeze() and,
+ * for trivially copyable keys and values, on that copy written to a file and mapped back with frozen_bstree::map(), as well as
+ * deserialize() from that file), find_batch(), find_near() from the previous result, floor(), ceiling(), an in-order traversal and
+ * remove(), and reports ns/op, the tree's size and height after the inserts, and the peak RSS of the process while the tree was
+ * built. std::map runs the same workload as a baseline.
+ *
+ *    benchmark [--sizes=1K,10K,100K,1M] [--filter=substring]
+ *
+ * --sizes accepts K and M suffixes; 10M and 100M runs need several GiB. --filter selects the benchmarks whose name contains the
+ * substring, e.g. --filter='<int,int' or --filter=zipfian.
+ *
+ * Keys are 2, 4, 6, ..., so floor() and ceiling() can probe the odd numbers between them. String keys are the same numbers, zero
+ * padded to 20 characters (too long for the small string optimization). An unbalanced bstree fed sorted or reverse-sorted keys
+ * degenerates into a list with O(n) operations, so those runs stop at degenerate_limit keys. So do a splay tree's: it degenerates
+ * the same way, and the lookups that do not splay, find_batch() and find_near(), then pay O(n) each. --filter=zipfian compares the
+ * three policies on skewed lookups.
+ */
+
+constexpr size_t degenerate_limit = 10'000;
+
+volatile size_t sink; // Keeps the optimizer from discarding the lookups.
+
+enum class distribution { random, sorted, reverse, zipfian };
+
+const char *to_string(distribution dist)
+{
+  switch (dist) {
+     case distribution::random:  return "random";
+     case distribution::sorted:  return "sorted";
+     case distribution::reverse: return "reverse";
+     default:                    return "zipfian";
+  }
+}
+
+/*
+ * Zipfian ranks in [0, n) with skew theta, using the method of Gray et al., "Quickly Generating Billion-Record Synthetic Databases"
+ * (as in YCSB). Rank 0 is the most frequent.
+ */
+class zipfian_generator {
+
+     uint64_t n;
+     double theta, alpha, zetan, eta;
+
+     static double zeta(uint64_t n, double theta)
+     {
+        double sum = 0;
+
+        for (uint64_t i = 1; i <= n; ++i)
+            sum += 1 / pow(double(i), theta);
+
+        return sum;
+     }
+
+  public:
+
+     zipfian_generator(uint64_t n_in, double theta_in = 0.99) : n{n_in}, theta{theta_in}, alpha{1 / (1 - theta_in)},
+        zetan{zeta(n_in, theta_in)}
+     {
+        double zeta2 = 1 + pow(0.5, theta);
+
+        eta = (1 - pow(2.0 / n, 1 - theta)) / (1 - zeta2 / zetan);
+     }
+
+     template<class Generator> uint64_t operator()(Generator& g)
+     {
+        double u = uniform_real_distribution<double>{0, 1}(g);
+        double uz = u * zetan;
+
+        if (uz < 1)
+            return 0;
+
+        if (uz < 1 + pow(0.5, theta))
+            return 1;
+
+        return min<uint64_t>(n - 1, uint64_t(n * pow(eta * u - eta + 1, alpha)));
+     }
+};
+
+/*
+ * Returns n key indices in [0, n) in the order the distribution prescribes. Random and Zipfian draws differ from call to call. The
+ * Zipfian ranks are mapped through a fixed random permutation, so the popular keys are scattered over the key space.
+ */
+vector<uint64_t> make_indices(distribution dist, size_t n, mt19937_64& g)
+{
+  vector<uint64_t> indices(n);
+
+  switch (dist) {
+
+     case distribution::sorted:
+         iota(indices.begin(), indices.end(), uint64_t{0});
+         break;
+
+     case distribution::reverse:
+         iota(indices.rbegin(), indices.rend(), uint64_t{0});
+         break;
+
+     case distribution::random:
+         iota(indices.begin(), indices.end(), uint64_t{0});
+         shuffle(indices.begin(), indices.end(), g);
+         break;
+
+     case distribution::zipfian: {
+
+         static size_t cached_n = 0;
+         static vector<uint64_t> permutation;
+         static zipfian_generator *zipf = nullptr;
+
+         if (cached_n != n) { // zeta(n) is O(n), so the generator is reused for all runs of one size.
+
+             delete zipf;
+             zipf = new zipfian_generator(n);
+
+             permutation.resize(n);
+             iota(permutation.begin(), permutation.end(), uint64_t{0});
+             shuffle(permutation.begin(), permutation.end(), mt19937_64{n});
+
+             cached_n = n;
+         }
+
+         for (auto& index : indices)
+             index = permutation[(*zipf)(g)];
+     }
+  }
+
+  return indices;
+}
+
+template<class K> K make_key(uint64_t number)
+{
+  if constexpr (is_same_v<K, string>) {
+
+      char buffer[24];
+      snprintf(buffer, sizeof(buffer), "%020llu", static_cast<unsigned long long>(number));
+      return buffer;
+
+  } else {
+
+      return K(static_cast<int>(number));
+  }
+}
+
+// Key i is 2(i + 1). offset is added to the number before it becomes a key, e.g. +1 gives a probe for floor().
+template<class K> vector<K> make_keys(const vector<uint64_t>& indices, int offset)
+{
+  vector<K> keys;
+  keys.reserve(indices.size());
+
+  for (auto index : indices)
+      keys.push_back(make_key<K>(2 * (index + 1) + offset));
+
+  return keys;
+}
+
+template<class T> struct is_bstree : false_type {};
+
+template<class K, class V, class C, class B, class A> struct is_bstree<bstree<K, V, C, B, A>> : true_type {};
+
+template<class T> struct is_balanced : false_type {};
+
+template<class K, class V, class C, class A> struct is_balanced<bstree<K, V, C, red_black, A>> : true_type {};
+
+template<class K, class V, class C, class A> struct is_balanced<map<K, V, C, A>> : true_type {};
+
+/*
+ * Peak resident set size in KiB. On Linux, writing 5 to /proc/self/clear_refs resets the peak (VmHWM) to the current RSS, so the
+ * peak can be measured per benchmark. Elsewhere the process-wide maximum from getrusage() is reported.
+ */
+void reset_peak_rss()
+{
+#if defined(__GLIBC__)
+  malloc_trim(0); // Give memory freed by the previous benchmark back to the system.
+#endif
+  ofstream clear_refs{"/proc/self/clear_refs"};
+
+  if (clear_refs)
+      clear_refs << "5";
+}
+
+long peak_rss_kib()
+{
+  ifstream status{"/proc/self/status"};
+
+  for (string line; getline(status, line); )
+      if (line.compare(0, 6, "VmHWM:") == 0)
+          return stol(line.substr(6));
+
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+
+  return usage.ru_maxrss;
+}
+
+template<class F> double ns_per_op(size_t ops, F f)
+{
+  auto start = chrono::steady_clock::now();
+
+  f();
+
+  auto stop = chrono::steady_clock::now();
+
+  return chrono::duration<double, nano>(stop - start).count() / max<size_t>(ops, 1);
+}
+
+void report(const string& name, double ns)
+{
+  cout << left << setw(62) << name << right << setw(12) << fixed << setprecision(1) << ns << " ns/op\n" << flush;
+}
+
+void report(const string& name, double ns, size_t size, int height, long rss_kib)
+{
+  cout << left << setw(62) << name << right << setw(12) << fixed << setprecision(1) << ns << " ns/op"
+       << "   size=" << size << "  height=";
+
+  if (height >= 0)
+      cout << height;
+  else
+      cout << '-';
+
+  cout << "  peak RSS=" << setprecision(1) << rss_kib / 1024.0 << " MiB\n" << flush;
+}
+
+template<class Tree> void run(const string& tree_name, distribution dist, size_t n)
+{
+  using Key   = typename Tree::key_type;
+  using Value = typename Tree::mapped_type;
+
+  string prefix = tree_name + "/" + to_string(dist) + "/";
+  string suffix = "/" + std::to_string(n);
+
+  if (!is_balanced<Tree>::value && (dist == distribution::sorted || dist == distribution::reverse) && n > degenerate_limit) {
+
+      cout << left << setw(62) << prefix + "*" + suffix << "   skipped: degenerate unbalanced tree\n";
+      return;
+  }
+
+  mt19937_64 g{n};
+
+  vector<Key> keys = make_keys<Key>(make_indices(dist, n, g), 0);
+
+  reset_peak_rss();
+
+  Tree tree;
+
+  double ns = ns_per_op(n, [&] {
+     for (size_t i = 0; i < n; ++i)
+         tree.insert_or_assign(keys[i], Value(static_cast<int>(i)));
+  });
+
+  int height = -1;
+
+  if constexpr (is_bstree<Tree>::value)
+      height = tree.height();
+
+  report(prefix + "insert" + suffix, ns, tree.size(), height, peak_rss_kib());
+
+  // The same inserts into a second tree, each hinted with the position of the one before it.
+  if constexpr (is_bstree<Tree>::value) {
+
+      Tree hinted;
+      auto hint = hinted.end();
+
+      report(prefix + "insert(hint)" + suffix, ns_per_op(n, [&] {
+         for (size_t i = 0; i < n; ++i)
+             hint = hinted.insert_or_assign(hint, keys[i], Value(static_cast<int>(i)));
+      }));
+  }
+
+  vector<uint64_t> indices = make_indices(dist, n, g);
+
+  keys = make_keys<Key>(indices, 0);
+
+  report(prefix + "find" + suffix, ns_per_op(n, [&] {
+     size_t found = 0;
+
+     for (const auto& key : keys) {
+
+         if constexpr (is_bstree<Tree>::value)
+             found += tree.find(key);
+         else
+             found += tree.find(key) != tree.end();
+     }
+
+     sink = found;
+  }));
+
+  if constexpr (is_bstree<Tree>::value) {
+
+      // The same lookups as find, in batches of 1024 as a request handler might issue them.
+      vector<Value *> values(keys.size());
+
+      report(prefix + "find_batch" + suffix, ns_per_op(n, [&] {
+         constexpr size_t batch = 1024;
+         size_t found = 0;
+
+         for (size_t i = 0; i < keys.size(); i += batch) {
+
+             size_t count = min(batch, keys.size() - i);
+
+             tree.find_batch(span<const Key>(keys.data() + i, count), span<Value *>(values.data() + i, count));
+         }
+
+         for (auto value : values)
+             found += value != nullptr;
+
+         sink = found;
+      }));
+
+      // Each lookup starts from the previous one's result; this pays off when consecutive keys are close, as in the sorted runs.
+      report(prefix + "find_near" + suffix, ns_per_op(n, [&] {
+         size_t found = 0;
+         auto finger = tree.cend();
+
+         for (const auto& key : keys) {
+
+             auto pos = tree.find_near(finger, key);
+
+             if (pos != tree.cend()) {
+
+                 finger = pos;
+                 ++found;
+             }
+         }
+
+         sink = found;
+      }));
+
+      auto frozen = tree.freeze();
+
+      report(prefix + "find(frozen)" + suffix, ns_per_op(n, [&] {
+         size_t found = 0;
+
+         for (const auto& key : keys)
+             found += frozen.find(key);
+
+         sink = found;
+      }));
+
+      // A restart: the frozen layout written to a file and then either rebuilt into a tree or mapped and searched in place.
+      if constexpr (is_trivially_copyable_v<Key> && is_trivially_copyable_v<Value>) {
+
+          string path = "benchmark-" + to_string(n) + ".frozen";
+
+          frozen.write(path.c_str());
+
+          report(prefix + "deserialize" + suffix, ns_per_op(n, [&] {
+             ifstream file(path, ios::binary);
+             sink = Tree::deserialize(file).size();
+          }));
+
+          report(prefix + "find(mapped)" + suffix, ns_per_op(n, [&] {
+             auto mapped = frozen_bstree<Key, Value, typename Tree::key_compare>::map(path.c_str());
+             size_t found = 0;
+
+             for (const auto& key : keys)
+                 found += mapped.find(key);
+
+             sink = found;
+          }));
+
+          remove(path.c_str());
+      }
+  }
+
+  // Every probe lies just above a key (for floor) or just below one (for ceiling). With Zipfian draws that key may be absent, so 
+  // the probes are clamped to the tree's range, where floor() and ceiling() do not throw.
+  Key smallest = tree.begin()->first;
+  Key largest  = prev(tree.end())->first;
+
+  keys = make_keys<Key>(indices, 1);
+
+  for (auto& key : keys)
+      key = max(key, smallest);
+
+  report(prefix + "floor" + suffix, ns_per_op(n, [&] {
+     size_t total = 0;
+
+     for (const auto& key : keys) {
+
+         if constexpr (is_bstree<Tree>::value)
+             total += tree.floor(key) < key;
+         else
+             total += prev(tree.upper_bound(key))->first < key;
+     }
+
+     sink = total;
+  }));
+
+  keys = make_keys<Key>(indices, -1);
+
+  for (auto& key : keys)
+      key = min(key, largest);
+
+  report(prefix + "ceiling" + suffix, ns_per_op(n, [&] {
+     size_t total = 0;
+
+     for (const auto& key : keys) {
+
+         if constexpr (is_bstree<Tree>::value)
+             total += key < tree.ceiling(key);
+         else
+             total += key < tree.lower_bound(key)->first;
+     }
+
+     sink = total;
+  }));
+
+  size_t size = tree.size();
+
+  report(prefix + "traverse" + suffix, ns_per_op(size, [&] {
+     size_t count = 0;
+
+     if constexpr (is_bstree<Tree>::value)
+         tree.inOrderTraverse([&count](const auto&) { ++count; });
+     else
+         for (const auto& pr : tree) { (void) pr; ++count; }
+
+     sink = count;
+  }));
+
+  keys = make_keys<Key>(make_indices(dist, n, g), 0);
+
+  report(prefix + "remove" + suffix, ns_per_op(n, [&] {
+     for (const auto& key : keys) {
+
+         if constexpr (is_bstree<Tree>::value)
+             tree.remove(key);
+         else
+             tree.erase(key);
+     }
+  }));
+}
+
+template<class Tree> void run_all(const string& tree_name, const vector<size_t>& sizes, const string& filter)
+{
+  for (auto dist : {distribution::random, distribution::sorted, distribution::reverse, distribution::zipfian})
+      for (auto n : sizes)
+          if ((tree_name + "/" + to_string(dist) + "/").find(filter) != string::npos)
+              run<Tree>(tree_name, dist, n);
+}
+
+template<class Key, class Value> void run_key_type(const string& types, const vector<size_t>& sizes, const string& filter)
+{
+  run_all<bstree<Key, Value>>("bstree<" + types + ">", sizes, filter);
+  run_all<bstree<Key, Value, less<Key>, red_black>>("bstree<" + types + ",red_black>", sizes, filter);
+  run_all<bstree<Key, Value, less<Key>, splay>>("bstree<" + types + ",splay>", sizes, filter);
+  run_all<map<Key, Value>>("std::map<" + types + ">", sizes, filter);
+}
+
+vector<size_t> parse_sizes(const string& list)
+{
+  vector<size_t> sizes;
+  istringstream istr{list};
+
+  for (string item; getline(istr, item, ','); ) {
+
+      size_t multiplier = 1;
+
+      if (!item.empty() && (item.back() == 'K' || item.back() == 'k'))
+          multiplier = 1'000;
+      else if (!item.empty() && (item.back() == 'M' || item.back() == 'm'))
+          multiplier = 1'000'000;
+
+      sizes.push_back(stoul(item) * multiplier);
+  }
+
+  return sizes;
+}
+
+int main(int argc, char** argv)
+{
+  vector<size_t> sizes = {1'000, 10'000, 100'000, 1'000'000};
+  string filter;
+
+  for (int i = 1; i < argc; ++i) {
+
+      string arg = argv[i];
+
+      if (arg.compare(0, 8, "--sizes=") == 0) {
+
+          sizes = parse_sizes(arg.substr(8));
+
+      } else if (arg.compare(0, 9, "--filter=") == 0) {
+
+          filter = arg.substr(9);
+
+      } else {
+
+          cerr << "usage: " << argv[0] << " [--sizes=1K,10K,100K,1M] [--filter=substring]\n";
+          return 1;
+      }
+  }
+
+  run_key_type<int, int>("int,int", sizes, filter);
+  run_key_type<string, int>("string,int", sizes, filter);
+  run_key_type<Test, Test>("Test,Test", sizes, filter);
+
+  return 0;
+}
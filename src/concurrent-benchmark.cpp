@@ -0,0 +1,297 @@
+#include <cstdlib>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+#include <vector>
+#include <set>
+#include <string>
+#include <random>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include "bst.h"
+#include "concurrent-bst.h"
+
+using namespace std;
+
+/*
+ * Stress test and scaling benchmark for concurrent_bstree.
+ *
+ *    concurrent-benchmark [--stress] [--threads=N] [--keys=1M] [--reads=90] [--seconds=1]
+ *
+ * --stress runs writers and readers together and checks the results (see stress()). Otherwise the benchmark prefills the trees with
+ * half of the key range, then runs 1, 2, 4, ... N threads doing a random mix of find() (--reads percent), insert_or_assign() and
+ * remove() on random keys, and reports the throughput. The baselines are a red-black bstree behind one std::mutex, the way the tree
+ * has been shared so far, and behind a std::shared_mutex that lets the finds run in parallel.
+ */
+
+struct options {
+
+   bool stress = false;
+   unsigned threads = max(1u, thread::hardware_concurrency());
+   size_t keys = 1'000'000;
+   int reads = 90;
+   double seconds = 1;
+};
+
+/*
+ * T writer threads each own the keys k with k % T == t, insert and remove them at random, and track them in a std::set. Reader
+ * threads run at the same time. The keys that are multiples of stable_stride are inserted up front and never removed, so a reader
+ * knows some answers regardless of the writers:
+ *
+ *  - find(k) is true for every stable k, and lookup(k) returns k's value, 2 * k, for every k it finds,
+ *  - floor(k) <= k and floor(k) >= the greatest stable key <= k; ceiling(k) >= k and ceiling(k) <= the least stable key >= k.
+ *
+ * At the end the tree must hold exactly the stable keys plus the union of the writers' sets, in ascending order.
+ */
+bool stress(const options& opt)
+{
+  constexpr int stable_stride = 64;
+
+  const int key_range = static_cast<int>(opt.keys);
+  const unsigned writers = max(1u, opt.threads / 2);
+  const unsigned readers = max(1u, opt.threads - writers);
+
+  concurrent_bstree<int, long> tree;
+
+  for (int k = 0; k < key_range; k += stable_stride)
+      tree.insert(k, 2L * k);
+
+  atomic<bool> stop{false};
+  atomic<size_t> failures{0};
+  vector<set<int>> owned(writers);
+  vector<thread> threads;
+
+  auto fail = [&failures](const char *what, int key) {
+     if (failures++ < 10)
+         cerr << "stress: " << what << " failed for key " << key << '\n';
+  };
+
+  for (unsigned w = 0; w < writers; ++w)
+      threads.emplace_back([&, w] {
+         mt19937 g{w};
+         uniform_int_distribution<int> pick{0, key_range / int(writers)};
+
+         while (!stop.load(memory_order_relaxed)) {
+
+             int k = pick(g) * int(writers) + int(w);
+
+             if (k % stable_stride == 0 || k >= key_range)
+                 continue;
+
+             if (g() % 2) {
+
+                 bool inserted = tree.insert_or_assign(k, 2L * k);
+
+                 if (inserted != owned[w].insert(k).second)
+                     fail("insert_or_assign", k);
+
+             } else {
+
+                 bool removed = tree.remove(k);
+
+                 if (removed != (owned[w].erase(k) == 1))
+                     fail("remove", k);
+             }
+         }
+      });
+
+  for (unsigned r = 0; r < readers; ++r)
+      threads.emplace_back([&, r] {
+         mt19937 g{1000 + r};
+         uniform_int_distribution<int> pick{0, key_range - 1};
+
+         while (!stop.load(memory_order_relaxed)) {
+
+             int k = pick(g);
+             int stable_below = k / stable_stride * stable_stride;
+             int stable_above = stable_below + (k % stable_stride ? stable_stride : 0);
+
+             if (k == stable_below && !tree.find(k))
+                 fail("find", k);
+
+             if (auto value = tree.lookup(k); value && *value != 2L * k)
+                 fail("lookup", k);
+
+             int floor = tree.floor(k);
+
+             if (floor > k || floor < stable_below)
+                 fail("floor", k);
+
+             if (stable_above < key_range) {
+
+                 int ceiling = tree.ceiling(k);
+
+                 if (ceiling < k || ceiling > stable_above)
+                     fail("ceiling", k);
+             }
+         }
+      });
+
+  this_thread::sleep_for(chrono::duration<double>(opt.seconds));
+  stop = true;
+
+  for (auto& t : threads)
+      t.join();
+
+  set<int> expected;
+
+  for (int k = 0; k < key_range; k += stable_stride)
+      expected.insert(k);
+
+  for (auto& keys : owned)
+      expected.insert(keys.begin(), keys.end());
+
+  vector<int> actual;
+
+  tree.inOrderTraverse([&actual](int key, long) { actual.push_back(key); });
+
+  if (!equal(actual.begin(), actual.end(), expected.begin(), expected.end()) || tree.size() != expected.size())
+      fail("final contents", -1);
+
+  cout << "stress: " << writers << " writers, " << readers << " readers, " << expected.size() << " keys at the end: "
+       << (failures ? "FAILED" : "passed") << '\n';
+
+  return failures == 0;
+}
+
+// Adapters giving the baselines and concurrent_bstree one interface.
+struct mutex_tree {
+
+   bstree<int, int, less<int>, red_black> tree;
+   mutex m;
+
+   bool find(int k)                { lock_guard lock{m}; return tree.find(k); }
+   void insert_or_assign(int k, int v) { lock_guard lock{m}; tree.insert_or_assign(k, v); }
+   void remove(int k)              { lock_guard lock{m}; tree.remove(k); }
+};
+
+struct shared_mutex_tree {
+
+   bstree<int, int, less<int>, red_black> tree;
+   shared_mutex m;
+
+   bool find(int k)                { shared_lock lock{m}; return tree.find(k); }
+   void insert_or_assign(int k, int v) { unique_lock lock{m}; tree.insert_or_assign(k, v); }
+   void remove(int k)              { unique_lock lock{m}; tree.remove(k); }
+};
+
+struct lock_free_reads_tree {
+
+   concurrent_bstree<int, int> tree;
+
+   bool find(int k)                { return tree.find(k); }
+   void insert_or_assign(int k, int v) { tree.insert_or_assign(k, v); }
+   void remove(int k)              { tree.remove(k); }
+};
+
+atomic<size_t> found_total; // Keeps the optimizer from discarding the finds.
+
+// Returns the throughput in millions of operations per second.
+template<class Tree> double run_mix(Tree& tree, unsigned thread_count, const options& opt)
+{
+  atomic<bool> start{false}, stop{false};
+  atomic<size_t> total{0};
+  vector<thread> threads;
+
+  for (unsigned t = 0; t < thread_count; ++t)
+      threads.emplace_back([&, t] {
+         mt19937 g{t + 1};
+         uniform_int_distribution<int> pick{0, int(opt.keys) - 1};
+         uniform_int_distribution<int> percent{0, 99};
+         size_t ops = 0, found = 0;
+
+         while (!start.load(memory_order_acquire))
+             ;
+
+         for (; !stop.load(memory_order_relaxed); ++ops) {
+
+             int k = pick(g);
+             int p = percent(g);
+
+             if (p < opt.reads)
+                 found += tree.find(k);
+             else if ((p - opt.reads) % 2 == 0)
+                 tree.insert_or_assign(k, k);
+             else
+                 tree.remove(k);
+         }
+
+         total += ops;
+         found_total += found;
+      });
+
+  auto begin = chrono::steady_clock::now();
+  start = true;
+
+  this_thread::sleep_for(chrono::duration<double>(opt.seconds));
+  stop = true;
+
+  for (auto& t : threads)
+      t.join();
+
+  double elapsed = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+  return total / elapsed / 1e6;
+}
+
+template<class Tree> void scale(const string& name, const options& opt)
+{
+  Tree tree;
+
+  mt19937 g{42};
+
+  for (size_t i = 0; i < opt.keys / 2; ++i)
+      tree.insert_or_assign(int(g() % opt.keys), 0);
+
+  for (unsigned n = 1; ; n = min(2 * n, opt.threads)) {
+
+      cout << left << setw(34) << name << " threads=" << setw(4) << n << right << fixed << setprecision(2) << setw(10)
+           << run_mix(tree, n, opt) << " Mops/s\n" << flush;
+
+      if (n == opt.threads)
+          break;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  options opt;
+
+  for (int i = 1; i < argc; ++i) {
+
+      string arg = argv[i];
+      size_t eq = arg.find('=');
+      string value = eq == string::npos ? "" : arg.substr(eq + 1);
+
+      if (arg == "--stress")
+          opt.stress = true;
+      else if (arg.compare(0, eq, "--threads") == 0)
+          opt.threads = max(1, stoi(value));
+      else if (arg.compare(0, eq, "--keys") == 0)
+          opt.keys = stoul(value) * (value.back() == 'M' ? 1'000'000 : value.back() == 'K' ? 1'000 : 1);
+      else if (arg.compare(0, eq, "--reads") == 0)
+          opt.reads = stoi(value);
+      else if (arg.compare(0, eq, "--seconds") == 0)
+          opt.seconds = stod(value);
+      else {
+          cerr << "usage: " << argv[0] << " [--stress] [--threads=N] [--keys=1M] [--reads=90] [--seconds=1]\n";
+          return 1;
+      }
+  }
+
+  if (opt.stress)
+      return stress(opt) ? 0 : 1;
+
+  cout << opt.reads << "% find, " << (100 - opt.reads) << "% insert_or_assign/remove, " << opt.keys << " keys\n";
+
+  scale<mutex_tree>("bstree<red_black> + mutex", opt);
+  scale<shared_mutex_tree>("bstree<red_black> + shared_mutex", opt);
+  scale<lock_free_reads_tree>("concurrent_bstree", opt);
+
+  return 0;
+}
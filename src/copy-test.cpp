@@ -0,0 +1,106 @@
+#include <cstdlib>
+#include <cstddef>
+#include <utility>
+#include <vector>
+#include <map>
+#include <string>
+#include <random>
+#include <thread>
+#include <iostream>
+#include "bst.h"
+
+using namespace std;
+
+/*
+ * Checks that copies of a bstree are independent containers. The source tree and each kind of copy (the copy constructor, copy
+ * assignment, clone() and set_union()) are mutated at the same time from two threads, each thread keeping a std::map of what its tree
+ * should hold, and the trees are compared with their maps at the end. The copies must not share the source's pool: node_pool is not
+ * thread safe, so sharing would corrupt the free list or, under -fsanitize=thread, report a data race.
+ *
+ *    copy-test [--ops=200K]
+ *
+ * --ops, the number of mutations per thread, accepts K and M suffixes. Exits with status 1 if a tree differs from its map.
+ */
+
+using tree_type = bstree<int, int, less<int>, red_black>;
+
+// Random insert_or_assign() and remove() calls on tree, mirrored in expected.
+void mutate(tree_type& tree, map<int, int>& expected, unsigned seed, size_t ops)
+{
+  mt19937 g{seed};
+
+  for (size_t i = 0; i < ops; ++i) {
+
+      int key = static_cast<int>(g() % 100'000);
+
+      if (g() % 3) {
+
+          tree.insert_or_assign(key, static_cast<int>(i));
+          expected[key] = static_cast<int>(i);
+
+      } else {
+
+          tree.remove(key);
+          expected.erase(key);
+      }
+  }
+}
+
+bool same(const tree_type& tree, const map<int, int>& expected)
+{
+  return tree.size() == expected.size() && equal(tree.begin(), tree.end(), expected.begin(), expected.end());
+}
+
+bool check(const string& name, tree_type& source, tree_type copy, size_t ops)
+{
+  map<int, int> source_expected(source.begin(), source.end());
+  map<int, int> copy_expected(copy.begin(), copy.end());
+
+  thread other{[&] { mutate(copy, copy_expected, 2, ops); }};
+
+  mutate(source, source_expected, 1, ops);
+
+  other.join();
+
+  bool passed = same(source, source_expected) && same(copy, copy_expected);
+
+  cout << name << ": " << (passed ? "passed" : "FAILED") << '\n';
+
+  return passed;
+}
+
+int main(int argc, char** argv)
+{
+  size_t ops = 200'000;
+
+  for (int i = 1; i < argc; ++i) {
+
+      string arg = argv[i];
+      size_t eq = arg.find('=');
+      string value = eq == string::npos ? "" : arg.substr(eq + 1);
+
+      if (arg.compare(0, eq, "--ops") == 0 && !value.empty())
+          ops = stoul(value) * (value.back() == 'M' ? 1'000'000 : value.back() == 'K' ? 1'000 : 1);
+      else {
+          cerr << "usage: " << argv[0] << " [--ops=200K]\n";
+          return 1;
+      }
+  }
+
+  tree_type source;
+
+  for (int key = 0; key < 100'000; key += 2)
+      source.insert_or_assign(key, key);
+
+  tree_type assigned;
+  assigned = source;
+
+  bool passed = true;
+
+  passed &= check("copy constructor", source, tree_type(source), ops);
+  passed &= check("copy assignment", source, assigned, ops);
+  passed &= check("clone()", source, source.clone(), ops);
+  passed &= check("set_union()", source, tree_type::set_union(source, tree_type{}), ops);
+
+  return passed ? 0 : 1;
+}
@@ -0,0 +1,139 @@
+#include <cstdlib>
+#include <cstddef>
+#include <utility>
+#include <memory>
+#include <string>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include "bst.h"
+
+using namespace std;
+
+/*
+ * Regression test for stack safety. It builds an unbalanced bstree shaped as one long chain, with every node the left child of the
+ * one above, then traverses it in order, pre-order and post-order, computes its height, copies it with the copy constructor and
+ * copy assignment, iterates over it, and destroys it. Each of these used to recurse once per level, so a chain of a few hundred
+ * thousand nodes overflowed the stack; a crash is a failure, as is any wrong count.
+ *
+ *    degenerate-test [--nodes=10M]
+ *
+ * --nodes accepts K and M suffixes; 10M nodes and their two copies need about 2 GiB. Inserting the keys in descending order would
+ * build the same chain in O(n^2), since each insertion walks it to the bottom, so the chain is grown from the top instead: joining
+ * the chain with a one-key tree whose key is greater makes that key the new root, in O(1) for the unbalanced policy.
+ */
+
+using tree_type = bstree<int, int>;
+
+template<class F> void timed(const string& name, F f)
+{
+  auto begin = chrono::steady_clock::now();
+
+  f();
+
+  cout << left << setw(28) << name << right << fixed << setprecision(1) << setw(10)
+       << chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count() << " ms\n" << flush;
+}
+
+int main(int argc, char** argv)
+{
+  size_t n = 10'000'000;
+
+  for (int i = 1; i < argc; ++i) {
+
+      string arg = argv[i];
+      size_t eq = arg.find('=');
+      string value = eq == string::npos ? "" : arg.substr(eq + 1);
+
+      if (arg.compare(0, eq, "--nodes") == 0 && !value.empty())
+          n = stoul(value) * (value.back() == 'M' ? 1'000'000 : value.back() == 'K' ? 1'000 : 1);
+      else {
+          cerr << "usage: " << argv[0] << " [--nodes=10M]\n";
+          return 1;
+      }
+  }
+
+  int failures = 0;
+
+  auto expect = [&failures](bool passed, const string& what) {
+     if (!passed) {
+         cerr << "degenerate-test: " << what << " failed\n";
+         ++failures;
+     }
+  };
+
+  auto chain = make_unique<tree_type>();
+
+  timed("build", [&] {
+     for (size_t i = 0; i < n; ++i) {
+
+         tree_type top(less<int>(), chain->get_allocator());
+
+         top.insert_or_assign(static_cast<int>(i), static_cast<int>(i));
+
+         *chain = tree_type::join(std::move(*chain), std::move(top));
+     }
+  });
+
+  expect(chain->size() == n, "size");
+
+  timed("height", [&] { expect(chain->height() == static_cast<int>(n) - 1, "height"); });
+
+  timed("inOrderTraverse", [&] {
+     size_t count = 0;
+     bool ascending = true;
+
+     chain->inOrderTraverse([&](const auto& pr) { ascending &= pr.first == static_cast<int>(count++); });
+
+     expect(count == n && ascending, "inOrderTraverse");
+  });
+
+  timed("preOrderTraverse", [&] {
+     size_t count = 0;
+     bool descending = true;
+
+     chain->preOrderTraverse([&](const auto& pr) { descending &= pr.first == static_cast<int>(n - ++count); });
+
+     expect(count == n && descending, "preOrderTraverse");
+  });
+
+  timed("postOrderTraverse", [&] {
+     size_t count = 0;
+
+     chain->postOrderTraverse([&count](const auto&) { ++count; });
+
+     expect(count == n, "postOrderTraverse");
+  });
+
+  timed("iterate", [&] {
+     size_t count = 0;
+
+     for (auto it = chain->begin(); it != chain->end(); ++it)
+         ++count;
+
+     expect(count == n, "iteration");
+  });
+
+  timed("copy constructor", [&] {
+     tree_type copy(*chain);
+
+     expect(copy.size() == n && copy.height() == static_cast<int>(n) - 1, "copy constructor");
+     expect(copy.find(0) && copy.find(static_cast<int>(n) - 1), "find in the copy");
+  });
+
+  timed("copy assignment", [&] {
+     tree_type assigned;
+
+     assigned.insert_or_assign(-1, -1);
+
+     assigned = *chain;
+
+     expect(assigned.size() == n && !assigned.find(-1), "copy assignment");
+  });
+
+  timed("destroy", [&] { chain.reset(); });
+
+  cout << "degenerate-test: " << n << " nodes: " << (failures ? "FAILED" : "passed") << '\n';
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,124 @@
+#include <cstdlib>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <random>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <iomanip>
+#include "durable-bst.h"
+
+using namespace std;
+
+/*
+ * Measures what durability costs durable_bstree: insert_or_assign() throughput when every write waits for its own sync, when writes
+ * are committed in groups and sync() is called once per batch, and when nothing waits at all; then the time to recover the tree
+ * from the log alone and from a checkpoint.
+ *
+ *    durable-benchmark [--dir=durable-benchmark.db] [--writes=100K] [--batch=1000]
+ *
+ * --writes accepts K and M suffixes. The directory is deleted before and after the run. Put it on the disk to be measured: on
+ * tmpfs a sync costs nothing.
+ */
+
+struct options {
+
+   string dir = "durable-benchmark.db";
+   size_t writes = 100'000;
+   size_t batch = 1000;
+};
+
+using tree_type = durable_bstree<uint64_t, uint64_t>;
+
+template<class F> double time_ms(F f)
+{
+  auto begin = chrono::steady_clock::now();
+
+  f();
+
+  return chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+}
+
+void report(const string& name, size_t ops, double ms)
+{
+  cout << left << setw(36) << name << right << fixed << setprecision(1) << setw(10) << ms << " ms" << setw(12)
+       << ops / ms * 1000 << " ops/s\n" << flush;
+}
+
+int main(int argc, char** argv)
+{
+  options opt;
+
+  for (int i = 1; i < argc; ++i) {
+
+      string arg = argv[i];
+      size_t eq = arg.find('=');
+      string value = eq == string::npos ? "" : arg.substr(eq + 1);
+
+      if (arg.compare(0, eq, "--dir") == 0 && !value.empty())
+          opt.dir = value;
+      else if (arg.compare(0, eq, "--writes") == 0 && !value.empty())
+          opt.writes = stoul(value) * (value.back() == 'M' ? 1'000'000 : value.back() == 'K' ? 1'000 : 1);
+      else if (arg.compare(0, eq, "--batch") == 0 && !value.empty())
+          opt.batch = max(1ul, stoul(value));
+      else {
+          cerr << "usage: " << argv[0] << " [--dir=durable-benchmark.db] [--writes=100K] [--batch=1000]\n";
+          return 1;
+      }
+  }
+
+  tree_type::options never_checkpoint;
+  never_checkpoint.checkpoint_bytes = 0;
+
+  // Writes each key once, so that the log, not the tree, decides the cost of recovery.
+  auto run = [&](const string& name, tree_type::options tree_opt, size_t writes, size_t batch) {
+
+     filesystem::remove_all(opt.dir);
+
+     tree_type tree(opt.dir, tree_opt);
+
+     mt19937_64 g{42};
+
+     double ms = time_ms([&] {
+        for (size_t i = 0; i < writes; ++i) {
+
+            tree.insert_or_assign(g(), i);
+
+            if (batch && (i + 1) % batch == 0)
+                tree.sync();
+        }
+
+        tree.sync();
+     });
+
+     report(name, writes, ms);
+  };
+
+  // A write that waits for its own sync takes a disk round trip; fewer of them keep the run short.
+  tree_type::options each = never_checkpoint;
+  each.sync_each_write = true;
+
+  run("sync each write", each, min<size_t>(opt.writes, 2000), 0);
+  run("group commit, sync() per " + to_string(opt.batch), never_checkpoint, opt.writes, opt.batch);
+  run("group commit, no waiting", never_checkpoint, opt.writes, 0);
+
+  size_t size = 0;
+
+  double ms = time_ms([&] { size = tree_type(opt.dir, never_checkpoint).size(); });
+
+  report("recover: replay the log", size, ms);
+
+  {
+     tree_type tree(opt.dir, never_checkpoint);
+     tree.checkpoint();
+  }
+
+  ms = time_ms([&] { size = tree_type(opt.dir, never_checkpoint).size(); });
+
+  report("recover: load the checkpoint", size, ms);
+
+  filesystem::remove_all(opt.dir);
+
+  return 0;
+}
@@ -0,0 +1,138 @@
+#include <cstdlib>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+#include <vector>
+#include <map>
+#include <string>
+#include <random>
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+#include "bst.h"
+#include "compact-bst.h"
+#include "intrusive-bst.h"
+
+using namespace std;
+
+/*
+ * Reports the heap bytes per entry of bstree<int, int> and the alternatives: std::map, compact_bstree with and without parent links,
+ * compact_bstree after shrink_to_fit(), and intrusive_bstree over objects kept in a vector. Each tree gets the same random keys, and
+ * its footprint is the growth of the heap in use (mallinfo2(), glibc only) while it was built, divided by its size, so allocator
+ * headers, pool slabs and vector slack all count.
+ *
+ *    memory-report [--keys=1M]
+ *
+ * --keys accepts K and M suffixes.
+ */
+
+size_t heap_in_use()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+  struct mallinfo2 info = mallinfo2();
+
+  return info.uordblks + info.hblkhd; // Small blocks plus the large ones malloc maps directly.
+#else
+  return 0;
+#endif
+}
+
+// An intrusive_bstree does not allocate, so it is measured together with the storage its objects live in.
+struct intrusive_entry : bstree_hook<> {
+
+   int key;
+   int value;
+
+   friend bool operator<(const intrusive_entry& lhs, const intrusive_entry& rhs) noexcept
+   {
+      return lhs.key < rhs.key;
+   }
+};
+
+struct intrusive_set {
+
+   vector<intrusive_entry> entries; // Declared first so that the tree unlinks the entries before they are destroyed.
+   intrusive_bstree<intrusive_entry, less<intrusive_entry>, red_black> tree;
+
+   size_t size() const noexcept
+   {
+      return tree.size();
+   }
+};
+
+template<class Tree, class Fill> void report(const string& name, const vector<int>& keys, Fill fill)
+{
+  size_t before = heap_in_use();
+
+  auto tree = make_unique<Tree>();
+
+  fill(*tree, keys);
+
+  size_t bytes = heap_in_use() - before;
+
+  cout << left << setw(44) << name << right << setw(12) << tree->size() << " entries" << fixed << setprecision(1) << setw(10)
+       << double(bytes) / tree->size() << " bytes/entry\n" << flush;
+}
+
+int main(int argc, char** argv)
+{
+  size_t n = 1'000'000;
+
+  for (int i = 1; i < argc; ++i) {
+
+      string arg = argv[i];
+      size_t eq = arg.find('=');
+      string value = eq == string::npos ? "" : arg.substr(eq + 1);
+
+      if (arg.compare(0, eq, "--keys") == 0 && !value.empty())
+          n = stoul(value) * (value.back() == 'M' ? 1'000'000 : value.back() == 'K' ? 1'000 : 1);
+      else {
+          cerr << "usage: " << argv[0] << " [--keys=1M]\n";
+          return 1;
+      }
+  }
+
+  if (heap_in_use() == 0)
+      cerr << "memory-report: mallinfo2() is unavailable; the numbers below are meaningless\n";
+
+  vector<int> keys(n);
+
+  mt19937 g{42};
+
+  for (auto& key : keys)
+      key = static_cast<int>(g() >> 1);
+
+  auto insert_all = [](auto& tree, const vector<int>& keys) {
+     for (int key : keys)
+         tree.insert_or_assign(key, key);
+  };
+
+  cout << "payload: " << sizeof(pair<int, int>) << " bytes/entry\n";
+
+  report<bstree<int, int>>("bstree<int,int>", keys, insert_all);
+  report<bstree<int, int, less<int>, red_black>>("bstree<int,int,red_black>", keys, insert_all);
+  report<bstree<int, int, less<int>, red_black, allocator<pair<const int, int>>>>("bstree<int,int,red_black,std::allocator>", keys, insert_all);
+  report<map<int, int>>("std::map<int,int>", keys, insert_all);
+  report<compact_bstree<int, int, less<int>, true>>("compact_bstree<int,int,ParentLinks>", keys, insert_all);
+  report<compact_bstree<int, int>>("compact_bstree<int,int>", keys, insert_all);
+
+  report<compact_bstree<int, int>>("compact_bstree<int,int> + shrink_to_fit()", keys, [&](auto& tree, const vector<int>& keys) {
+     insert_all(tree, keys);
+     tree.shrink_to_fit();
+  });
+
+  report<intrusive_set>("intrusive_bstree<red_black> + vector storage", keys, [](auto& set, const vector<int>& keys) {
+     set.entries.resize(keys.size());
+
+     for (size_t i = 0; i < keys.size(); ++i) {
+
+         set.entries[i].key = set.entries[i].value = keys[i];
+         set.tree.insert(set.entries[i]);
+     }
+  });
+
+  return 0;
+}
@@ -0,0 +1,83 @@
+#include <cstdlib>
+#include <cstddef>
+#include <utility>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include "test.h"
+#include "bst.h"
+
+using namespace std;
+
+/*
+ * Counts the copies and moves of keys and values made by each of bstree's insertion methods, using Test's counters, and times
+ * inserting large values by const reference versus by rvalue. The forwarding methods should report no copies at all.
+ */
+
+constexpr int n = 10000;
+
+template<class Insert> void count(const string& name, Insert insert)
+{
+  bstree<Test, Test> tree;
+
+  Test::reset_counts();
+
+  for (int i = 0; i < n; ++i)
+      insert(tree, i);
+
+  cout << left << setw(44) << name << " copies/insert = " << setw(6) << double(Test::copies) / n
+       << " moves/insert = " << double(Test::moves) / n << '\n';
+}
+
+template<class Insert> double time_inserts(Insert insert)
+{
+  bstree<int, vector<char>> tree;
+
+  // Built before the clock starts, so that only the insertions are timed, not the allocation and filling of the buffers.
+  vector<vector<char>> buffers(n, vector<char>(4096, 'x'));
+
+  auto start = chrono::steady_clock::now();
+
+  for (int i = 0; i < n; ++i)
+      insert(tree, i * 7919 % n, buffers[i]); // keys in scrambled order
+
+  auto stop = chrono::steady_clock::now();
+
+  return chrono::duration<double, nano>(stop - start).count() / n;
+}
+
+int main()
+{
+  // Keys and values are temporaries unless noted; the Test{i} temporaries themselves are neither copies nor moves.
+  count("insert(key, value) (legacy, const&)", [](auto& tree, int i) { tree.insert(Test{i}, Test{i}); });
+
+  count("insert_or_assign(Key&&, M&&)", [](auto& tree, int i) { tree.insert_or_assign(Test{i}, Test{i}); });
+
+  count("try_emplace(Key&&, int)", [](auto& tree, int i) { tree.try_emplace(Test{i}, i); });
+
+  count("emplace(int, int)", [](auto& tree, int i) { tree.emplace(i, i); });
+
+  count("emplace(piecewise_construct, ...)", [](auto& tree, int i) {
+         tree.emplace(piecewise_construct, forward_as_tuple(i), forward_as_tuple(i)); });
+
+  count("insert(pair<Test, Test>&&)", [](auto& tree, int i) { tree.insert(pair<Test, Test>{i, i}); });
+
+  count("insert(pair<const Test, Test>&&) (key const)", [](auto& tree, int i) { tree.insert(pair<const Test, Test>{i, i}); });
+
+  count("operator[](Key&&) = value", [](auto& tree, int i) { tree[Test{i}] = Test{i}; });
+
+  // Repeating a key: try_emplace() leaves its arguments alone, insert_or_assign() move-assigns the value.
+  count("try_emplace(existing key, Test&&)", [](auto& tree, int i) { tree.try_emplace(Test{0}, Test{i}); });
+
+  count("insert_or_assign(existing key, Test&&)", [](auto& tree, int i) { tree.insert_or_assign(Test{0}, Test{i}); });
+
+  double by_copy = time_inserts([](auto& tree, int key, vector<char>& buffer) { tree.insert(key, buffer); });
+
+  double by_move = time_inserts([](auto& tree, int key, vector<char>& buffer) { tree.insert_or_assign(key, std::move(buffer)); });
+
+  cout << "\n4 KiB values: insert(key, const value&) " << by_copy << " ns/op, insert_or_assign(key, value&&) " << by_move << " ns/op\n";
+
+  return 0;
+}
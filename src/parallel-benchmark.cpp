@@ -0,0 +1,223 @@
+#include <cstdlib>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+#include <vector>
+#include <string>
+#include <random>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include "bst.h"
+#include "thread-pool.h"
+
+using namespace std;
+
+/*
+ * Compares the sequential in-order traversal (inOrderTraverse(), i.e. DoInOrderTraverse()) with parallel_for_each() and
+ * parallel_reduce() on a red-black bstree of random keys, for 1, 2, 4, ... N worker threads. It also times clone() on each pool
+ * against clone() on one worker, the destruction of a copy with and without deferred destruction, and set_union() against
+ * parallel_union() for a second tree of the same size and for one of a hundredth of the size.
+ *
+ *    parallel-benchmark [--keys=10M] [--threads=N] [--work=0]
+ *
+ * --keys accepts K and M suffixes. --work adds that many rounds of integer hashing per element, to model a fold that does more
+ * than add up the values; with --work=0 the traversals are bound by memory latency.
+ */
+
+struct options {
+
+   size_t keys = 10'000'000;
+   unsigned threads = max(1u, thread::hardware_concurrency());
+   int work = 0;
+};
+
+volatile uint64_t sink; // Keeps the optimizer from discarding the results.
+
+uint64_t mix(uint64_t x, int rounds)
+{
+  for (int i = 0; i < rounds; ++i) {
+
+      x ^= x >> 33;
+      x *= 0xff51afd7ed558ccdULL;
+      x ^= x >> 33;
+  }
+
+  return x;
+}
+
+template<class F> double time_ms(F f)
+{
+  auto begin = chrono::steady_clock::now();
+
+  f();
+
+  return chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+}
+
+void report(const string& name, unsigned threads, double ms, double sequential_ms)
+{
+  cout << left << setw(28) << name << " threads=" << setw(4) << threads << right << fixed << setprecision(1) << setw(10) << ms
+       << " ms" << setprecision(2) << setw(8) << sequential_ms / ms << "x\n" << flush;
+}
+
+int main(int argc, char** argv)
+{
+  options opt;
+
+  for (int i = 1; i < argc; ++i) {
+
+      string arg = argv[i];
+      size_t eq = arg.find('=');
+      string value = eq == string::npos ? "" : arg.substr(eq + 1);
+
+      if (arg.compare(0, eq, "--keys") == 0 && !value.empty())
+          opt.keys = stoul(value) * (value.back() == 'M' ? 1'000'000 : value.back() == 'K' ? 1'000 : 1);
+      else if (arg.compare(0, eq, "--threads") == 0 && !value.empty())
+          opt.threads = max(1, stoi(value));
+      else if (arg.compare(0, eq, "--work") == 0 && !value.empty())
+          opt.work = stoi(value);
+      else {
+          cerr << "usage: " << argv[0] << " [--keys=10M] [--threads=N] [--work=0]\n";
+          return 1;
+      }
+  }
+
+  bstree<uint64_t, uint64_t, less<uint64_t>, red_black> tree;
+
+  mt19937_64 g{42};
+
+  while (tree.size() < opt.keys) {
+
+      uint64_t k = g();
+      tree.insert_or_assign(k, k);
+  }
+
+  const int work = opt.work;
+
+  auto step = [work](uint64_t acc, const auto& pair) { return acc + mix(pair.second, work); };
+  auto add = [](uint64_t a, uint64_t b) { return a + b; };
+
+  uint64_t expected = 0;
+
+  double sequential_ms = time_ms([&] {
+     tree.inOrderTraverse([&](const auto& pair) { expected = step(expected, pair); });
+  });
+
+  cout << opt.keys << " keys, height " << tree.height() << ", work=" << opt.work << '\n';
+
+  report("inOrderTraverse", 1, sequential_ms, sequential_ms);
+
+  double clone_ms = 0;
+
+  for (unsigned n = 1; ; n = min(2 * n, opt.threads)) {
+
+      work_stealing_pool pool{n};
+
+      uint64_t sum = 0;
+
+      double ms = time_ms([&] { sum = tree.parallel_reduce(uint64_t{0}, step, add, true, pool); });
+
+      if (sum != expected) {
+          cerr << "parallel_reduce: wrong result\n";
+          return 1;
+      }
+
+      report("parallel_reduce", n, ms, sequential_ms);
+
+      ms = time_ms([&] { sum = tree.parallel_reduce(uint64_t{0}, step, add, false, pool); });
+
+      report("parallel_reduce(unordered)", n, ms, sequential_ms);
+
+      atomic<uint64_t> total{0};
+
+      // Counts one element in 1024, so that the shared counter is rarely written.
+      ms = time_ms([&] {
+         tree.parallel_for_each([&](const auto& pair) {
+            if (mix(pair.second, work) % 1024 == 0)
+                total.fetch_add(1, memory_order_relaxed);
+         }, pool);
+      });
+
+      report("parallel_for_each", n, ms, sequential_ms);
+
+      sink = sum + total;
+
+      decltype(tree) copy;
+
+      ms = time_ms([&] { copy = tree.clone(pool); });
+
+      if (n == 1)
+          clone_ms = ms;
+
+      report("clone", n, ms, clone_ms);
+
+      if (n == opt.threads)
+          break;
+  }
+
+  // The second trees share the first one's pool, and so do the copies made for each run (a copy constructed from a tree gets a pool of
+  // its own; copy assignment keeps the target's allocator), so that parallel_union() can relink the nodes of both.
+  for (size_t other_keys : {opt.keys, opt.keys / 100}) {
+
+      decltype(tree) other(less<uint64_t>(), tree.get_allocator());
+
+      while (other.size() < other_keys) {
+
+          uint64_t k = g();
+          other.insert_or_assign(k, k);
+      }
+
+      size_t expected_size = 0;
+
+      double union_ms = time_ms([&] { expected_size = decltype(tree)::set_union(tree, other).size(); });
+
+      string name = "set_union (1:" + to_string(opt.keys / other_keys) + ")";
+
+      report(name, 1, union_ms, union_ms);
+
+      for (unsigned n = 1; ; n = min(2 * n, opt.threads)) {
+
+          work_stealing_pool pool{n};
+
+          decltype(tree) lhs(less<uint64_t>(), tree.get_allocator()), rhs(less<uint64_t>(), tree.get_allocator());
+
+          lhs = tree;
+          rhs = other;
+
+          size_t size = 0;
+
+          double ms = time_ms([&] { size = decltype(tree)::parallel_union(move(lhs), move(rhs), pool).size(); });
+
+          if (size != expected_size) {
+              cerr << "parallel_union: wrong result\n";
+              return 1;
+          }
+
+          report("parallel_union (1:" + to_string(opt.keys / other_keys) + ")", n, ms, union_ms);
+
+          if (n == opt.threads)
+              break;
+      }
+  }
+
+  // The copies use std::allocator: a tree whose nodes are trivially destructible and come from its own pool is freed at once anyway.
+  using heap_tree = bstree<uint64_t, uint64_t, less<uint64_t>, red_black, allocator<pair<const uint64_t, uint64_t>>>;
+
+  for (bool deferred : {false, true}) {
+
+      auto copy = make_unique<heap_tree>(heap_tree::from_sorted(tree.begin(), tree.end()));
+
+      copy->set_deferred_destruction(deferred);
+
+      double ms = time_ms([&] { copy.reset(); });
+
+      cout << left << setw(28) << (deferred ? "~bstree (deferred)" : "~bstree") << right << fixed << setprecision(1) << setw(24) << ms
+           << " ms\n";
+  }
+
+  return 0;
+}
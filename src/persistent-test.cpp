@@ -0,0 +1,237 @@
+#include <cstdlib>
+#include <cstddef>
+#include <cmath>
+#include <utility>
+#include <iterator>
+#include <vector>
+#include <map>
+#include <string>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <stdexcept>
+#include <iostream>
+#include "persistent-bst.h"
+
+using namespace std;
+
+/*
+ * Checks persistent_bstree against std::map. Random insert_or_assign() and remove() calls must return what the map says, lookup(),
+ * floor() and ceiling() must agree with the map's find(), upper_bound() and lower_bound() (throwing where the map has no answer),
+ * and the height must stay within the AVL bound of 1.44 log2(n + 2). A snapshot and the tree it was taken from are then both
+ * written to, and each must hold only its own writes. Last, reader threads walk and query snapshots while the main thread keeps
+ * writing to the tree they were taken from; build with -fsanitize=thread to have data races reported.
+ *
+ *    persistent-test [--ops=200K]
+ *
+ * --ops, the number of mutations per phase, accepts K and M suffixes. Exits with status 1 if any check fails.
+ */
+
+using tree_type = persistent_bstree<int, int>;
+
+constexpr int key_range = 50'000;
+
+int failures = 0;
+
+void expect(bool passed, const string& what)
+{
+  if (!passed) {
+      cerr << "persistent-test: " << what << " failed\n";
+      ++failures;
+  }
+}
+
+bool same(const tree_type& tree, const map<int, int>& expected)
+{
+  bool equal = tree.size() == expected.size();
+  auto it = expected.begin();
+
+  tree.inOrderTraverse([&](int key, int value) {
+     equal = equal && it != expected.end() && it->first == key && it->second == value;
+     if (it != expected.end())
+         ++it;
+  });
+
+  return equal && it == expected.end();
+}
+
+bool within_avl_bound(const tree_type& tree)
+{
+  // height() counts edges; the AVL bound is on nodes.
+  return tree.height() + 1 <= 1.4405 * log2(static_cast<double>(tree.size()) + 2);
+}
+
+// Random insert_or_assign() and remove() calls on tree, mirrored in expected. Returns false if a call's result disagrees.
+bool mutate(tree_type& tree, map<int, int>& expected, mt19937& g, size_t ops)
+{
+  bool agreed = true;
+
+  for (size_t i = 0; i < ops; ++i) {
+
+      int key = static_cast<int>(g() % key_range);
+
+      if (g() % 3) {
+
+          bool inserted = expected.insert_or_assign(key, static_cast<int>(i)).second;
+
+          agreed &= tree.insert_or_assign(key, static_cast<int>(i)) == inserted;
+
+      } else
+          agreed &= tree.remove(key) == (expected.erase(key) == 1);
+  }
+
+  return agreed;
+}
+
+// Compares lookup(), floor() and ceiling() on random keys with the map. Thread safe as long as nobody writes to tree.
+bool queries_agree(const tree_type& tree, const map<int, int>& expected, mt19937& g, size_t queries)
+{
+  bool agreed = true;
+
+  for (size_t i = 0; i < queries; ++i) {
+
+      int key = static_cast<int>(g() % (key_range + 2)) - 1; // also one below and one above every possible key
+
+      auto found = expected.find(key);
+      const int *value = tree.lookup(key);
+
+      agreed &= found == expected.end() ? value == nullptr : value && *value == found->second;
+      agreed &= tree.find(key) == (found != expected.end());
+
+      // floor() and ceiling() throw where the map has no answer.
+      auto above = expected.upper_bound(key);
+      auto below = expected.lower_bound(key);
+
+      try {
+          agreed &= tree.floor(key) == (above == expected.begin() ? key_range : prev(above)->first);
+      } catch (const logic_error&) {
+          agreed &= above == expected.begin();
+      }
+
+      try {
+          agreed &= tree.ceiling(key) == (below == expected.end() ? key_range : below->first);
+      } catch (const logic_error&) {
+          agreed &= below == expected.end();
+      }
+  }
+
+  return agreed;
+}
+
+int main(int argc, char** argv)
+{
+  size_t ops = 200'000;
+
+  for (int i = 1; i < argc; ++i) {
+
+      string arg = argv[i];
+      size_t eq = arg.find('=');
+      string value = eq == string::npos ? "" : arg.substr(eq + 1);
+
+      if (arg.compare(0, eq, "--ops") == 0 && !value.empty())
+          ops = stoul(value) * (value.back() == 'M' ? 1'000'000 : value.back() == 'K' ? 1'000 : 1);
+      else {
+          cerr << "usage: " << argv[0] << " [--ops=200K]\n";
+          return 1;
+      }
+  }
+
+  mt19937 g{1};
+
+  tree_type tree;
+  map<int, int> expected;
+
+  expect(tree.height() == -1 && within_avl_bound(tree), "empty tree");
+
+  // Ascending keys are the worst case for an unbalanced tree, so start with them.
+  for (int key = 0; key < key_range; key += 2) {
+      tree.insert_or_assign(key, key);
+      expected.emplace(key, key);
+  }
+
+  expect(same(tree, expected) && within_avl_bound(tree), "ascending inserts");
+
+  expect(mutate(tree, expected, g, ops), "insert_or_assign() and remove() results");
+  expect(same(tree, expected), "contents after random writes");
+  expect(within_avl_bound(tree), "height bound after random writes");
+  expect(queries_agree(tree, expected, g, ops), "lookup(), floor() and ceiling()");
+
+  // Write to a snapshot and to its origin: neither may see the other's writes.
+  tree_type snapshot = tree.snapshot();
+  map<int, int> snapshot_expected = expected;
+
+  expect(same(snapshot, snapshot_expected), "snapshot contents");
+
+  mt19937 h{2};
+
+  expect(mutate(tree, expected, g, ops / 2) && mutate(snapshot, snapshot_expected, h, ops / 2), "interleaved writes");
+  expect(mutate(snapshot, snapshot_expected, h, ops / 2) && mutate(tree, expected, g, ops / 2), "interleaved writes");
+
+  expect(same(tree, expected), "origin independent of its snapshot");
+  expect(same(snapshot, snapshot_expected), "snapshot independent of its origin");
+  expect(within_avl_bound(tree) && within_avl_bound(snapshot), "height bound after snapshot writes");
+
+  // Emptying a snapshot of the snapshot must leave the snapshot whole.
+  tree_type emptied = snapshot.snapshot();
+
+  for (const auto& [key, value] : snapshot_expected)
+      emptied.remove(key);
+
+  expect(emptied.isEmpty() && emptied.size() == 0, "removing every key");
+  expect(same(snapshot, snapshot_expected), "snapshot after its origin was emptied");
+
+  // Readers on snapshots, one per version, while the main thread keeps writing to the tree they came from.
+  unsigned readers = max(2u, thread::hardware_concurrency() - 1);
+
+  vector<pair<tree_type, map<int, int>>> versions;
+
+  for (unsigned r = 0; r < readers; ++r) {
+
+      versions.emplace_back(tree.snapshot(), expected);
+
+      mutate(tree, expected, g, ops / readers);
+  }
+
+  atomic<bool> writing{true};
+  atomic<int> reader_failures{0};
+
+  vector<thread> threads;
+
+  for (unsigned r = 0; r < readers; ++r)
+      threads.emplace_back([&, r] {
+         mt19937 local{100 + r};
+         const auto& [version, version_expected] = versions[r];
+
+         do {
+             if (!same(version, version_expected) || !queries_agree(version, version_expected, local, 1'000))
+                 ++reader_failures;
+
+         } while (writing.load());
+      });
+
+  bool agreed = mutate(tree, expected, g, ops);
+
+  // Drop the versions' nodes from the origin as well, so that the writer frees nodes while readers still hold them.
+  for (int key = 0; key < key_range; ++key) {
+      tree.remove(key);
+      expected.erase(key);
+  }
+
+  agreed &= mutate(tree, expected, g, ops);
+
+  writing = false;
+
+  for (auto& t : threads)
+      t.join();
+
+  expect(agreed, "writes while readers hold snapshots");
+  expect(reader_failures == 0, "readers on snapshots during writes");
+  expect(same(tree, expected) && within_avl_bound(tree), "origin after concurrent reads");
+
+  for (const auto& [version, version_expected] : versions)
+      expect(same(version, version_expected), "snapshot after concurrent reads");
+
+  cout << "persistent-test: " << (failures ? "FAILED" : "passed") << '\n';
+
+  return failures ? 1 : 0;
+}